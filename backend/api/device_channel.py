@@ -0,0 +1,215 @@
+from fastapi import APIRouter, WebSocket, WebSocketDisconnect, Header, HTTPException, status
+from fastapi.concurrency import run_in_threadpool
+from pydantic import BaseModel, Field
+from typing import Awaitable, Optional
+import asyncio
+import json
+import logging
+import struct
+
+from db.database import SessionLocal
+from api.esp32_upload import _register_device, _process_image, capture_schedule
+from services.device_channels import (
+    channels, ChannelError, DeviceChannel, MESSAGE_HEADER, FRAME_HEADER,
+    MSG_METRICS, MSG_FRAME, MSG_ACK, MSG_ERROR, MSG_RESULT,
+    CMD_CAPTURE, CMD_INTERVAL, CMD_ROI, CMD_FULL_FRAME
+)
+from config import get_settings
+
+router = APIRouter(prefix="/api", tags=["esp32"])
+
+logger = logging.getLogger(__name__)
+settings = get_settings()
+
+
+def _get_channel(device_id: str) -> DeviceChannel:
+    channel = channels.get(device_id)
+    if not channel:
+        raise HTTPException(
+            status_code=status.HTTP_404_NOT_FOUND,
+            detail=f"Device {device_id} is not connected"
+        )
+    return channel
+
+
+async def _reply(request: Awaitable[dict]) -> dict:
+    """Wait for a device's reply, as an HTTP error if it doesn't come"""
+    try:
+        return await request
+    except ChannelError as e:
+        raise HTTPException(status_code=e.status_code, detail=e.detail)
+
+
+def _process_frame(device_id: str, image_data: bytes, roi: Optional[str],
+                   frame_score: Optional[int], name_suffix: str = "") -> dict:
+    """OCR and record a frame pushed over the channel, like POST /api/upload"""
+    db = SessionLocal()
+    try:
+        try:
+            result = _process_image(db, device_id, image_data, roi or None,
+                                    name_suffix=name_suffix, frame_score=frame_score)
+        except HTTPException as e:
+            return {"status": "error", "device": device_id, "error": e.detail}
+        if settings.CAPTURE_SCHEDULE_ENABLED:
+            confidence = 0.0 if result.get("ocr_failed") else result.get("confidence")
+            result["capture_interval"] = capture_schedule.next_interval(db, device_id, confidence)
+        return result
+    finally:
+        db.close()
+
+
+def _mark_seen(device_id: str, device_name: Optional[str]):
+    db = SessionLocal()
+    try:
+        _register_device(db, device_id, device_name)
+    finally:
+        db.close()
+
+
+async def _handle_frame(channel: DeviceChannel, message_id: int, payload: bytes):
+    if len(payload) < FRAME_HEADER.size:
+        logger.warning(f"ESP32 {channel.device_id} sent a truncated frame")
+        return
+    score, roi_len = FRAME_HEADER.unpack_from(payload)
+    roi = payload[FRAME_HEADER.size:FRAME_HEADER.size + roi_len].decode("ascii", "replace")
+    image_data = payload[FRAME_HEADER.size + roi_len:]
+
+    # Full frames fetched for a thumbnail are stored next to it
+    suffix = "_full" if channel.command_type(message_id) == CMD_FULL_FRAME else ""
+    result = await run_in_threadpool(_process_frame, channel.device_id, image_data, roi,
+                                     score if score >= 0 else None, suffix)
+    channel.resolve(message_id, result)
+    await channel.send(MSG_RESULT, message_id, json.dumps(result).encode())
+    if "capture_interval" in result:
+        await channel.send(CMD_INTERVAL, 0, struct.pack("<I", result["capture_interval"]))
+
+
+@router.websocket("/device/channel")
+async def device_channel(
+    websocket: WebSocket,
+    device_id: str = Header(None, alias="X-Device-ID"),
+    device_name: str = Header(None, alias="X-Device-Name")
+):
+    """
+    Persistent connection opened by an ESP32. The device pushes metrics and
+    frames; the endpoints below send it capture and config commands.
+    """
+    if not device_id:
+        await websocket.close(code=1008)
+        return
+    await websocket.accept()
+    await run_in_threadpool(_mark_seen, device_id, device_name)
+
+    previous = channels.get(device_id)
+    if previous:
+        previous.close()
+    channel = DeviceChannel(websocket, device_id)
+    channels[device_id] = channel
+    logger.info(f"ESP32 {device_id} channel connected")
+
+    try:
+        while True:
+            message = await websocket.receive_bytes()
+            if len(message) < MESSAGE_HEADER.size:
+                continue
+            msg_type, message_id = MESSAGE_HEADER.unpack_from(message)
+            payload = message[MESSAGE_HEADER.size:]
+
+            if msg_type == MSG_METRICS:
+                channel.metrics = payload.decode("ascii", "replace")
+                logger.info(f"ESP32 {device_id} metrics: {channel.metrics}")
+                await run_in_threadpool(_mark_seen, device_id, device_name)
+            elif msg_type == MSG_FRAME:
+                await _handle_frame(channel, message_id, payload)
+            elif msg_type == MSG_ACK:
+                channel.resolve(message_id, {"status": "applied", "device": device_id})
+            elif msg_type == MSG_ERROR:
+                channel.resolve(message_id, {
+                    "status": "error",
+                    "device": device_id,
+                    "error": payload.decode("ascii", "replace")
+                })
+            else:
+                logger.warning(f"ESP32 {device_id} sent unknown message type {msg_type:#x}")
+    except WebSocketDisconnect:
+        pass
+    finally:
+        channel.close()
+        if channels.get(device_id) is channel:
+            del channels[device_id]
+        logger.info(f"ESP32 {device_id} channel disconnected")
+
+
+@router.get("/device/channels")
+async def list_channels():
+    """Devices connected over the channel right now"""
+    return {
+        "count": len(channels),
+        "devices": [
+            {
+                "device": channel.device_id,
+                "connected_at": channel.connected_at,
+                "metrics": channel.metrics
+            }
+            for channel in channels.values()
+        ]
+    }
+
+
+@router.post("/device/{device_id}/capture")
+async def capture_on_device(device_id: str):
+    """Have a connected device take a reading now; returns the OCR result"""
+    channel = _get_channel(device_id)
+    return await _reply(channel.request(CMD_CAPTURE, b"", settings.CHANNEL_CAPTURE_TIMEOUT_S))
+
+
+@router.post("/device/capture")
+async def capture_on_all_devices():
+    """Take a reading on every connected device at once"""
+    connected = list(channels.values())
+    results = await asyncio.gather(
+        *(channel.request(CMD_CAPTURE, b"", settings.CHANNEL_CAPTURE_TIMEOUT_S)
+          for channel in connected),
+        return_exceptions=True
+    )
+    return {
+        "count": len(connected),
+        "results": [
+            result if isinstance(result, dict) else {
+                "status": "error",
+                "device": channel.device_id,
+                "error": getattr(result, "detail", repr(result))
+            }
+            for channel, result in zip(connected, results)
+        ]
+    }
+
+
+class IntervalUpdate(BaseModel):
+    seconds: int = Field(..., gt=0)
+
+
+@router.post("/device/{device_id}/interval")
+async def set_device_interval(device_id: str, update: IntervalUpdate):
+    """Change a connected device's capture interval"""
+    channel = _get_channel(device_id)
+    return await _reply(channel.request(CMD_INTERVAL, struct.pack("<I", update.seconds),
+                                        settings.CHANNEL_COMMAND_TIMEOUT_S))
+
+
+class RoiUpdate(BaseModel):
+    enabled: bool = True
+    x: int = Field(0, ge=0, le=0xFFFF)
+    y: int = Field(0, ge=0, le=0xFFFF)
+    w: int = Field(0, ge=0, le=0xFFFF)
+    h: int = Field(0, ge=0, le=0xFFFF)
+
+
+@router.post("/device/{device_id}/roi")
+async def set_device_roi(device_id: str, update: RoiUpdate):
+    """Change a connected device's LCD region of interest, like its /roi"""
+    channel = _get_channel(device_id)
+    width = update.w if update.enabled else 0
+    return await _reply(channel.request(CMD_ROI,
+                                        struct.pack("<HHHH", update.x, update.y, width, update.h),
+                                        settings.CHANNEL_COMMAND_TIMEOUT_S))
@@ -1,10 +1,14 @@
-from fastapi import APIRouter, Request, Header, HTTPException, status, Depends
+from fastapi import APIRouter, BackgroundTasks, Request, Response, Header, HTTPException, status, Depends
 from sqlalchemy.orm import Session
-from datetime import datetime
+from datetime import datetime, timedelta
 from io import BytesIO
+from PIL import Image
+from typing import Optional
+import json
 import logging
+import struct
 
-from db.database import get_db
+from db.database import get_db, SessionLocal
 from db import crud
 from models.reading import ReadingCreate, SourceType
 from models.device import DeviceUpdate
@@ -12,9 +16,20 @@ from services.ocr import OCRService
 from services.ocr_orchestrator import OCROrchestrator, OCRStrategy
 from services.storage import StorageService
 from services.pricing import PricingService
+from services.validation import ValidationService
+from services.capture_schedule import CaptureScheduleService
+from services.device_channels import channels as device_channels, ChannelError, CMD_FULL_FRAME
 from config import get_settings
 
 router = APIRouter(prefix="/api", tags=["esp32"])
+
+# Image formats the firmware uploads, by Content-Type: whether the device
+# already binarized the image. Bitmaps are stored as PNG so the dashboard
+# can show them.
+ESP32_IMAGE_FORMATS = {
+    "image/jpeg": False,
+    "image/x-portable-bitmap": True,
+}
 logger = logging.getLogger(__name__)
 
 settings = get_settings()
@@ -22,31 +37,18 @@ ocr_orchestrator = OCROrchestrator(settings.TESSERACT_PATH)
 ocr_service = OCRService(settings.TESSERACT_PATH)  # Keep for backward compatibility
 storage_service = StorageService(settings.UPLOAD_DIRECTORY, settings.S3_BUCKET_NAME, settings.AWS_REGION)
 pricing_service = PricingService(settings.PRICE_PER_KWH)
+validation_service = ValidationService(settings.ALLOWED_DEVICE_IDS.split(','))
+capture_schedule = CaptureScheduleService(
+    settings.CAPTURE_INTERVAL_MIN_S,
+    settings.CAPTURE_INTERVAL_MAX_S,
+    settings.CAPTURE_INTERVAL_DEFAULT_S,
+    settings.CAPTURE_KWH_PER_READING,
+    settings.CAPTURE_RATE_WINDOW_HOURS,
+    settings.OCR_CONFIDENCE_THRESHOLD
+)
 
-@router.post("/upload")
-async def upload_from_esp32(
-    request: Request,
-    device_id: str = Header(None, alias="X-Device-ID"),
-    device_name: str = Header(None, alias="X-Device-Name"),
-    db: Session = Depends(get_db)
-):
-    """ESP32-CAM upload endpoint matching embedded/esp32-cam/API.md spec"""
-    
-    if not device_id:
-        raise HTTPException(
-            status_code=status.HTTP_400_BAD_REQUEST,
-            detail="X-Device-ID header required"
-        )
-    
-    # Get image data
-    image_data = await request.body()
-    if not image_data:
-        raise HTTPException(
-            status_code=status.HTTP_400_BAD_REQUEST,
-            detail="No image data received"
-        )
-    
-    # Update device info
+def _register_device(db: Session, device_id: str, device_name: Optional[str]):
+    """Create the device on first contact and record that it was seen"""
     device = crud.get_device(db, device_id)
     if not device:
         device = crud.create_device(db, device_id, device_name)
@@ -56,10 +58,70 @@ async def upload_from_esp32(
         name=device_name
     )
     crud.update_device(db, device_id, device_update)
+
+
+def _set_capture_interval(response: Response, db: Session, device_id: str,
+                          confidence: Optional[float] = None):
+    """Tell the device when to capture next (see CaptureScheduleService)"""
+    if not settings.CAPTURE_SCHEDULE_ENABLED:
+        return
+    interval = capture_schedule.next_interval(db, device_id, confidence)
+    response.headers["X-Capture-Interval"] = str(interval)
+
+
+async def _fetch_full_frame(device_id: str, seq: int, thumbnail_reading_id: Optional[int]):
+    """
+    Have the device send the full frame behind an uncertain thumbnail over
+    its channel. Its OCR result replaces the thumbnail's reading.
+    """
+    channel = device_channels.get(device_id)
+    if not channel:
+        return
+    try:
+        result = await channel.request(CMD_FULL_FRAME, struct.pack("<I", seq),
+                                       settings.CHANNEL_CAPTURE_TIMEOUT_S)
+    except ChannelError as e:
+        logger.warning(f"ESP32 {device_id} full frame {seq} not fetched: {e.detail}")
+        return
+    if result.get("status") == "error":
+        logger.warning(f"ESP32 {device_id} full frame {seq} not fetched: {result.get('error')}")
+        return
+    logger.info(f"ESP32 {device_id} full frame {seq}: reading={result.get('reading')}, "
+               f"confidence={result.get('confidence')}")
+    if thumbnail_reading_id and result.get("reading_id"):
+        db = SessionLocal()
+        try:
+            db.query(crud.models.Reading).filter(
+                crud.models.Reading.id == thumbnail_reading_id
+            ).delete()
+            db.commit()
+        finally:
+            db.close()
+
+
+def _process_image(
+    db: Session,
+    device_id: str,
+    image_data: bytes,
+    roi: Optional[str] = None,
+    captured_at: Optional[datetime] = None,
+    name_suffix: str = "",
+    content_type: str = "image/jpeg",
+    frame_score: Optional[int] = None
+) -> dict:
+    """Save, OCR and record one ESP32 image. Raises HTTPException if the image can't be saved."""
+    captured_at = captured_at or datetime.utcnow()
+    binarized = ESP32_IMAGE_FORMATS[content_type]
+    extension = "jpg"
     
     # Save raw image
     try:
-        filename = f"esp32_{device_id}_{datetime.utcnow().strftime('%Y%m%d_%H%M%S')}.jpg"
+        if binarized:
+            png_buffer = BytesIO()
+            Image.open(BytesIO(image_data)).save(png_buffer, format='PNG')
+            image_data = png_buffer.getvalue()
+            extension = "png"
+        filename = f"esp32_{device_id}_{captured_at.strftime('%Y%m%d_%H%M%S')}{name_suffix}.{extension}"
         photo_path = storage_service.save_raw_image(
             image_data, filename, device_id
         )
@@ -74,17 +136,26 @@ async def upload_from_esp32(
     try:
         full_path = storage_service.get_full_path(photo_path)
 
+        # Frames cropped on the device skip meter-type detection and LCD search;
+        # ones the device scored as blurred or glared go to heavier preprocessing
+        if frame_score is not None and frame_score < settings.OCR_LOW_SCORE_THRESHOLD:
+            strategy = OCRStrategy(settings.OCR_LOW_SCORE_STRATEGY)
+        elif roi:
+            strategy = OCRStrategy(settings.OCR_CROPPED_STRATEGY)
+        else:
+            strategy = OCRStrategy(settings.OCR_DEFAULT_STRATEGY)
+
         # Use orchestrator with fallback for ESP32 images
         if settings.OCR_ENABLE_FALLBACK:
             ocr_result = ocr_orchestrator.process_with_fallback(
                 full_path,
-                primary_strategy=OCRStrategy(settings.OCR_DEFAULT_STRATEGY),
+                primary_strategy=strategy,
                 confidence_threshold=settings.OCR_CONFIDENCE_THRESHOLD
             )
         else:
             ocr_result = ocr_orchestrator.extract_reading(
                 full_path,
-                strategy=OCRStrategy(settings.OCR_DEFAULT_STRATEGY)
+                strategy=strategy
             )
 
         reading_value = ocr_result.reading_kwh
@@ -102,8 +173,11 @@ async def upload_from_esp32(
                 "message": f"Image saved but OCR failed. Strategy: {ocr_result.strategy_used}"
             }
 
-        # Save processed image
-        processed_img = ocr_service.preprocess_image(full_path)
+        # Save processed image; a device bitmap already is one
+        if binarized:
+            processed_img = Image.open(full_path).convert("L")
+        else:
+            processed_img = ocr_service.preprocess_image(full_path)
         img_buffer = BytesIO()
         processed_img.save(img_buffer, format='PNG')
         processed_path = storage_service.save_processed_image(
@@ -121,14 +195,14 @@ async def upload_from_esp32(
     
     # Create reading record
     reading_data = ReadingCreate(
-        timestamp=datetime.utcnow(),
+        timestamp=captured_at,
         reading_kwh=reading_value,
         photo_path=photo_path,
         processed_photo_path=processed_path,
         source=SourceType.DEVICE,
         device_id=device_id,
         ocr_confidence=confidence,
-        price_per_kwh=pricing_service.get_current_price(datetime.utcnow())
+        price_per_kwh=pricing_service.get_current_price(captured_at)
     )
     
     reading = crud.create_reading(db, reading_data)
@@ -139,4 +213,393 @@ async def upload_from_esp32(
         "reading": reading_value,
         "confidence": confidence,
         "reading_id": reading.id
-    }
\ No newline at end of file
+    }
+
+
+def _parse_meters(text: Optional[str]) -> list:
+    """Meter regions as the device describes them: meter, name and "x,y,w,h" roi"""
+    try:
+        meters = json.loads(text or "[]")
+        for meter in meters:
+            if not meter["meter"] or len([int(v) for v in meter["roi"].split(",")]) != 4:
+                raise ValueError
+    except (ValueError, KeyError, TypeError, AttributeError):
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="Invalid meter regions"
+        )
+    return meters
+
+
+def _crop_meters(image_data: bytes, meters: list, scale: int = 1) -> list:
+    """Cut a whole frame into one grayscale JPEG per meter, as the device does.
+
+    `scale` is how many times smaller than the sensor frame it was stored,
+    which the meter regions are given in.
+    """
+    image = Image.open(BytesIO(image_data)).convert("L")
+    crops = []
+    for meter in meters:
+        x, y, w, h = (int(v) // scale for v in meter["roi"].split(","))
+        buffer = BytesIO()
+        image.crop((x, y, x + w, y + h)).save(buffer, format="JPEG", quality=90)
+        crops.append(buffer.getvalue())
+    return crops
+
+
+def _process_meters(db: Session, device_id: str, device_name: Optional[str], meters: list,
+                    crops: list, captured_at: Optional[datetime] = None,
+                    name_suffix: str = "") -> list:
+    """OCR and record each meter's crop under the meter's own ID"""
+    results = []
+    for meter, image_data in zip(meters, crops):
+        meter_id = meter["meter"]
+        _register_device(db, meter_id, f"{device_name or device_id} {meter.get('name', meter_id)}")
+        try:
+            result = _process_image(db, meter_id, image_data, meter["roi"], captured_at,
+                                    name_suffix=name_suffix)
+        except HTTPException as e:
+            result = {"status": "failed", "device": meter_id, "error": e.detail}
+        result["meter"] = meter_id
+        result["name"] = meter.get("name")
+        results.append(result)
+    return results
+
+
+@router.post("/upload")
+async def upload_from_esp32(
+    request: Request,
+    response: Response,
+    background_tasks: BackgroundTasks,
+    device_id: str = Header(None, alias="X-Device-ID"),
+    device_name: str = Header(None, alias="X-Device-Name"),
+    roi: str = Header(None, alias="X-ROI"),
+    edge_reading: str = Header(None, alias="X-Edge-Reading"),
+    edge_confidence: str = Header(None, alias="X-Edge-Confidence"),
+    frame_score: Optional[int] = Header(None, alias="X-Frame-Score"),
+    content_type: str = Header("image/jpeg"),
+    device_metrics: str = Header(None, alias="X-Device-Metrics"),
+    slow_trace: str = Header(None, alias="X-Slow-Trace"),
+    firmware_trial: str = Header(None, alias="X-Firmware-Trial"),
+    frame_seq: Optional[int] = Header(None, alias="X-Frame-Seq"),
+    full_size: Optional[int] = Header(None, alias="X-Full-Size"),
+    db: Session = Depends(get_db)
+):
+    """ESP32-CAM upload endpoint matching embedded/esp32-cam/API.md spec"""
+    
+    if not device_id:
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="X-Device-ID header required"
+        )
+    
+    content_type = content_type.split(";")[0].strip().lower()
+    if content_type not in ESP32_IMAGE_FORMATS:
+        raise HTTPException(
+            status_code=status.HTTP_415_UNSUPPORTED_MEDIA_TYPE,
+            detail=f"Unsupported image type: {content_type}"
+        )
+    
+    # Get image data
+    image_data = await request.body()
+    if not image_data:
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="No image data received"
+        )
+    
+    if device_metrics:
+        logger.info(f"ESP32 {device_id} metrics: {device_metrics}")
+    if slow_trace:
+        logger.warning(f"ESP32 {device_id} slow reading (ms per stage): {slow_trace}")
+    if firmware_trial:
+        logger.info(f"ESP32 {device_id} health check of new firmware in {firmware_trial}")
+    if edge_reading:
+        logger.info(f"ESP32 {device_id} edge OCR was unsure: {edge_reading} ({edge_confidence}%)")
+    
+    _register_device(db, device_id, device_name)
+    result = _process_image(db, device_id, image_data, roi, content_type=content_type,
+                            frame_score=frame_score)
+    
+    # A thumbnail OCR isn't sure about: fetch the full frame the device kept
+    if frame_seq is not None:
+        logger.info(f"ESP32 {device_id} thumbnail of frame {frame_seq}: "
+                   f"{len(image_data)} of {full_size} bytes")
+        uncertain = result.get("ocr_failed") or \
+            result.get("confidence", 0) < settings.OCR_CONFIDENCE_THRESHOLD
+        if uncertain and settings.THUMBNAIL_FETCH_FULL_FRAMES and device_id in device_channels:
+            background_tasks.add_task(_fetch_full_frame, device_id, frame_seq,
+                                      result.get("reading_id"))
+            result["full_frame_requested"] = True
+    # A frame OCR couldn't read counts as an uncertain reading
+    _set_capture_interval(response, db, device_id,
+                          0.0 if result.get("ocr_failed") else result.get("confidence"))
+    return result
+
+
+@router.post("/upload/meters")
+async def upload_meters_from_esp32(
+    request: Request,
+    response: Response,
+    device_id: str = Header(None, alias="X-Device-ID"),
+    device_name: str = Header(None, alias="X-Device-Name"),
+    device_metrics: str = Header(None, alias="X-Device-Metrics"),
+    slow_trace: str = Header(None, alias="X-Slow-Trace"),
+    db: Session = Depends(get_db)
+):
+    """
+    One capture of an ESP32 with several meters in view, cut into a crop
+    per meter on the device.
+
+    multipart/form-data with a "manifest" JSON field - entries with
+    "meter" (the meter ID readings are recorded under), "name" and "roi"
+    ("x,y,w,h" in the frame) - followed by one "frames" JPEG per entry,
+    in the same order.
+    """
+    if not device_id:
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="X-Device-ID header required"
+        )
+    
+    form = await request.form()
+    meters = _parse_meters(form.get("manifest"))
+    frames = form.getlist("frames")
+    if not frames or len(frames) != len(meters):
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="Manifest and frames don't match"
+        )
+    
+    if device_metrics:
+        logger.info(f"ESP32 {device_id} metrics: {device_metrics}")
+    if slow_trace:
+        logger.warning(f"ESP32 {device_id} slow reading (ms per stage): {slow_trace}")
+    _register_device(db, device_id, device_name)
+    crops = [await frame.read() for frame in frames]
+    results = _process_meters(db, device_id, device_name, meters, crops)
+    logger.info(f"ESP32 {device_id} meters: " + ", ".join(
+        f"{r['meter']}={r.get('reading')}" for r in results))
+    
+    # The device captures for all its meters at once: as often as the
+    # busiest or least certain one needs
+    if settings.CAPTURE_SCHEDULE_ENABLED:
+        response.headers["X-Capture-Interval"] = str(min(
+            capture_schedule.next_interval(
+                db, r["meter"], 0.0 if r.get("ocr_failed") else r.get("confidence"))
+            for r in results
+        ))
+    
+    return {
+        "status": "received",
+        "device": device_id,
+        "count": len(results),
+        "results": results
+    }
+
+
+@router.post("/upload/reading")
+async def reading_from_esp32(
+    request: Request,
+    response: Response,
+    device_id: str = Header(None, alias="X-Device-ID"),
+    device_name: str = Header(None, alias="X-Device-Name"),
+    db: Session = Depends(get_db)
+):
+    """
+    Reading decoded on the ESP32 (edge OCR), sent instead of the image when
+    the device is confident. JSON body with "reading" (kWh), "digits" and
+    "confidence" (0-100). Rejecting it makes the device upload the image.
+    """
+    if not device_id:
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="X-Device-ID header required"
+        )
+    
+    try:
+        data = await request.json()
+        reading_value = float(data["reading"])
+        confidence = float(data.get("confidence", 0))
+    except (ValueError, KeyError, TypeError):
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="Invalid reading"
+        )
+    
+    # A misread digit on the device would otherwise go straight into the data
+    previous = crud.get_latest_reading(db, device_id)
+    is_valid, error_msg = validation_service.validate_reading_value(
+        reading_value,
+        previous.reading_kwh if previous else None,
+        datetime.utcnow() - previous.timestamp if previous else None
+    )
+    if not is_valid:
+        logger.warning(f"ESP32 {device_id} edge reading {reading_value} rejected: {error_msg}")
+        raise HTTPException(
+            status_code=status.HTTP_422_UNPROCESSABLE_ENTITY,
+            detail=error_msg
+        )
+    
+    _register_device(db, device_id, device_name)
+    
+    captured_at = datetime.utcnow()
+    reading_data = ReadingCreate(
+        timestamp=captured_at,
+        reading_kwh=reading_value,
+        photo_path="",  # Decoded on the device, no image sent
+        source=SourceType.DEVICE,
+        device_id=device_id,
+        ocr_confidence=min(max(confidence, 0.0), 100.0),
+        price_per_kwh=pricing_service.get_current_price(captured_at),
+        notes=f"Edge OCR: {data.get('digits', '')}"
+    )
+    reading = crud.create_reading(db, reading_data)
+    
+    logger.info(f"ESP32 edge reading from {device_id}: {reading_value} ({confidence:.0f}%)")
+    _set_capture_interval(response, db, device_id, confidence)
+    
+    return {
+        "status": "received",
+        "device": device_id,
+        "reading": reading_value,
+        "confidence": confidence,
+        "reading_id": reading.id
+    }
+
+
+@router.post("/upload/batch")
+async def upload_batch_from_esp32(
+    request: Request,
+    device_id: str = Header(None, alias="X-Device-ID"),
+    device_name: str = Header(None, alias="X-Device-Name"),
+    db: Session = Depends(get_db)
+):
+    """
+    Replay of frames an ESP32 spooled while the backend was unreachable.
+
+    multipart/form-data with a "manifest" JSON field followed by one "frames"
+    file per entry, in the same order. Each manifest entry has "seq", plus
+    "captured_at" (unix seconds, when the device clock was set) or "age_ms"
+    (how long ago it was captured), and optionally "roi". "id" names the
+    spooled frame for good: a device that didn't get the reply resends the
+    batch, and frames already recorded are answered as "duplicate". "scale"
+    says the device stored the frame that many times smaller. Devices with
+    several meters in view add a "meters" field like the /upload/meters
+    manifest; each frame is then cut into those regions here.
+    """
+    if not device_id:
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="X-Device-ID header required"
+        )
+    
+    form = await request.form()
+    try:
+        manifest = json.loads(form.get("manifest") or "[]")
+    except ValueError:
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="Invalid manifest"
+        )
+    frames = form.getlist("frames")
+    if not frames or len(frames) != len(manifest):
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="Manifest and frames don't match"
+        )
+    meters = _parse_meters(form.get("meters"))
+    
+    _register_device(db, device_id, device_name)
+    
+    received_at = datetime.utcnow()
+    results = []
+    for entry, frame in zip(manifest, frames):
+        if entry.get("captured_at"):
+            captured_at = datetime.utcfromtimestamp(entry["captured_at"])
+        elif entry.get("age_ms") is not None:
+            captured_at = received_at - timedelta(milliseconds=entry["age_ms"])
+        else:
+            captured_at = received_at
+        
+        frame_id = entry.get("id")
+        if frame_id and crud.is_frame_replayed(db, device_id, frame_id):
+            results.append({"status": "duplicate", "device": device_id, "seq": entry.get("seq")})
+            continue
+        
+        image_data = await frame.read()
+        name_suffix = f"_{entry.get('seq', len(results))}"
+        if meters:
+            try:
+                crops = _crop_meters(image_data, meters, int(entry.get("scale") or 1))
+            except Exception as e:
+                logger.error(f"Failed to crop ESP32 frame into meters: {str(e)}")
+                result = {"status": "failed", "device": device_id, "error": "Invalid image"}
+            else:
+                result = {
+                    "status": "received",
+                    "device": device_id,
+                    "results": _process_meters(db, device_id, device_name, meters, crops,
+                                               captured_at, name_suffix)
+                }
+        else:
+            try:
+                result = _process_image(
+                    db, device_id, image_data, entry.get("roi"), captured_at,
+                    name_suffix=name_suffix
+                )
+            except HTTPException as e:
+                result = {"status": "failed", "device": device_id, "error": e.detail}
+        result["seq"] = entry.get("seq")
+        results.append(result)
+        if frame_id and result["status"] != "failed":
+            crud.mark_frame_replayed(db, device_id, frame_id)
+    
+    logger.info(f"ESP32 batch from {device_id}: {len(results)} frames")
+    
+    return {
+        "status": "received",
+        "device": device_id,
+        "count": len(results),
+        "results": results
+    }
+
+
+@router.post("/upload/heartbeat")
+async def heartbeat_from_esp32(
+    request: Request,
+    response: Response,
+    device_id: str = Header(None, alias="X-Device-ID"),
+    device_name: str = Header(None, alias="X-Device-Name"),
+    device_metrics: str = Header(None, alias="X-Device-Metrics"),
+    slow_trace: str = Header(None, alias="X-Slow-Trace"),
+    db: Session = Depends(get_db)
+):
+    """
+    Sent by an ESP32 instead of an upload when the meter display hasn't
+    changed since its last frame. JSON body with "unchanged" (frames skipped
+    since the last upload) and "last_upload_age_ms".
+    """
+    if not device_id:
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="X-Device-ID header required"
+        )
+    
+    try:
+        info = await request.json()
+    except ValueError:
+        info = {}
+    if not isinstance(info, dict):
+        info = {}
+    
+    _register_device(db, device_id, device_name)
+    if device_metrics:
+        logger.info(f"ESP32 {device_id} metrics: {device_metrics}")
+    if slow_trace:
+        logger.warning(f"ESP32 {device_id} slow reading (ms per stage): {slow_trace}")
+    logger.info(f"ESP32 heartbeat from {device_id}: {info.get('unchanged')} unchanged frames, "
+               f"last upload {info.get('last_upload_age_ms')} ms ago")
+    _set_capture_interval(response, db, device_id)
+    
+    return {"status": "alive", "device": device_id}
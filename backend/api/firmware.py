@@ -0,0 +1,65 @@
+from fastapi import APIRouter, Header, HTTPException, status
+from fastapi.concurrency import run_in_threadpool
+from fastapi.responses import FileResponse
+import hashlib
+import logging
+import os
+import re
+
+from config import get_settings
+
+router = APIRouter(prefix="/api", tags=["esp32"])
+
+logger = logging.getLogger(__name__)
+settings = get_settings()
+
+# Names the firmware accepts for /ota?image=, see ota_update.h
+IMAGE_NAME = re.compile(r"^[A-Za-z0-9_-][A-Za-z0-9._-]*$")
+
+# SHA-256 per image path, keyed on modification time and size so a
+# replaced image is hashed again
+_digests: dict = {}
+
+
+def _sha256(path: str) -> str:
+    info = os.stat(path)
+    key = (info.st_mtime_ns, info.st_size)
+    cached = _digests.get(path)
+    if cached and cached[0] == key:
+        return cached[1]
+    digest = hashlib.sha256()
+    with open(path, "rb") as f:
+        for block in iter(lambda: f.read(1 << 16), b""):
+            digest.update(block)
+    _digests[path] = (key, digest.hexdigest())
+    return _digests[path][1]
+
+
+@router.get("/firmware/{image}")
+async def download_firmware(
+    image: str,
+    device_id: str = Header(None, alias="X-Device-ID")
+):
+    """Firmware image for an OTA update, with its SHA-256 in X-Firmware-SHA256.
+
+    The device streams the body straight into its inactive app slot and
+    checks the hash before booting it (embedded/esp32-cam/API.md)."""
+    if not IMAGE_NAME.match(image):
+        raise HTTPException(
+            status_code=status.HTTP_400_BAD_REQUEST,
+            detail="Invalid image name"
+        )
+    path = os.path.join(settings.FIRMWARE_DIRECTORY, image)
+    if not os.path.isfile(path):
+        raise HTTPException(
+            status_code=status.HTTP_404_NOT_FOUND,
+            detail=f"No firmware image {image}"
+        )
+
+    digest = await run_in_threadpool(_sha256, path)
+    logger.info(f"ESP32 {device_id} fetching firmware {image} ({os.path.getsize(path)} bytes)")
+    return FileResponse(
+        path,
+        media_type="application/octet-stream",
+        headers={"X-Firmware-SHA256": digest}
+    )
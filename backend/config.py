@@ -19,6 +19,25 @@ class Settings(BaseSettings):
     OCR_CONFIDENCE_THRESHOLD: float = 50.0  # Minimum confidence for accepting results
     OCR_ENABLE_FALLBACK: bool = True  # Enable fallback to other strategies
     OCR_DEBUG_MODE: bool = False  # Save preprocessed images for debugging
+    OCR_CROPPED_STRATEGY: str = "template"  # Used for device images already cropped to the LCD (X-ROI)
+    OCR_LOW_SCORE_THRESHOLD: int = 40  # Device frame score (X-Frame-Score) below which a frame counts as blurred or glared
+    OCR_LOW_SCORE_STRATEGY: str = "advanced"  # Used for those frames instead
+
+    # Device capture schedule, returned as X-Capture-Interval (seconds)
+    CAPTURE_SCHEDULE_ENABLED: bool = True
+    CAPTURE_INTERVAL_MIN_S: int = 60  # After an uncertain reading
+    CAPTURE_INTERVAL_MAX_S: int = 1800  # While the meter stands still
+    CAPTURE_INTERVAL_DEFAULT_S: int = 60  # Until there are two readings in the rate window
+    CAPTURE_KWH_PER_READING: float = 0.1  # Aim for one capture per this much consumption
+    CAPTURE_RATE_WINDOW_HOURS: float = 3.0  # Consumption rate is measured over this long
+
+    # Device channel (persistent WebSocket, api/device_channel.py)
+    CHANNEL_CAPTURE_TIMEOUT_S: float = 20.0  # Capture command until the OCR result
+    CHANNEL_COMMAND_TIMEOUT_S: float = 5.0  # Config commands until the device acknowledges
+    THUMBNAIL_FETCH_FULL_FRAMES: bool = True  # Fetch the full frame behind an uncertain thumbnail (X-Frame-Seq)
+
+    # Firmware images served to devices for OTA updates (api/firmware.py)
+    FIRMWARE_DIRECTORY: str = "./firmware"
 
     # Pricing
     PRICE_PER_KWH: float = 0.42
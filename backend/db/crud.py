@@ -36,6 +36,19 @@ def create_reading(db: Session, reading: ReadingCreate) -> models.Reading:
     db.refresh(db_reading)
     return db_reading
 
+def is_frame_replayed(db: Session, device_id: str, frame_id: str) -> bool:
+    return db.query(models.ReplayedFrame).filter(
+        models.ReplayedFrame.device_id == device_id,
+        models.ReplayedFrame.frame_id == frame_id
+    ).first() is not None
+
+def mark_frame_replayed(db: Session, device_id: str, frame_id: str) -> models.ReplayedFrame:
+    db_frame = models.ReplayedFrame(device_id=device_id, frame_id=frame_id)
+    db.add(db_frame)
+    db.commit()
+    db.refresh(db_frame)
+    return db_frame
+
 def get_readings(
     db: Session,
     skip: int = 0,
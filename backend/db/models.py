@@ -1,4 +1,4 @@
-from sqlalchemy import Column, Integer, String, Float, DateTime, Enum, Boolean, Text
+from sqlalchemy import Column, Integer, String, Float, DateTime, Enum, Boolean, Text, UniqueConstraint
 from sqlalchemy.ext.declarative import declarative_base
 from sqlalchemy.sql import func
 from datetime import datetime
@@ -36,4 +36,14 @@ class Reading(Base):
     price_per_kwh = Column(Float, nullable=False, default=0.42)
     manual_override = Column(Boolean, default=False)
     notes = Column(Text, nullable=True)
-    created_at = Column(DateTime(timezone=True), server_default=func.now())
\ No newline at end of file
+    created_at = Column(DateTime(timezone=True), server_default=func.now())
+
+class ReplayedFrame(Base):
+    """A spooled frame already taken from a batch replay, so a resent batch isn't recorded twice"""
+    __tablename__ = "replayed_frames"
+    __table_args__ = (UniqueConstraint("device_id", "frame_id"),)
+
+    id = Column(Integer, primary_key=True)
+    device_id = Column(String, nullable=False)
+    frame_id = Column(String, nullable=False)
+    created_at = Column(DateTime(timezone=True), server_default=func.now())
@@ -9,7 +9,7 @@ import os
 from config import get_settings
 from db.database import engine
 from db.models import Base
-from api import upload, readings, devices, esp32_upload, ocr_test
+from api import upload, readings, devices, esp32_upload, device_channel, firmware, ocr_test
 
 # Configure logging
 settings = get_settings()
@@ -59,6 +59,8 @@ app.include_router(upload.router)
 app.include_router(readings.router)
 app.include_router(devices.router)
 app.include_router(esp32_upload.router)
+app.include_router(device_channel.router)
+app.include_router(firmware.router)
 app.include_router(ocr_test.router)  # OCR testing API (no database required)
 
 # Serve static files (images)
@@ -75,6 +77,7 @@ async def root():
             "upload": "/upload",
             "readings": "/readings",
             "devices": "/devices",
+            "device_channel": "/api/device/channel",
             "ocr_testing": "/ocr",
             "docs": "/docs"
         }
@@ -0,0 +1,61 @@
+from datetime import datetime, timedelta
+from typing import Optional
+import logging
+
+from sqlalchemy.orm import Session
+
+from db import crud
+
+logger = logging.getLogger(__name__)
+
+
+class CaptureScheduleService:
+    """
+    Picks how long an ESP32 should wait before its next capture, so uploads
+    and OCR follow how fast the meter moves rather than the clock: about one
+    capture per `kwh_per_reading` consumed at the recent rate, the shortest
+    interval after an uncertain reading, the longest while nothing is used.
+    """
+
+    def __init__(self, min_interval_s: int = 60, max_interval_s: int = 1800,
+                 default_interval_s: int = 60, kwh_per_reading: float = 0.1,
+                 rate_window_hours: float = 3.0, confidence_threshold: float = 50.0):
+        self.min_interval_s = min_interval_s
+        self.max_interval_s = max_interval_s
+        self.default_interval_s = default_interval_s
+        self.kwh_per_reading = kwh_per_reading
+        self.rate_window = timedelta(hours=rate_window_hours)
+        self.confidence_threshold = confidence_threshold
+
+    def _clamp(self, seconds: float) -> int:
+        return int(min(max(seconds, self.min_interval_s), self.max_interval_s))
+
+    def consumption_rate(self, db: Session, device_id: str) -> Optional[float]:
+        """kWh per hour over the rate window, None without two readings in it"""
+        now = datetime.utcnow()
+        readings = crud.get_readings_by_date_range(db, now - self.rate_window, now, device_id)
+        if len(readings) < 2:
+            return None
+
+        first, last = readings[0], readings[-1]
+        # Measured up to now, so the rate decays while the meter stands still
+        elapsed_h = (now - first.timestamp.replace(tzinfo=None)).total_seconds() / 3600
+        if elapsed_h <= 0:
+            return None
+        return max(last.reading_kwh - first.reading_kwh, 0.0) / elapsed_h
+
+    def next_interval(self, db: Session, device_id: str,
+                      confidence: Optional[float] = None) -> int:
+        """Seconds until the device should capture again"""
+        if confidence is not None and confidence < self.confidence_threshold:
+            # Look again soon rather than keep an uncertain number for long
+            return self.min_interval_s
+
+        rate = self.consumption_rate(db, device_id)
+        if rate is None:
+            return self._clamp(self.default_interval_s)
+        if rate <= 0:
+            return self.max_interval_s
+        interval = self._clamp(self.kwh_per_reading / rate * 3600)
+        logger.debug(f"Capture schedule for {device_id}: {rate:.3f} kWh/h, next in {interval} s")
+        return interval
@@ -0,0 +1,80 @@
+from datetime import datetime
+from typing import Dict, Optional, Tuple
+import asyncio
+import struct
+
+from fastapi import WebSocket
+
+# Binary WebSocket messages, see embedded/esp32-cam/API.md "Backend channel".
+# Every message starts with a type byte and a little-endian u32 id; replies
+# to a command carry the command's id, messages nobody asked for carry 0.
+MESSAGE_HEADER = struct.Struct("<BI")
+MSG_METRICS = 0x01        # Device: metrics summary text
+MSG_FRAME = 0x02          # Device: i16 score, u8 ROI length, ROI text, JPEG
+MSG_ACK = 0x03            # Device: command applied
+MSG_ERROR = 0x04          # Device: command failed, reason text
+CMD_CAPTURE = 0x81        # Backend: take a reading and send it as MSG_FRAME
+CMD_INTERVAL = 0x82       # Backend: u32 capture interval in seconds
+CMD_ROI = 0x83            # Backend: u16 x, y, w, h; w = 0 turns the ROI off
+MSG_RESULT = 0x84         # Backend: OCR result of a frame as JSON
+CMD_FULL_FRAME = 0x85     # Backend: u32 frame sequence number; sent back as MSG_FRAME
+FRAME_HEADER = struct.Struct("<hB")
+
+
+class ChannelError(Exception):
+    """A command that got no reply: timed out (504) or the device went away (503)"""
+
+    def __init__(self, status_code: int, detail: str):
+        super().__init__(detail)
+        self.status_code = status_code
+        self.detail = detail
+
+
+class DeviceChannel:
+    """One connected device and the commands waiting for its reply"""
+
+    def __init__(self, websocket: WebSocket, device_id: str):
+        self.websocket = websocket
+        self.device_id = device_id
+        self.connected_at = datetime.utcnow()
+        self.metrics: Optional[str] = None
+        self.pending: Dict[int, Tuple[int, asyncio.Future]] = {}
+        self.next_id = 1
+        self.send_lock = asyncio.Lock()
+
+    async def send(self, msg_type: int, message_id: int, payload: bytes = b""):
+        async with self.send_lock:
+            await self.websocket.send_bytes(MESSAGE_HEADER.pack(msg_type, message_id) + payload)
+
+    async def request(self, msg_type: int, payload: bytes, timeout: float) -> dict:
+        """Send a command and wait for the device's reply to it"""
+        message_id = self.next_id
+        self.next_id = self.next_id % 0xFFFFFFFF + 1
+        future = asyncio.get_running_loop().create_future()
+        self.pending[message_id] = (msg_type, future)
+        try:
+            await self.send(msg_type, message_id, payload)
+            return await asyncio.wait_for(future, timeout)
+        except asyncio.TimeoutError:
+            raise ChannelError(504, f"Device {self.device_id} did not answer")
+        finally:
+            self.pending.pop(message_id, None)
+
+    def command_type(self, message_id: int) -> Optional[int]:
+        """Type of the pending command a reply answers, if any"""
+        entry = self.pending.get(message_id)
+        return entry[0] if entry else None
+
+    def resolve(self, message_id: int, result: dict):
+        entry = self.pending.get(message_id)
+        if entry and not entry[1].done():
+            entry[1].set_result(result)
+
+    def close(self):
+        for _, future in self.pending.values():
+            if not future.done():
+                future.set_exception(ChannelError(503, f"Device {self.device_id} disconnected"))
+
+
+# Connected devices by id; a reconnecting device replaces its old entry
+channels: Dict[str, DeviceChannel] = {}
@@ -0,0 +1,290 @@
+// Host-native benchmark of the firmware pipeline, built by [env:native]:
+//   pio run -e native -t exec
+//   pio run -e native -t exec -a "--runs 20 --fixtures bench/fixtures"
+//
+// The whole of src/ runs against the doubles in bench/doubles: frames come
+// from recorded JPEGs (or are synthesised) at the OV2640's frame rate, the
+// backend is an in-process HTTP/1.1 server, and the control server's handlers
+// are called directly. Latency is host time, so compare runs on the same
+// machine rather than against the device; allocation counts, heap peaks and
+// bytes on the wire carry over as they are.
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <thread>
+#include <vector>
+#include "bench_hooks.h"
+#include "backend_channel.h"
+#include "camera_capture.h"
+#include "capture_pipeline.h"
+#include "camera_profiles.h"
+#include "stream_server.h"
+#include "uploader.h"
+#include "frame_pool.h"
+
+void setup();
+
+struct StageResult {
+    const char *name;
+    std::vector<double> ms;
+    uint64_t allocations;
+    int64_t heapPeak;          // Bytes above the heap in use at the start
+    uint64_t bytesOut;         // Response to the client plus requests to the backend
+};
+
+struct Sample {
+    int64_t startUs;
+    BenchHeap heap;
+    BenchNetwork net;
+};
+
+static Sample begin() {
+    Sample s;
+    benchHeapResetPeak();
+    benchHeap(s.heap);
+    benchNetwork(s.net);
+    s.startUs = esp_timer_get_time();
+    return s;
+}
+
+static void end(StageResult &stage, const Sample &s, size_t responseBytes = 0) {
+    int64_t elapsedUs = esp_timer_get_time() - s.startUs;
+    BenchHeap heap;
+    BenchNetwork net;
+    benchHeap(heap);
+    benchNetwork(net);
+    stage.ms.push_back(elapsedUs / 1000.0);
+    stage.allocations += heap.allocations - s.heap.allocations;
+    stage.heapPeak = max(stage.heapPeak, heap.peak - s.heap.current);
+    stage.bytesOut += responseBytes + (net.backendSent - s.net.backendSent) +
+                      (net.viewerSent - s.net.viewerSent);
+}
+
+static bool get(StageResult &stage, const char *target) {
+    BenchHttpResponse response;
+    Sample s = begin();
+    bool ok = benchHttpGet(target, response) && response.status == 200;
+    end(stage, s, response.bytes);
+    if (!ok) {
+        fprintf(stderr, "GET %s failed (status %d)\n", target, response.status);
+    }
+    return ok;
+}
+
+static void printStage(const StageResult &stage) {
+    std::vector<double> sorted = stage.ms;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0;
+    for (double v : sorted) {
+        sum += v;
+    }
+    size_t n = sorted.size();
+    double mean = n ? sum / n : 0;
+    double p95 = n ? sorted[min(n - 1, (size_t)(n * 0.95))] : 0;
+    printf("%-20s %5zu %9.1f %9.1f %9.1f %12.1f %11.1f\n", stage.name, n, mean, p95,
+           n ? (double)stage.allocations / n : 0, stage.heapPeak / 1024.0,
+           n ? stage.bytesOut / 1024.0 / n : 0);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [--runs N] [--fixtures DIR] [--backend-delay MS] [--stream-ms MS]\n"
+            "          [--no-sensor-timing] [--verbose]\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    int runs = 10;
+    const char *fixtureDir = "bench/fixtures";
+    uint32_t backendDelayMs = 20;
+    uint32_t streamMs = 2000;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--runs") == 0 && hasValue) {
+            runs = max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--fixtures") == 0 && hasValue) {
+            fixtureDir = argv[++i];
+        } else if (strcmp(argv[i], "--backend-delay") == 0 && hasValue) {
+            backendDelayMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stream-ms") == 0 && hasValue) {
+            streamMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-sensor-timing") == 0) {
+            benchCameraSetSensorTiming(false);
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            benchSetVerbose(true);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    int fixtures = benchCameraLoadFixtures(fixtureDir);
+    printf("Fixtures: %d from %s%s\n", fixtures, fixtureDir,
+           fixtures ? "" : " (frames are synthesised)");
+    benchBackendSetDelay(backendDelayMs);
+
+    Sample boot = begin();
+    setup();
+    StageResult setupStage = {"setup", {}, 0, 0, 0};
+    end(setupStage, boot);
+
+    StageResult capture = {"GET /capture", {}, 0, 0, 0};
+    StageResult send = {"GET /send_to_api", {}, 0, 0, 0};
+    StageResult snapshot = {"GET /snapshot", {}, 0, 0, 0};
+    StageResult changed = {"cycle, changed", {}, 0, 0, 0};
+    StageResult unchanged = {"cycle, unchanged", {}, 0, 0, 0};
+    StageResult metrics = {"GET /metrics", {}, 0, 0, 0};
+    StageResult trace = {"GET /trace", {}, 0, 0, 0};
+    StageResult channel = {"channel capture", {}, 0, 0, 0};
+    StageResult meters = {"cycle, 3 meters", {}, 0, 0, 0};
+    StageResult stream = {"stream, 1 viewer", {}, 0, 0, 0};
+    StageResult slow = {"stream, +1 slow", {}, 0, 0, 0};
+
+    uint32_t warmupFrames = 0, warmupUs = 0, scoreUs = 0;
+    for (int run = 0; run < runs; run++) {
+        get(capture, "/capture");
+        CaptureStats captureStats;
+        getCaptureStats(captureStats);
+        warmupFrames += captureStats.last.warmupFrames;
+        warmupUs += captureStats.last.warmupUs;
+        scoreUs += captureStats.last.scoreUs;
+
+        get(send, "/send_to_api");
+        get(snapshot, "/snapshot");  // Served from the frame /capture just took
+
+        // Change detection only runs on a sensor ROI
+        CameraRoi roi = {true, 400, 400, 800, 320};
+        cameraSetRoi(roi);
+        benchCameraSceneChange();
+        Sample s = begin();
+        runCaptureCycle();
+        end(changed, s);
+
+        s = begin();
+        runCaptureCycle();
+        end(unchanged, s);
+        roi.enabled = false;
+        cameraSetRoi(roi);
+
+        get(metrics, "/metrics");
+        get(trace, "/trace");
+
+        // Command to frame pushed on the backend channel, once it's up
+        ChannelStats channelStats;
+        getChannelStats(channelStats);
+        uint32_t framesBefore = channelStats.framesSent;
+        s = begin();
+        if (channelStats.connected && benchChannelCapture(run + 1)) {
+            for (int wait = 0; wait < 1000 && channelStats.framesSent == framesBefore; wait++) {
+                delay(5);
+                getChannelStats(channelStats);
+            }
+            end(channel, s);
+        }
+    }
+
+    // A changed frame with three meters in view, uploaded as one crop each
+    static const char *METERS[] = {"power", "gas", "water"};
+    BenchHttpResponse response;
+    for (int i = 0; i < 3; i++) {
+        char target[96];
+        snprintf(target, sizeof(target), "/meters?name=%s&meter=bench-%s&x=160&y=%d&w=640&h=192",
+                 METERS[i], METERS[i], 96 + i * 384);
+        benchHttpGet(target, response);
+    }
+    for (int run = 0; run < runs; run++) {
+        benchCameraSceneChange();
+        Sample s = begin();
+        runCaptureCycle();
+        end(meters, s);
+    }
+    for (int i = 0; i < 3; i++) {
+        char target[32];
+        snprintf(target, sizeof(target), "/meters?remove=%s", METERS[i]);
+        benchHttpGet(target, response);
+    }
+
+    // Two viewers that find the snapshot stale at the same time share one
+    // exposure: the second waits for the first one's frame
+    const uint32_t snapshotAgeMs = 200;
+    delay(snapshotAgeMs + 50);
+    CaptureStats snapshotsBefore, snapshotsAfter;
+    getCaptureStats(snapshotsBefore);
+    PooledFrame *snapshots[2] = {};
+    std::thread first([&] { snapshots[0] = captureSnapshot(snapshotAgeMs); });
+    std::thread second([&] { snapshots[1] = captureSnapshot(snapshotAgeMs); });
+    first.join();
+    second.join();
+    for (PooledFrame *frame : snapshots) {
+        if (frame) {
+            framePoolRelease(frame);
+        }
+    }
+    getCaptureStats(snapshotsAfter);
+    uint32_t snapshotsExposed = snapshotsAfter.snapshotsExposed - snapshotsBefore.snapshotsExposed;
+    bool snapshotsShared = snapshotsExposed == 1 && snapshots[0] && snapshots[0] == snapshots[1];
+    if (!snapshotsShared) {
+        fprintf(stderr, "Overlapping stale snapshots: %u exposures, expected 1\n",
+                (unsigned)snapshotsExposed);
+    }
+
+    StreamStats before, after;
+    getStreamStats(before);
+    Sample s = begin();
+    benchStreamConnectIdle();  // Must not hold up the viewer behind it
+    benchStreamConnect();
+    delay(streamMs);
+    benchStreamDisconnectAll();
+    end(stream, s);
+    getStreamStats(after);
+    delay(100);  // Let the stream task notice the viewer has gone
+
+    // A viewer on a slow link must not slow down the one beside it
+    StreamStats slowBefore, slowAfter;
+    getStreamStats(slowBefore);
+    s = begin();
+    benchStreamConnectSlow();
+    benchStreamConnect();
+    delay(streamMs);
+    benchStreamDisconnectAll();
+    end(slow, s);
+    getStreamStats(slowAfter);
+    delay(100);
+
+    printf("\n%-20s %5s %9s %9s %9s %12s %11s\n", "stage", "runs", "mean ms", "p95 ms",
+           "allocs", "heap peak KB", "KB out/run");
+    for (const StageResult *stage : {&setupStage, &capture, &send, &snapshot, &changed, &unchanged,
+                                     &metrics, &trace, &channel, &meters, &stream,
+                                     &slow}) {
+        printStage(*stage);
+    }
+
+    UploadStats upload;
+    getUploadStats(upload);
+    BenchNetwork net;
+    benchNetwork(net);
+    uint32_t framesSent = after.framesSent - before.framesSent;
+    BenchHeap heap;
+    benchHeap(heap);
+
+    printf("\ncapture: %.1f warm-up frames, %.1f ms warm-up, %.1f ms scoring per reading\n",
+           (double)warmupFrames / runs, warmupUs / 1000.0 / runs, scoreUs / 1000.0 / runs);
+    printf("upload: %u requests, %u connects, %u reused, %.1f ms average (backend delay %u ms)\n",
+           (unsigned)upload.requests, (unsigned)upload.connects, (unsigned)upload.reused,
+           upload.avgLatencyUs / 1000.0, (unsigned)backendDelayMs);
+    printf("stream: %u frames in %u ms (%.1f fps), %.1f KB per frame, %u dropped\n",
+           (unsigned)framesSent, (unsigned)streamMs, framesSent * 1000.0 / streamMs,
+           framesSent ? (stream.bytesOut / 1024.0) / framesSent : 0,
+           (unsigned)(after.framesDropped - before.framesDropped));
+    printf("stream beside a slow viewer: %u deliveries in %u ms, %u slow viewers dropped\n",
+           (unsigned)(slowAfter.framesSent - slowBefore.framesSent), (unsigned)streamMs,
+           (unsigned)(slowAfter.slowViewers - slowBefore.slowViewers));
+    printf("heap: %.1f KB in use, %.1f KB of it PSRAM; %llu KB sent to the backend in total\n",
+           heap.current / 1024.0, heap.psram / 1024.0,
+           (unsigned long long)(net.backendSent / 1024));
+
+    printf("snapshot: %u exposure for 2 overlapping stale requests\n", (unsigned)snapshotsExposed);
+
+    // Firmware tasks never return; end without waiting for them
+    fflush(stdout);
+    _Exit(snapshotsShared ? 0 : 1);
+}
@@ -0,0 +1,161 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// Host double of the Arduino-ESP32 core, limited to what the firmware uses.
+// Built only by [env:native]; see bench/bench_main.cpp.
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+using std::min;
+using std::max;
+
+#define PROGMEM
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#define LOW    0x0
+#define HIGH   0x1
+#define INPUT  0x01
+#define OUTPUT 0x03
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+uint32_t ledcSetup(uint8_t channel, uint32_t freq, uint8_t resolutionBits);
+void ledcAttachPin(uint8_t pin, uint8_t channel);
+void ledcDetachPin(uint8_t pin);
+void ledcWrite(uint8_t channel, uint32_t duty);
+int digitalRead(uint8_t pin);
+
+// PSRAM allocations come from the host heap and are counted separately
+void *ps_malloc(size_t size);
+void *ps_calloc(size_t count, size_t size);
+uint32_t esp_random();
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char *server1,
+                const char *server2 = nullptr, const char *server3 = nullptr);
+
+class String {
+public:
+    String() {}
+    String(const char *s) : s(s ? s : "") {}
+    String(const std::string &s) : s(s) {}
+    String(char c) : s(1, c) {}
+    String(int v) : s(std::to_string(v)) {}
+    String(unsigned v) : s(std::to_string(v)) {}
+    String(long v) : s(std::to_string(v)) {}
+    String(unsigned long v) : s(std::to_string(v)) {}
+    String(long long v) : s(std::to_string(v)) {}
+    String(unsigned long long v) : s(std::to_string(v)) {}
+    String(double v, unsigned decimals = 2);
+
+    const char *c_str() const { return s.c_str(); }
+    unsigned length() const { return s.size(); }
+    bool isEmpty() const { return s.empty(); }
+    long toInt() const { return strtol(s.c_str(), NULL, 10); }
+    float toFloat() const { return strtof(s.c_str(), NULL); }
+
+    String &operator+=(const String &o) { s += o.s; return *this; }
+    String operator+(const String &o) const { return String(s + o.s); }
+    bool operator==(const String &o) const { return s == o.s; }
+    bool operator==(const char *o) const { return s == (o ? o : ""); }
+    bool operator!=(const char *o) const { return !(*this == o); }
+
+private:
+    std::string s;
+};
+
+inline String operator+(const char *a, const String &b) {
+    return String(a) + b;
+}
+
+class IPAddress {
+public:
+    IPAddress() : addr(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+        : addr(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+    IPAddress(uint32_t addr) : addr(addr) {}
+    operator uint32_t() const { return addr; }
+    uint8_t operator[](int i) const { return (addr >> (8 * i)) & 0xFF; }
+    String toString() const;
+
+private:
+    uint32_t addr;  // Network byte order, as on the ESP32
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t len);
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(const IPAddress &ip) { return print(ip.toString()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t print(unsigned v) { return printf("%u", v); }
+    size_t print(long v) { return printf("%ld", v); }
+    size_t print(unsigned long v) { return printf("%lu", v); }
+    size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+    template <typename T> size_t println(const T &v) { return print(v) + println(); }
+    size_t println() { return write("\r\n"); }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+};
+
+// Firmware logging; printed to stderr only with --verbose
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long /*baud*/) {}
+    void flush();
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t len) override;
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+// Heap figures follow the host allocations the firmware makes, against the
+// ESP32-CAM's internal RAM and PSRAM sizes
+class EspClass {
+public:
+    uint32_t getHeapSize();
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+    uint32_t getPsramSize();
+    uint32_t getFreePsram();
+    uint32_t getCycleCount();  // esp_timer time at BENCH_CPU_MHZ
+    void restart();
+};
+
+uint32_t getCpuFreqMHz();
+
+extern EspClass ESP;
+
+#endif // ARDUINO_H
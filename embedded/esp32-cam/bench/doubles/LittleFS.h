@@ -0,0 +1,49 @@
+#ifndef LITTLEFS_H
+#define LITTLEFS_H
+
+#include <Arduino.h>
+#include <memory>
+
+struct HostFsNode;
+
+// In-memory filesystem double with the File calls the spool makes
+class File : public Stream {
+public:
+    File() {}
+    File(std::shared_ptr<HostFsNode> node, const std::string &path, bool append);
+
+    operator bool() const { return node != nullptr; }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t len) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    size_t read(uint8_t *buf, size_t len);
+    bool seek(uint32_t pos);
+    size_t size() const;
+    const char *name() const;
+    bool isDirectory() const;
+    File openNextFile();
+    void close();
+
+private:
+    std::shared_ptr<HostFsNode> node;
+    std::string path;
+    size_t pos = 0;
+    size_t dirIndex = 0;
+};
+
+class HostFs {
+public:
+    bool begin(bool formatOnFail = false);
+    File open(const char *path, const char *mode = "r");
+    bool exists(const char *path);
+    bool remove(const char *path);
+    bool mkdir(const char *path);
+    size_t totalBytes();
+    size_t usedBytes();
+};
+
+extern HostFs LittleFS;
+
+#endif // LITTLEFS_H
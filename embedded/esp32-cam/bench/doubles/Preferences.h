@@ -0,0 +1,21 @@
+#ifndef PREFERENCES_H
+#define PREFERENCES_H
+
+#include <Arduino.h>
+
+// NVS double: namespaces are kept in memory for the life of the process
+class Preferences {
+public:
+    bool begin(const char *name, bool readOnly = false);
+    void end();
+    size_t putBytes(const char *key, const void *value, size_t len);
+    size_t getBytes(const char *key, void *buf, size_t maxLen);
+    size_t getBytesLength(const char *key);
+    bool remove(const char *key);
+
+private:
+    std::string ns;
+    bool readOnly = false;
+};
+
+#endif // PREFERENCES_H
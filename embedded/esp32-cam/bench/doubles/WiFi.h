@@ -0,0 +1,97 @@
+#ifndef WIFI_H
+#define WIFI_H
+
+// Host double of the WiFi library. The station is always associated.
+// Clients that connect() talk to an in-process fake backend that answers
+// each request with a small JSON 200; clients accepted from a WiFiServer
+// are the viewers attached by benchStreamConnect(). Bytes are counted on
+// both.
+#include <Arduino.h>
+#include <memory>
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1 } wifi_mode_t;
+
+typedef int WiFiEvent_t;
+#define ARDUINO_EVENT_WIFI_STA_CONNECTED    4
+#define ARDUINO_EVENT_WIFI_STA_DISCONNECTED 5
+#define ARDUINO_EVENT_WIFI_STA_GOT_IP       7
+
+typedef union {
+    struct {
+        uint8_t reason;
+    } wifi_sta_disconnected;
+} WiFiEventInfo_t;
+
+typedef void (*WiFiEventFuncCb)(WiFiEvent_t event, WiFiEventInfo_t info);
+
+class WiFiClass {
+public:
+    wl_status_t begin(const char *ssid, const char *password, int32_t channel = 0,
+                      const uint8_t *bssid = nullptr, bool connect = true);
+    bool config(IPAddress localIp, IPAddress gateway, IPAddress subnet,
+                IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+    bool disconnect(bool wifiOff = false, bool eraseAp = false);
+    wl_status_t status();
+    bool mode(wifi_mode_t mode);
+    void persistent(bool /*persistent*/) {}
+    void setAutoReconnect(bool /*autoReconnect*/) {}
+    int onEvent(WiFiEventFuncCb callback, WiFiEvent_t event = 0);
+
+    IPAddress localIP();
+    IPAddress gatewayIP();
+    IPAddress subnetMask();
+    IPAddress dnsIP(uint8_t index = 0);
+    uint8_t *BSSID();
+    int32_t channel();
+    int8_t RSSI();
+};
+
+extern WiFiClass WiFi;
+
+struct HostSocket;
+
+class WiFiClient : public Stream {
+public:
+    WiFiClient() {}
+    explicit WiFiClient(std::shared_ptr<HostSocket> socket) : socket(socket) {}
+
+    int connect(const char *host, uint16_t port, int32_t timeoutMs = 3000);
+    uint8_t connected();
+    void stop();
+    int setNoDelay(bool /*noDelay*/) { return 0; }
+    int fd() const;
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t len) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t len);
+
+    operator bool() { return connected(); }
+
+private:
+    std::shared_ptr<HostSocket> socket;
+};
+
+class WiFiServer {
+public:
+    WiFiServer(uint16_t port = 80, uint8_t /*maxClients*/ = 4) : port(port) {}
+    void begin(uint16_t /*port*/ = 0) {}
+    void setNoDelay(bool /*noDelay*/) {}
+    WiFiClient available();
+
+private:
+    uint16_t port;
+};
+
+#endif // WIFI_H
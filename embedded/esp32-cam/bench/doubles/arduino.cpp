@@ -0,0 +1,339 @@
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <esp_sleep.h>
+#include <driver/rtc_io.h>
+#include <pthread.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+#include "bench_hooks.h"
+
+// ESP32-CAM: ~320 KB of internal heap for the application, 4 MB PSRAM
+static const uint32_t HEAP_SIZE = 320 * 1024;
+static const uint32_t PSRAM_SIZE = 4 * 1024 * 1024;
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+static bool verbose = false;
+static uint32_t minFreeHeap = HEAP_SIZE;
+
+int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long millis() {
+    return esp_timer_get_time() / 1000;
+}
+
+unsigned long micros() {
+    return esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t /*pin*/, uint8_t /*mode*/) {}
+void digitalWrite(uint8_t /*pin*/, uint8_t /*value*/) {}
+uint32_t ledcSetup(uint8_t /*channel*/, uint32_t freq, uint8_t /*resolutionBits*/) { return freq; }
+void ledcAttachPin(uint8_t /*pin*/, uint8_t /*channel*/) {}
+void ledcDetachPin(uint8_t /*pin*/) {}
+void ledcWrite(uint8_t /*channel*/, uint32_t /*duty*/) {}
+int digitalRead(uint8_t /*pin*/) { return LOW; }
+
+uint32_t esp_random() {
+    static uint32_t state = 0x57415454;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+void configTime(long /*gmtOffsetSec*/, int /*daylightOffsetSec*/, const char * /*server1*/,
+                const char * /*server2*/, const char * /*server3*/) {
+}
+
+void benchSetVerbose(bool enabled) {
+    verbose = enabled;
+}
+
+// --- Print, String, Serial ---
+
+size_t Print::write(const uint8_t *buf, size_t len) {
+    size_t n = 0;
+    while (n < len && write(buf[n])) {
+        n++;
+    }
+    return n;
+}
+
+size_t Print::printf(const char *format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len <= 0) {
+        return 0;
+    }
+    return write((const uint8_t *)buf, min((size_t)len, sizeof(buf) - 1));
+}
+
+String::String(double v, unsigned decimals) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+    s = buf;
+}
+
+String IPAddress::toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buf);
+}
+
+HardwareSerial Serial;
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+    if (verbose) {
+        fwrite(buf, 1, len, stderr);
+    }
+    return len;
+}
+
+void HardwareSerial::flush() {
+    fflush(stderr);
+}
+
+// --- ESP ---
+
+EspClass ESP;
+
+uint32_t EspClass::getHeapSize() {
+    return HEAP_SIZE;
+}
+
+uint32_t EspClass::getFreeHeap() {
+    BenchHeap heap;
+    benchHeap(heap);
+    int64_t internal = heap.current - heap.psram;
+    uint32_t free = internal >= HEAP_SIZE ? 0 : HEAP_SIZE - max(internal, (int64_t)0);
+    minFreeHeap = min(minFreeHeap, free);
+    return free;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    getFreeHeap();
+    return minFreeHeap;
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+    return getFreeHeap();
+}
+
+uint32_t EspClass::getPsramSize() {
+    return PSRAM_SIZE;
+}
+
+uint32_t EspClass::getFreePsram() {
+    BenchHeap heap;
+    benchHeap(heap);
+    return heap.psram >= PSRAM_SIZE ? 0 : PSRAM_SIZE - heap.psram;
+}
+
+// The ESP32-CAM's clock; the cycle counter wraps at the same rate
+static const uint32_t BENCH_CPU_MHZ = 240;
+
+uint32_t EspClass::getCycleCount() {
+    return (uint32_t)(esp_timer_get_time() * BENCH_CPU_MHZ);
+}
+
+uint32_t getCpuFreqMHz() {
+    return BENCH_CPU_MHZ;
+}
+
+void EspClass::restart() {
+    fprintf(stderr, "ESP.restart() called\n");
+    exit(1);
+}
+
+// --- Sleep and RTC pads ---
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() {
+    return ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t /*us*/) {
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start() {
+    fflush(stdout);
+    _Exit(0);
+}
+
+esp_err_t rtc_gpio_hold_en(gpio_num_t /*pin*/) { return ESP_OK; }
+esp_err_t rtc_gpio_hold_dis(gpio_num_t /*pin*/) { return ESP_OK; }
+
+// --- FreeRTOS ---
+
+// Arduino's loopTask, and so setup() and loop(), run on core 1
+static thread_local BaseType_t taskCore = 1;
+
+// A task handle is its notification value
+struct HostTask {
+    std::mutex lock;
+    std::condition_variable notified;
+    uint32_t value = 0;
+};
+static thread_local HostTask *currentTask = NULL;
+
+BaseType_t xPortGetCoreID() {
+    return taskCore;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char * /*name*/,
+                                   uint32_t /*stackDepth*/, void *arg, UBaseType_t /*priority*/,
+                                   TaskHandle_t *handle,
+                                   BaseType_t core) {
+    // Tasks never return on the device; the threads end with the process
+    HostTask *task = new HostTask();
+    std::thread([fn, arg, core, task] {
+        taskCore = core == tskNO_AFFINITY ? 0 : core;
+        currentTask = task;
+        fn(arg);
+    }).detach();
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    delay(ticks);
+}
+
+void vTaskDelete(TaskHandle_t /*task*/) {
+    pthread_exit(NULL);
+}
+
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t increment) {
+    *previousWake += increment;
+    int64_t waitMs = (int64_t)*previousWake - (int64_t)millis();
+    if (waitMs > 0) {
+        delay(waitMs);
+    }
+}
+
+TickType_t xTaskGetTickCount() {
+    return millis();
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait) {
+    if (!currentTask) {
+        currentTask = new HostTask();
+    }
+    std::unique_lock<std::mutex> guard(currentTask->lock);
+    auto pending = [] { return currentTask->value > 0; };
+    if (wait == portMAX_DELAY) {
+        currentTask->notified.wait(guard, pending);
+    } else {
+        currentTask->notified.wait_for(guard, std::chrono::milliseconds(wait), pending);
+    }
+    uint32_t value = currentTask->value;
+    if (value > 0) {
+        currentTask->value = clearOnExit ? 0 : value - 1;
+    }
+    return value;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    HostTask *target = (HostTask *)task;
+    std::lock_guard<std::mutex> guard(target->lock);
+    target->value++;
+    target->notified.notify_one();
+    return pdPASS;
+}
+
+static std::chrono::steady_clock::time_point deadline(TickType_t wait) {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(wait);
+}
+
+struct HostQueue {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    size_t length;
+    size_t itemSize;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    HostQueue *queue = new HostQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(queue->lock);
+    auto hasSpace = [queue] { return queue->items.size() < queue->length; };
+    if (wait == portMAX_DELAY) {
+        queue->changed.wait(lock, hasSpace);
+    } else if (!queue->changed.wait_until(lock, deadline(wait), hasSpace)) {
+        return pdFAIL;
+    }
+    const uint8_t *bytes = (const uint8_t *)item;
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait) {
+    std::unique_lock<std::mutex> lock(queue->lock);
+    auto hasItem = [queue] { return !queue->items.empty(); };
+    if (wait == portMAX_DELAY) {
+        queue->changed.wait(lock, hasItem);
+    } else if (!queue->changed.wait_until(lock, deadline(wait), hasItem)) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->length - queue->items.size();
+}
+
+struct HostSemaphore {
+    std::timed_mutex lock;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new HostSemaphore();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+    if (wait == portMAX_DELAY) {
+        sem->lock.lock();
+        return pdTRUE;
+    }
+    return sem->lock.try_lock_for(std::chrono::milliseconds(wait)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    sem->lock.unlock();
+    return pdTRUE;
+}
@@ -0,0 +1,58 @@
+#ifndef BENCH_HOOKS_H
+#define BENCH_HOOKS_H
+
+// Controls and counters of the native doubles, for bench/bench_main.cpp
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+// Firmware Serial output goes to stderr when set
+void benchSetVerbose(bool verbose);
+
+// Host heap use, from the malloc/new replacements in heap.cpp
+struct BenchHeap {
+    uint64_t allocations;      // Calls that allocated, since start
+    int64_t current;           // Bytes allocated now
+    int64_t peak;              // Highest `current` since benchHeapResetPeak()
+    int64_t psram;             // Of `current`, allocated with ps_malloc()
+};
+
+void benchHeapResetPeak();
+void benchHeap(BenchHeap &out);
+
+// Camera double. Frames come from *.jpg files in `dir` whose size matches
+// the sensor's current output; other sizes are synthesised. With
+// `sensorTiming` frames arrive at the OV2640's rate for their size.
+int benchCameraLoadFixtures(const char *dir);
+void benchCameraSetSensorTiming(bool enabled);
+void benchCameraSceneChange();  // Synthetic frames show a new display from now on
+
+// Network double counters: bytes the device wrote and read
+struct BenchNetwork {
+    uint64_t backendSent;
+    uint64_t backendReceived;
+    uint32_t backendConnects;
+    uint32_t backendRequests;
+    uint64_t viewerSent;
+};
+
+void benchNetwork(BenchNetwork &out);
+void benchBackendSetDelay(uint32_t ms);  // Backend think time before each reply
+bool benchChannelCapture(uint32_t id);   // Backend sends a capture command on the channel
+void benchStreamConnect();               // Queue a viewer for the stream server
+void benchStreamConnectIdle();           // ... and a client that never sends its request
+void benchStreamConnectSlow();           // ... and a viewer reading about 20 KB/s
+void benchStreamDisconnectAll();
+
+// Control server double: run the registered handler for `target` (path and
+// optional query) and report what a client would have received
+struct BenchHttpResponse {
+    int status;
+    std::string contentType;
+    size_t bytes;              // Status line, headers and body
+    size_t bodyBytes;
+};
+
+bool benchHttpGet(const char *target, BenchHttpResponse &out, const char *headers = "");
+
+#endif // BENCH_HOOKS_H
@@ -0,0 +1,455 @@
+#include <esp_camera.h>
+#include <esp_jpg_decode.h>
+#include <img_converters.h>
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <dirent.h>
+#include <mutex>
+#include <vector>
+#include "bench_hooks.h"
+
+const resolution_info_t resolution[] = {
+    {96, 96}, {160, 120}, {176, 144}, {240, 176}, {240, 240}, {320, 240}, {400, 296},
+    {480, 320}, {640, 480}, {800, 600}, {1024, 768}, {1280, 720}, {1280, 1024}, {1600, 1200},
+};
+
+struct Fixture {
+    std::vector<uint8_t> jpeg;
+    uint16_t width;
+    uint16_t height;
+};
+
+// Regions of a synthetic frame; each has one brightness per scene
+static const int SCENE_REGIONS = 64;
+// OV2640 exposure the AEC starts from on a size change, and where it settles
+static const uint32_t AEC_START = 800;
+static const uint32_t AEC_TARGET = 400;
+
+static std::recursive_mutex cameraLock;
+static std::vector<Fixture> fixtures;
+static size_t nextFixture = 0;
+static bool sensorTiming = true;
+static bool initialised = false;
+static camera_config_t config;
+static sensor_t sensor;
+static std::vector<camera_fb_t> buffers;
+static std::vector<bool> bufferOut;
+static size_t bufferSize = 0;
+static uint16_t staleWidth = 0, staleHeight = 0;
+static int staleFrames = 0;           // Frames still at the old size after a change
+static uint32_t aec = AEC_START;
+static int64_t lastFrameUs = 0;
+static uint32_t frameCounter = 0;
+static uint8_t sceneLevels[SCENE_REGIONS];
+
+static bool parseDimensions(const uint8_t *buf, size_t len, uint16_t &width, uint16_t &height) {
+    size_t pos = 2;
+    while (pos + 9 < len && buf[pos] == 0xFF) {
+        uint8_t marker = buf[pos + 1];
+        if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
+            height = (buf[pos + 5] << 8) | buf[pos + 6];
+            width = (buf[pos + 7] << 8) | buf[pos + 8];
+            return true;
+        }
+        if (marker == 0xDA) {
+            return false;
+        }
+        pos += 2 + ((buf[pos + 2] << 8) | buf[pos + 3]);
+    }
+    return false;
+}
+
+static void newScene() {
+    for (int i = 0; i < SCENE_REGIONS; i++) {
+        sceneLevels[i] = 40 + esp_random() % 180;
+    }
+}
+
+int benchCameraLoadFixtures(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        return 0;
+    }
+    std::lock_guard<std::recursive_mutex> guard(cameraLock);
+    for (struct dirent *entry = readdir(d); entry; entry = readdir(d)) {
+        const char *dot = strrchr(entry->d_name, '.');
+        if (!dot || (strcasecmp(dot, ".jpg") != 0 && strcasecmp(dot, ".jpeg") != 0)) {
+            continue;
+        }
+        std::string path = std::string(dir) + "/" + entry->d_name;
+        FILE *f = fopen(path.c_str(), "rb");
+        if (!f) {
+            continue;
+        }
+        Fixture fixture;
+        uint8_t chunk[4096];
+        for (size_t n; (n = fread(chunk, 1, sizeof(chunk), f)) > 0;) {
+            fixture.jpeg.insert(fixture.jpeg.end(), chunk, chunk + n);
+        }
+        fclose(f);
+        if (fixture.jpeg.size() > 4 && fixture.jpeg[0] == 0xFF && fixture.jpeg[1] == 0xD8 &&
+            parseDimensions(fixture.jpeg.data(), fixture.jpeg.size(), fixture.width,
+                            fixture.height)) {
+            fixtures.push_back(std::move(fixture));
+        }
+    }
+    closedir(d);
+    return fixtures.size();
+}
+
+void benchCameraSetSensorTiming(bool enabled) {
+    sensorTiming = enabled;
+}
+
+void benchCameraSceneChange() {
+    std::lock_guard<std::recursive_mutex> guard(cameraLock);
+    newScene();
+}
+
+static void outputSize(uint16_t &width, uint16_t &height) {
+    if (sensor.windowWidth && sensor.windowHeight) {
+        width = sensor.windowWidth;
+        height = sensor.windowHeight;
+    } else {
+        width = resolution[sensor.framesize].width;
+        height = resolution[sensor.framesize].height;
+    }
+}
+
+// The driver keeps delivering frames taken with the previous settings until
+// its buffers have cycled
+static void settingsChanged(uint16_t oldWidth, uint16_t oldHeight) {
+    uint16_t width, height;
+    outputSize(width, height);
+    if (width == oldWidth && height == oldHeight) {
+        return;
+    }
+    staleWidth = oldWidth;
+    staleHeight = oldHeight;
+    staleFrames = config.fb_count;
+    aec = AEC_START;
+}
+
+static int setFramesize(sensor_t *s, framesize_t size) {
+    if (size >= FRAMESIZE_INVALID) {
+        return -1;
+    }
+    std::lock_guard<std::recursive_mutex> guard(cameraLock);
+    uint16_t oldWidth, oldHeight;
+    outputSize(oldWidth, oldHeight);
+    s->framesize = size;
+    s->windowWidth = 0;
+    s->windowHeight = 0;
+    settingsChanged(oldWidth, oldHeight);
+    return 0;
+}
+
+static int setQuality(sensor_t *s, int quality) {
+    s->quality = quality;
+    return 0;
+}
+
+static int setSpecialEffect(sensor_t *s, int effect) {
+    s->special_effect = effect;
+    return 0;
+}
+
+static int setResRaw(sensor_t *s, int /*startX*/, int /*startY*/, int /*endX*/, int /*endY*/,
+                     int /*offsetX*/, int /*offsetY*/, int /*totalX*/, int /*totalY*/,
+                     int outputX, int outputY, bool /*scale*/, bool /*binning*/) {
+    if (outputX <= 0 || outputY <= 0) {
+        return -1;
+    }
+    std::lock_guard<std::recursive_mutex> guard(cameraLock);
+    uint16_t oldWidth, oldHeight;
+    outputSize(oldWidth, oldHeight);
+    s->windowWidth = outputX;
+    s->windowHeight = outputY;
+    settingsChanged(oldWidth, oldHeight);
+    return 0;
+}
+
+// AEC[15:10], AEC[9:2], AEC[1:0] and GAIN, as camera_capture reads them
+static int getReg(sensor_t * /*s*/, int reg, int mask) {
+    std::lock_guard<std::recursive_mutex> guard(cameraLock);
+    switch (reg) {
+        case 0x145: return (aec >> 10) & mask;
+        case 0x110: return (aec >> 2) & mask;
+        case 0x104: return aec & mask;
+        case 0x100: return 16 & mask;
+        default: return 0;
+    }
+}
+
+static int setValue(sensor_t * /*s*/, int /*value*/) {
+    return 0;
+}
+
+static int setGainceiling(sensor_t * /*s*/, gainceiling_t /*ceiling*/) {
+    return 0;
+}
+
+// Size of a frame the way esp32-camera sizes its JPEG buffers
+static size_t maxFrameBytes(uint16_t width, uint16_t height) {
+    return (size_t)width * height / 5;
+}
+
+esp_err_t esp_camera_init(const camera_config_t *cfg) {
+    std::lock_guard<std::recursive_mutex> guard(cameraLock);
+    config = *cfg;
+    sensor = sensor_t();
+    sensor.framesize = cfg->frame_size;
+    sensor.quality = cfg->jpeg_quality;
+    sensor.set_framesize = setFramesize;
+    sensor.set_quality = setQuality;
+    sensor.set_special_effect = setSpecialEffect;
+    sensor.set_res_raw = setResRaw;
+    sensor.get_reg = getReg;
+    sensor.set_brightness = setValue;
+    sensor.set_contrast = setValue;
+    sensor.set_saturation = setValue;
+    sensor.set_whitebal = setValue;
+    sensor.set_awb_gain = setValue;
+    sensor.set_wb_mode = setValue;
+    sensor.set_exposure_ctrl = setValue;
+    sensor.set_aec2 = setValue;
+    sensor.set_ae_level = setValue;
+    sensor.set_aec_value = setValue;
+    sensor.set_gain_ctrl = setValue;
+    sensor.set_agc_gain = setValue;
+    sensor.set_gainceiling = setGainceiling;
+    sensor.set_bpc = setValue;
+    sensor.set_wpc = setValue;
+    sensor.set_raw_gma = setValue;
+    sensor.set_lenc = setValue;
+    sensor.set_hmirror = setValue;
+    sensor.set_vflip = setValue;
+    sensor.set_dcw = setValue;
+    sensor.set_colorbar = setValue;
+
+    // Buffers are allocated once, big enough for the initial (largest) size
+    bufferSize = maxFrameBytes(resolution[cfg->frame_size].width,
+                               resolution[cfg->frame_size].height);
+    buffers.assign(max(cfg->fb_count, (size_t)1), camera_fb_t());
+    bufferOut.assign(buffers.size(), false);
+    for (camera_fb_t &fb : buffers) {
+        fb.buf = (uint8_t *)ps_malloc(bufferSize);
+        if (!fb.buf) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    newScene();
+    aec = AEC_START;
+    lastFrameUs = esp_timer_get_time();
+    initialised = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit() {
+    std::lock_guard<std::recursive_mutex> guard(cameraLock);
+    for (camera_fb_t &fb : buffers) {
+        free(fb.buf);
+    }
+    buffers.clear();
+    bufferOut.clear();
+    initialised = false;
+    return ESP_OK;
+}
+
+sensor_t *esp_camera_sensor_get() {
+    return initialised ? &sensor : NULL;
+}
+
+// SOI, a baseline frame header and a scan whose bytes follow the scene's
+// region brightness plus a little noise that differs from frame to frame
+static size_t synthesise(uint8_t *buf, size_t size, uint16_t width, uint16_t height) {
+    size_t len = (size_t)width * height * 2 / (sensor.quality + 10);
+    len = max(min(len, size), (size_t)64);
+    static const uint8_t HEAD[] = {
+        0xFF, 0xD8,                                       // SOI
+        0xFF, 0xC0, 0x00, 0x11, 0x08, 0, 0, 0, 0, 0x03,   // SOF0, size filled in
+        0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+        0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3F, 0x00,
+    };
+    memcpy(buf, HEAD, sizeof(HEAD));
+    buf[7] = height >> 8;
+    buf[8] = height & 0xFF;
+    buf[9] = width >> 8;
+    buf[10] = width & 0xFF;
+
+    uint32_t noise = 0x9E3779B9u * ++frameCounter;
+    size_t payload = len - sizeof(HEAD) - 2;
+    for (size_t i = 0; i < payload; i++) {
+        noise = noise * 1664525u + 1013904223u;
+        int level = sceneLevels[i * SCENE_REGIONS / payload] + (int)((noise >> 24) & 7) - 4;
+        buf[sizeof(HEAD) + i] = min(max(level, 0), 0xFE);  // No markers in the scan
+    }
+    buf[len - 2] = 0xFF;
+    buf[len - 1] = 0xD9;                                  // EOI
+    return len;
+}
+
+camera_fb_t *esp_camera_fb_get() {
+    std::unique_lock<std::recursive_mutex> guard(cameraLock);
+    if (!initialised) {
+        return NULL;
+    }
+    int slot = -1;
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (!bufferOut[i]) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        return NULL;  // Every buffer is held by the firmware; the driver times out
+    }
+
+    uint16_t width, height;
+    outputSize(width, height);
+    if (staleFrames > 0) {
+        staleFrames--;
+        width = staleWidth;
+        height = staleHeight;
+    }
+    int64_t periodUs = (size_t)width * height > 800 * 600 ? 66000 : 40000;
+    if (aec > AEC_TARGET) {
+        aec -= (aec - AEC_TARGET + 1) / 2;
+    }
+
+    camera_fb_t &fb = buffers[slot];
+    fb.len = 0;
+    for (size_t i = 0; i < fixtures.size() && fb.len == 0; i++) {
+        const Fixture &fixture = fixtures[(nextFixture + i) % fixtures.size()];
+        if (fixture.width == width && fixture.height == height && fixture.jpeg.size() <= bufferSize) {
+            memcpy(fb.buf, fixture.jpeg.data(), fixture.jpeg.size());
+            fb.len = fixture.jpeg.size();
+            nextFixture = (nextFixture + i + 1) % fixtures.size();
+        }
+    }
+    if (fb.len == 0) {
+        fb.len = synthesise(fb.buf, bufferSize, width, height);
+    }
+    bufferOut[slot] = true;
+    guard.unlock();
+
+    // The sensor delivers one frame per period; waiting for it is most of a capture
+    if (sensorTiming) {
+        int64_t waitUs = lastFrameUs + periodUs - esp_timer_get_time();
+        if (waitUs > 0) {
+            delay((waitUs + 999) / 1000);
+        }
+    }
+    lastFrameUs = esp_timer_get_time();
+
+    int64_t now = esp_timer_get_time();
+    fb.timestamp.tv_sec = now / 1000000;
+    fb.timestamp.tv_usec = now % 1000000;
+    // Like the driver, width and height follow the current setting even for stale frames
+    outputSize(width, height);
+    fb.width = width;
+    fb.height = height;
+    fb.format = PIXFORMAT_JPEG;
+    return &fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb) {
+    std::lock_guard<std::recursive_mutex> guard(cameraLock);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (&buffers[i] == fb) {
+            bufferOut[i] = false;
+        }
+    }
+}
+
+// Like the ROM decoder's work area; the headers are parsed from it
+static const size_t DECODE_WORK_SIZE = 3100;
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader,
+                         jpg_writer_cb writer, void *arg) {
+    uint8_t *work = (uint8_t *)malloc(DECODE_WORK_SIZE);
+    if (!work) {
+        return ESP_ERR_NO_MEM;
+    }
+    size_t headLen = reader(arg, 0, work, min(DECODE_WORK_SIZE, len));
+    uint16_t width, height;
+    bool valid = headLen > 4 && work[0] == 0xFF && work[1] == 0xD8 &&
+                 parseDimensions(work, headLen, width, height);
+    // The whole stream goes through the reader, as when decoding
+    for (size_t index = headLen; valid && index < len;) {
+        size_t n = reader(arg, index, work, min(DECODE_WORK_SIZE, len - index));
+        valid = n > 0;
+        index += n;
+    }
+    free(work);
+    if (!valid) {
+        return ESP_FAIL;
+    }
+    uint16_t outWidth = width >> scale;
+    uint16_t outHeight = height >> scale;
+    if (!outWidth || !outHeight || !writer(arg, 0, 0, outWidth, outHeight, NULL)) {
+        return ESP_FAIL;
+    }
+
+    // Pixels run through the file in raster order, so a region of the
+    // picture maps to a region of the scan
+    static const int BLOCK = 16;
+    uint8_t block[BLOCK * BLOCK * 3];
+    uint64_t pixels = (uint64_t)outWidth * outHeight;
+    for (uint16_t y = 0; y < outHeight; y += BLOCK) {
+        uint16_t h = min(BLOCK, outHeight - y);
+        for (uint16_t x = 0; x < outWidth; x += BLOCK) {
+            uint16_t w = min(BLOCK, outWidth - x);
+            uint8_t *px = block;
+            for (uint16_t row = 0; row < h; row++) {
+                for (uint16_t col = 0; col < w; col++, px += 3) {
+                    uint64_t i = (uint64_t)(y + row) * outWidth + x + col;
+                    reader(arg, i * len / pixels, px, 1);
+                    px[1] = px[2] = px[0];
+                }
+            }
+            if (!writer(arg, x, y, w, h, block)) {
+                return ESP_FAIL;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height,
+                pixformat_t /*format*/, uint8_t quality, jpg_out_cb cb, void *arg) {
+    if (!src || !width || !height || !quality) {
+        return false;
+    }
+    uint8_t head[] = {
+        0xFF, 0xD8,                                       // SOI
+        0xFF, 0xC0, 0x00, 0x0B, 0x08, 0, 0, 0, 0, 0x01,   // SOF0, one component
+        0x01, 0x11, 0x00,
+        0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00,
+    };
+    head[7] = height >> 8;
+    head[8] = height & 0xFF;
+    head[9] = width >> 8;
+    head[10] = width & 0xFF;
+    size_t index = 0;
+    if (cb(arg, index, head, sizeof(head)) != sizeof(head)) {
+        return false;
+    }
+    index += sizeof(head);
+
+    size_t scanLen = max((size_t)width * height * quality / 800, (size_t)16);
+    uint8_t chunk[512];
+    for (size_t done = 0; done < scanLen;) {
+        size_t n = min(sizeof(chunk), scanLen - done);
+        for (size_t i = 0; i < n; i++) {
+            chunk[i] = min(src[(done + i) * src_len / scanLen], (uint8_t)0xFE);
+        }
+        if (cb(arg, index, chunk, n) != n) {
+            return false;
+        }
+        index += n;
+        done += n;
+    }
+    static const uint8_t EOI[] = {0xFF, 0xD9};
+    return cb(arg, index, EOI, sizeof(EOI)) == sizeof(EOI);
+}
@@ -0,0 +1,11 @@
+#ifndef DRIVER_RTC_IO_H
+#define DRIVER_RTC_IO_H
+
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+esp_err_t rtc_gpio_hold_en(gpio_num_t pin);
+esp_err_t rtc_gpio_hold_dis(gpio_num_t pin);
+
+#endif // DRIVER_RTC_IO_H
@@ -0,0 +1,138 @@
+#ifndef ESP_CAMERA_H
+#define ESP_CAMERA_H
+
+// Host double of esp32-camera. Frames are replayed from the JPEG fixtures
+// loaded by benchCameraLoadFixtures(), or synthesised at the configured
+// size, and arrive at the OV2640's frame rate for that size.
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include "esp_err.h"
+
+typedef enum {
+    PIXFORMAT_RGB565,
+    PIXFORMAT_YUV422,
+    PIXFORMAT_YUV420,
+    PIXFORMAT_GRAYSCALE,
+    PIXFORMAT_JPEG,
+    PIXFORMAT_RGB888,
+    PIXFORMAT_RAW,
+    PIXFORMAT_RGB444,
+    PIXFORMAT_RGB555,
+} pixformat_t;
+
+typedef enum {
+    FRAMESIZE_96X96,
+    FRAMESIZE_QQVGA,
+    FRAMESIZE_QCIF,
+    FRAMESIZE_HQVGA,
+    FRAMESIZE_240X240,
+    FRAMESIZE_QVGA,
+    FRAMESIZE_CIF,
+    FRAMESIZE_HVGA,
+    FRAMESIZE_VGA,
+    FRAMESIZE_SVGA,
+    FRAMESIZE_XGA,
+    FRAMESIZE_HD,
+    FRAMESIZE_SXGA,
+    FRAMESIZE_UXGA,
+    FRAMESIZE_INVALID
+} framesize_t;
+
+typedef enum {
+    GAINCEILING_2X,
+    GAINCEILING_4X,
+    GAINCEILING_8X,
+    GAINCEILING_16X,
+    GAINCEILING_32X,
+    GAINCEILING_64X,
+    GAINCEILING_128X,
+} gainceiling_t;
+
+typedef enum { LEDC_CHANNEL_0, LEDC_CHANNEL_1 } ledc_channel_t;
+typedef enum { LEDC_TIMER_0, LEDC_TIMER_1 } ledc_timer_t;
+typedef enum { CAMERA_GRAB_WHEN_EMPTY, CAMERA_GRAB_LATEST } camera_grab_mode_t;
+typedef enum { CAMERA_FB_IN_PSRAM, CAMERA_FB_IN_DRAM } camera_fb_location_t;
+
+typedef struct {
+    int pin_pwdn;
+    int pin_reset;
+    int pin_xclk;
+    int pin_sccb_sda;
+    int pin_sccb_scl;
+    int pin_d7, pin_d6, pin_d5, pin_d4, pin_d3, pin_d2, pin_d1, pin_d0;
+    int pin_vsync;
+    int pin_href;
+    int pin_pclk;
+    int xclk_freq_hz;
+    ledc_timer_t ledc_timer;
+    ledc_channel_t ledc_channel;
+    pixformat_t pixel_format;
+    framesize_t frame_size;
+    int jpeg_quality;
+    size_t fb_count;
+    camera_fb_location_t fb_location;
+    camera_grab_mode_t grab_mode;
+} camera_config_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t width;
+    size_t height;
+    pixformat_t format;
+    struct timeval timestamp;
+} camera_fb_t;
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+} resolution_info_t;
+
+extern const resolution_info_t resolution[];
+
+typedef struct _sensor sensor_t;
+struct _sensor {
+    framesize_t framesize;
+    int quality;
+    int special_effect;
+    uint16_t windowWidth;      // set_res_raw() output size, 0 for the full frame
+    uint16_t windowHeight;
+
+    int (*set_framesize)(sensor_t *s, framesize_t size);
+    int (*set_quality)(sensor_t *s, int quality);
+    int (*set_special_effect)(sensor_t *s, int effect);
+    int (*set_res_raw)(sensor_t *s, int startX, int startY, int endX, int endY, int offsetX,
+                       int offsetY, int totalX, int totalY, int outputX, int outputY, bool scale,
+                       bool binning);
+    int (*get_reg)(sensor_t *s, int reg, int mask);
+    int (*set_brightness)(sensor_t *s, int level);
+    int (*set_contrast)(sensor_t *s, int level);
+    int (*set_saturation)(sensor_t *s, int level);
+    int (*set_whitebal)(sensor_t *s, int enable);
+    int (*set_awb_gain)(sensor_t *s, int enable);
+    int (*set_wb_mode)(sensor_t *s, int mode);
+    int (*set_exposure_ctrl)(sensor_t *s, int enable);
+    int (*set_aec2)(sensor_t *s, int enable);
+    int (*set_ae_level)(sensor_t *s, int level);
+    int (*set_aec_value)(sensor_t *s, int value);
+    int (*set_gain_ctrl)(sensor_t *s, int enable);
+    int (*set_agc_gain)(sensor_t *s, int gain);
+    int (*set_gainceiling)(sensor_t *s, gainceiling_t ceiling);
+    int (*set_bpc)(sensor_t *s, int enable);
+    int (*set_wpc)(sensor_t *s, int enable);
+    int (*set_raw_gma)(sensor_t *s, int enable);
+    int (*set_lenc)(sensor_t *s, int enable);
+    int (*set_hmirror)(sensor_t *s, int enable);
+    int (*set_vflip)(sensor_t *s, int enable);
+    int (*set_dcw)(sensor_t *s, int enable);
+    int (*set_colorbar)(sensor_t *s, int enable);
+};
+
+esp_err_t esp_camera_init(const camera_config_t *config);
+esp_err_t esp_camera_deinit();
+camera_fb_t *esp_camera_fb_get();
+void esp_camera_fb_return(camera_fb_t *fb);
+sensor_t *esp_camera_sensor_get();
+
+#endif // ESP_CAMERA_H
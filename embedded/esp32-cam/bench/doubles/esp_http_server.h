@@ -0,0 +1,77 @@
+#ifndef ESP_HTTP_SERVER_H
+#define ESP_HTTP_SERVER_H
+
+// Host double of the ESP-IDF HTTP server. Nothing listens: handlers are
+// registered and then invoked in-process by benchHttpGet(), which records
+// the response the way a client would see it.
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include "esp_err.h"
+
+#define ESP_ERR_HTTPD_RESULT_TRUNC 0xb00D
+
+typedef void *httpd_handle_t;
+
+typedef enum {
+    HTTP_GET = 1,
+    HTTP_POST = 3,
+} httpd_method_t;
+
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int method;
+    const char *uri;
+    size_t content_len;
+    void *user_ctx;
+
+    // Double only: the request as received and the response as sent
+    std::string query;
+    std::string requestHeaders;    // "Name: value\r\n" lines
+    std::string status;
+    std::string contentType;
+    std::string responseHeaders;
+    size_t responseBytes;          // Status line, headers and body on the wire
+    size_t bodyBytes;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *r);
+    void *user_ctx;
+} httpd_uri_t;
+
+typedef struct {
+    unsigned task_priority;
+    size_t stack_size;
+    int core_id;
+    uint16_t server_port;
+    uint16_t ctrl_port;
+    uint16_t max_open_sockets;
+    uint16_t max_uri_handlers;
+    uint16_t max_resp_headers;
+    uint16_t backlog_conn;
+    bool lru_purge_enable;
+    uint16_t recv_wait_timeout;
+    uint16_t send_wait_timeout;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() httpd_config_t{5, 4096, 0x7FFFFFFF, 80, 32768, 7, 8, 8, 5, false, 5, 5}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri);
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t size);
+size_t httpd_req_get_url_query_len(httpd_req_t *r);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t size);
+esp_err_t httpd_query_key_value(const char *query, const char *key, char *val, size_t size);
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value);
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t len);
+
+#endif // ESP_HTTP_SERVER_H
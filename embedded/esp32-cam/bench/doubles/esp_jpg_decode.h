@@ -0,0 +1,27 @@
+#ifndef ESP_JPG_DECODE_H
+#define ESP_JPG_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+typedef enum {
+    JPG_SCALE_NONE,
+    JPG_SCALE_2X,
+    JPG_SCALE_4X,
+    JPG_SCALE_8X,
+    JPG_SCALE_MAX = JPG_SCALE_8X
+} jpg_scale_t;
+
+typedef size_t (*jpg_reader_cb)(void *arg, size_t index, uint8_t *buf, size_t len);
+typedef bool (*jpg_writer_cb)(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+                              uint8_t *data);
+
+// Reads the whole input through `reader` like the ROM decoder, but the RGB888
+// blocks handed to `writer` are a deterministic pattern taken from the JPEG
+// bytes, not the picture. It times the firmware's per-pixel work, not the
+// decoder's.
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader,
+                         jpg_writer_cb writer, void *arg);
+
+#endif // ESP_JPG_DECODE_H
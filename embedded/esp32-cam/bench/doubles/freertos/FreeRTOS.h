@@ -0,0 +1,58 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+// Host double of the FreeRTOS calls the firmware makes: tasks are threads,
+// ticks are milliseconds, critical sections are recursive mutexes
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void *TaskHandle_t;
+typedef struct HostQueue *QueueHandle_t;
+typedef struct HostSemaphore *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define pdFAIL              0
+#define pdPASS              1
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define tskIDLE_PRIORITY    0
+#define tskNO_AFFINITY      0x7FFFFFFF
+#define PRO_CPU_NUM         0
+#define APP_CPU_NUM         1
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stackDepth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core);
+BaseType_t xPortGetCoreID();
+void vTaskDelay(TickType_t ticks);
+void vTaskDelete(TaskHandle_t task);   // Only the calling task (NULL)
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t increment);
+TickType_t xTaskGetTickCount();
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+struct portMUX_TYPE {
+    std::recursive_mutex lock;
+};
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define portENTER_CRITICAL(mux) ((mux)->lock.lock())
+#define portEXIT_CRITICAL(mux) ((mux)->lock.unlock())
+
+#endif // FREERTOS_H
@@ -0,0 +1,163 @@
+#include <Arduino.h>
+#include <errno.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include "bench_hooks.h"
+
+// Allocation accounting. On glibc malloc and friends are replaced and pass
+// through to the __libc_* entry points, so ArduinoJson, std::string and
+// operator new are all counted; elsewhere only the totals stay at zero.
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<int64_t> current{0};
+static std::atomic<int64_t> peak{0};
+static std::atomic<int64_t> psram{0};
+
+// PSRAM blocks are few and live for the whole run
+static const int PSRAM_BLOCKS = 64;
+static void *psramBlocks[PSRAM_BLOCKS];
+static size_t psramSizes[PSRAM_BLOCKS];
+static std::mutex psramLock;
+
+void benchHeapResetPeak() {
+    peak = current.load();
+}
+
+void benchHeap(BenchHeap &out) {
+    out.allocations = allocations;
+    out.current = current;
+    out.peak = peak;
+    out.psram = psram;
+}
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *p);
+}
+
+static void account(void *p) {
+    if (!p) {
+        return;
+    }
+    allocations++;
+    int64_t now = current += malloc_usable_size(p);
+    int64_t high = peak;
+    while (now > high && !peak.compare_exchange_weak(high, now)) {
+    }
+}
+
+static void release(void *p) {
+    if (p) {
+        current -= malloc_usable_size(p);
+        std::lock_guard<std::mutex> guard(psramLock);
+        for (int i = 0; i < PSRAM_BLOCKS; i++) {
+            if (psramBlocks[i] == p) {
+                psramBlocks[i] = NULL;
+                psram -= psramSizes[i];
+            }
+        }
+    }
+}
+
+extern "C" {
+
+void *malloc(size_t size) {
+    void *p = __libc_malloc(size);
+    account(p);
+    return p;
+}
+
+void *calloc(size_t count, size_t size) {
+    void *p = __libc_calloc(count, size);
+    account(p);
+    return p;
+}
+
+void *realloc(void *p, size_t size) {
+    release(p);
+    void *moved = __libc_realloc(p, size);
+    account(moved ? moved : (size ? p : NULL));
+    return moved;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    void *p = __libc_memalign(alignment, size);
+    account(p);
+    return p;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    *out = memalign(alignment, size);
+    return *out || !size ? 0 : ENOMEM;
+}
+
+void free(void *p) {
+    release(p);
+    __libc_free(p);
+}
+
+}  // extern "C"
+
+static void *trackPsram(void *p) {
+    if (p) {
+        size_t size = malloc_usable_size(p);
+        std::lock_guard<std::mutex> guard(psramLock);
+        for (int i = 0; i < PSRAM_BLOCKS; i++) {
+            if (!psramBlocks[i]) {
+                psramBlocks[i] = p;
+                psramSizes[i] = size;
+                psram += size;
+                break;
+            }
+        }
+    }
+    return p;
+}
+#else
+static void *trackPsram(void *p) {
+    return p;
+}
+#endif
+
+void *ps_malloc(size_t size) {
+    return trackPsram(malloc(size));
+}
+
+void *ps_calloc(size_t count, size_t size) {
+    return trackPsram(calloc(count, size));
+}
+
+void *operator new(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return malloc(size ? size : 1);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
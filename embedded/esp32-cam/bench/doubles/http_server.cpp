@@ -0,0 +1,157 @@
+#include <esp_http_server.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "bench_hooks.h"
+
+static std::vector<httpd_uri_t> handlers;
+static std::mutex serverLock;  // The real server runs one handler at a time
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t * /*config*/) {
+    *handle = &handlers;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t /*handle*/, const httpd_uri_t *uri) {
+    handlers.push_back(*uri);
+    return ESP_OK;
+}
+
+static bool findHeader(httpd_req_t *r, const char *field, std::string &value) {
+    size_t fieldLen = strlen(field);
+    for (size_t pos = 0; pos < r->requestHeaders.size();) {
+        size_t end = r->requestHeaders.find("\r\n", pos);
+        if (end == std::string::npos) {
+            end = r->requestHeaders.size();
+        }
+        const char *line = r->requestHeaders.c_str() + pos;
+        if (end - pos > fieldLen && strncasecmp(line, field, fieldLen) == 0 && line[fieldLen] == ':') {
+            size_t start = pos + fieldLen + 1;
+            while (start < end && r->requestHeaders[start] == ' ') {
+                start++;
+            }
+            value = r->requestHeaders.substr(start, end - start);
+            return true;
+        }
+        pos = end + 2;
+    }
+    return false;
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field) {
+    std::string value;
+    return findHeader(r, field, value) ? value.size() : 0;
+}
+
+static esp_err_t copyOut(const std::string &value, char *buf, size_t size) {
+    if (size == 0) {
+        return ESP_ERR_HTTPD_RESULT_TRUNC;
+    }
+    size_t n = std::min(value.size(), size - 1);
+    memcpy(buf, value.data(), n);
+    buf[n] = '\0';
+    return n < value.size() ? ESP_ERR_HTTPD_RESULT_TRUNC : ESP_OK;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t size) {
+    std::string value;
+    if (!findHeader(r, field, value)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return copyOut(value, val, size);
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r) {
+    return r->query.size();
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t size) {
+    if (r->query.empty()) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return copyOut(r->query, buf, size);
+}
+
+esp_err_t httpd_query_key_value(const char *query, const char *key, char *val, size_t size) {
+    size_t keyLen = strlen(key);
+    for (const char *p = query; *p;) {
+        const char *end = strchr(p, '&');
+        if (!end) {
+            end = p + strlen(p);
+        }
+        if ((size_t)(end - p) >= keyLen && strncmp(p, key, keyLen) == 0 &&
+            (p[keyLen] == '=' || p + keyLen == end)) {
+            const char *value = p + keyLen + (p[keyLen] == '=' ? 1 : 0);
+            return copyOut(std::string(value, end), val, size);
+        }
+        p = *end ? end + 1 : end;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status) {
+    r->status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type) {
+    r->contentType = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value) {
+    r->responseHeaders += std::string(field) + ": " + value + "\r\n";
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t len) {
+    if (len < 0) {
+        len = buf ? strlen(buf) : 0;
+    }
+    char lengthLine[48];
+    snprintf(lengthLine, sizeof(lengthLine), "Content-Length: %u\r\n", (unsigned)len);
+    std::string head = "HTTP/1.1 " + r->status + "\r\nContent-Type: " + r->contentType + "\r\n" +
+                       lengthLine + r->responseHeaders + "\r\n";
+    r->bodyBytes += len;
+    r->responseBytes += head.size() + len;
+    return ESP_OK;
+}
+
+bool benchHttpGet(const char *target, BenchHttpResponse &out, const char *headers) {
+    out = BenchHttpResponse();
+    std::string path = target;
+    std::string query;
+    size_t mark = path.find('?');
+    if (mark != std::string::npos) {
+        query = path.substr(mark + 1);
+        path.erase(mark);
+    }
+
+    std::lock_guard<std::mutex> guard(serverLock);
+    for (const httpd_uri_t &uri : handlers) {
+        if (uri.method != HTTP_GET || path != uri.uri) {
+            continue;
+        }
+        httpd_req_t req = {};
+        req.handle = &handlers;
+        req.method = HTTP_GET;
+        req.uri = target;
+        req.user_ctx = uri.user_ctx;
+        req.query = query;
+        req.requestHeaders = headers ? headers : "";
+        req.status = "200 OK";
+        req.contentType = "text/html";
+        if (uri.handler(&req) != ESP_OK) {
+            return false;
+        }
+        out.status = atoi(req.status.c_str());
+        out.contentType = req.contentType;
+        out.bytes = req.responseBytes;
+        out.bodyBytes = req.bodyBytes;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,13 @@
+#ifndef IMG_CONVERTERS_H
+#define IMG_CONVERTERS_H
+
+#include "esp_camera.h"
+
+typedef size_t (*jpg_out_cb)(void *arg, size_t index, const void *data, size_t len);
+
+// Emits a JPEG header for the given size and a scan sampled from `src`, about
+// as long as the real encoder's output at `quality`
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height,
+                pixformat_t format, uint8_t quality, jpg_out_cb cb, void *arg);
+
+#endif // IMG_CONVERTERS_H
@@ -0,0 +1,8 @@
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+// The stream server only needs select(); viewer sockets are socketpairs
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#endif // LWIP_SOCKETS_H
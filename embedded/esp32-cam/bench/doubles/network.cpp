@@ -0,0 +1,315 @@
+#include <WiFi.h>
+#include <esp_timer.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "bench_hooks.h"
+
+// One end of a connection. `inbound` holds what the device will read; for
+// the backend it is filled once a complete request has been written.
+struct HostSocket {
+    std::mutex lock;
+    bool backend = false;
+    bool open = true;
+    std::string requestHead;      // Backend: head of the request in progress
+    size_t bodyRemaining = 0;     // Backend: body bytes still to come, not kept
+    bool inBody = false;
+    bool websocket = false;       // Backend: upgraded; device frames are counted, not parsed
+    std::string inbound;
+    int64_t inboundReadyUs = 0;   // Backend think time: reply readable from then
+    int fds[2] = {-1, -1};        // Viewer: socketpair, the device writes fds[0]
+
+    ~HostSocket() {
+        for (int fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+};
+
+static const char BACKEND_BODY[] = "{\"status\":\"received\",\"device\":\"bench\"}";
+
+static std::mutex networkLock;
+static std::deque<std::shared_ptr<HostSocket>> pendingViewers;
+static std::vector<std::weak_ptr<HostSocket>> viewers;
+static std::weak_ptr<HostSocket> channelSocket;
+static std::atomic<uint64_t> backendSent{0}, backendReceived{0}, viewerSent{0};
+static std::atomic<uint32_t> backendConnects{0}, backendRequests{0};
+static std::atomic<uint32_t> backendDelayMs{0};
+
+
+
+void benchNetwork(BenchNetwork &out) {
+    out.backendSent = backendSent;
+    out.backendReceived = backendReceived;
+    out.backendConnects = backendConnects;
+    out.backendRequests = backendRequests;
+    out.viewerSent = viewerSent;
+}
+
+void benchBackendSetDelay(uint32_t ms) {
+    backendDelayMs = ms;
+}
+
+bool benchChannelCapture(uint32_t id) {
+    auto socket = channelSocket.lock();
+    if (!socket) {
+        return false;
+    }
+    // Unmasked binary frame: CMD_CAPTURE and the command id
+    uint8_t frame[] = {0x82, 5, 0x81, (uint8_t)id, (uint8_t)(id >> 8), (uint8_t)(id >> 16),
+                       (uint8_t)(id >> 24)};
+    std::lock_guard<std::mutex> guard(socket->lock);
+    socket->inbound.append((const char *)frame, sizeof(frame));
+    return socket->open;
+}
+
+// A viewer's socket holds about as much as lwIP's TCP send buffer would, so a
+// viewer that stops reading backs up partway through a 20 KB frame
+static const int VIEWER_SOCKET_BUFFER = 4096;  // Linux doubles it: about lwIP's 5.7 KB
+
+// `readPauseMs` between reads of at most 1 KB makes a viewer on a slow link
+static void streamConnect(const char *request, uint32_t readPauseMs) {
+    // Writes to a viewer that has hung up fail with EPIPE, as on lwIP
+    signal(SIGPIPE, SIG_IGN);
+    auto socket = std::make_shared<HostSocket>();
+    socketpair(AF_UNIX, SOCK_STREAM, 0, socket->fds);
+    setsockopt(socket->fds[0], SOL_SOCKET, SO_SNDBUF, &VIEWER_SOCKET_BUFFER,
+               sizeof(VIEWER_SOCKET_BUFFER));
+    socket->inbound = request;
+    // The viewer reads what arrives until it hangs up
+    std::thread([socket, readPauseMs] {
+        char buf[16384];
+        size_t chunk = readPauseMs ? 1024 : sizeof(buf);
+        ssize_t n;
+        while ((n = read(socket->fds[1], buf, chunk)) > 0) {
+            viewerSent += n;
+            if (readPauseMs) {
+                delay(readPauseMs);
+            }
+        }
+    }).detach();
+    std::lock_guard<std::mutex> guard(networkLock);
+    pendingViewers.push_back(socket);
+    viewers.push_back(socket);
+}
+
+void benchStreamConnect() {
+    streamConnect("GET /stream HTTP/1.1\r\nHost: bench\r\n\r\n", 0);
+}
+
+void benchStreamConnectIdle() {
+    streamConnect("", 0);
+}
+
+void benchStreamConnectSlow() {
+    streamConnect("GET /stream HTTP/1.1\r\nHost: bench\r\n\r\n", 50);
+}
+
+void benchStreamDisconnectAll() {
+    std::lock_guard<std::mutex> guard(networkLock);
+    for (auto &weak : viewers) {
+        if (auto socket = weak.lock()) {
+            std::lock_guard<std::mutex> socketGuard(socket->lock);
+            socket->open = false;
+            shutdown(socket->fds[1], SHUT_RDWR);
+        }
+    }
+    viewers.clear();
+    pendingViewers.clear();
+}
+
+// A 200 with a small JSON body, readable after the configured think time
+static void backendReply(HostSocket &socket) {
+    char reply[256];
+    int len = snprintf(reply, sizeof(reply),
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: application/json\r\n"
+                       "Content-Length: %u\r\n"
+                       "Connection: keep-alive\r\n"
+                       "\r\n%s",
+                       (unsigned)(sizeof(BACKEND_BODY) - 1), BACKEND_BODY);
+    socket.inbound.append(reply, len);
+    socket.inboundReadyUs = esp_timer_get_time() + (int64_t)backendDelayMs * 1000;
+    backendRequests++;
+}
+
+// The backend channel's upgrade; later writes on the socket are frames
+static void backendUpgrade(HostSocket &socket) {
+    socket.inbound += "HTTP/1.1 101 Switching Protocols\r\n"
+                      "Upgrade: websocket\r\n"
+                      "Connection: Upgrade\r\n"
+                      "\r\n";
+    socket.websocket = true;
+}
+
+// Queue the reply once the request head and its Content-Length body are in.
+// Only the head is kept, so the double adds no frame-sized buffer of its own.
+static void backendConsume(HostSocket &socket, const uint8_t *buf, size_t len) {
+    while (len > 0 && !socket.websocket) {
+        if (socket.inBody) {
+            size_t n = min(len, socket.bodyRemaining);
+            socket.bodyRemaining -= n;
+            buf += n;
+            len -= n;
+        } else {
+            socket.requestHead += (char)*buf++;
+            len--;
+            size_t headLen = socket.requestHead.size();
+            if (headLen < 4 || socket.requestHead.compare(headLen - 4, 4, "\r\n\r\n") != 0) {
+                continue;
+            }
+            if (socket.requestHead.find("Upgrade: websocket") != std::string::npos) {
+                socket.requestHead.clear();
+                backendUpgrade(socket);
+                return;
+            }
+            size_t at = socket.requestHead.find("Content-Length:");
+            socket.bodyRemaining =
+                at == std::string::npos ? 0 : strtoul(socket.requestHead.c_str() + at + 15, NULL, 10);
+            socket.requestHead.clear();
+            socket.inBody = true;
+        }
+        if (socket.inBody && socket.bodyRemaining == 0) {
+            socket.inBody = false;
+            backendReply(socket);
+        }
+    }
+}
+
+// --- WiFiClient ---
+
+int WiFiClient::connect(const char * /*host*/, uint16_t /*port*/, int32_t /*timeoutMs*/) {
+    socket = std::make_shared<HostSocket>();
+    socket->backend = true;
+    backendConnects++;
+    return 1;
+}
+
+uint8_t WiFiClient::connected() {
+    if (!socket) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(socket->lock);
+    return socket->open || !socket->inbound.empty();
+}
+
+void WiFiClient::stop() {
+    if (socket) {
+        std::lock_guard<std::mutex> guard(socket->lock);
+        socket->open = false;
+    }
+    socket.reset();
+}
+
+int WiFiClient::fd() const {
+    return socket ? socket->fds[0] : -1;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t len) {
+    if (!socket) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(socket->lock);
+    if (!socket->open) {
+        return 0;
+    }
+    if (socket->backend) {
+        backendSent += len;
+        backendConsume(*socket, buf, len);
+        if (socket->websocket) {
+            channelSocket = socket;
+        }
+    } else {
+        // Counted by the viewer's reader as it drains the socket
+        ssize_t n = send(socket->fds[0], buf, len, 0);
+        return n > 0 ? n : 0;
+    }
+    return len;
+}
+
+int WiFiClient::available() {
+    if (!socket) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(socket->lock);
+    if (esp_timer_get_time() < socket->inboundReadyUs) {
+        return 0;
+    }
+    return socket->inbound.size();
+}
+
+int WiFiClient::read(uint8_t *buf, size_t len) {
+    int avail = available();
+    if (avail <= 0) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> guard(socket->lock);
+    len = min(len, socket->inbound.size());
+    memcpy(buf, socket->inbound.data(), len);
+    socket->inbound.erase(0, len);
+    if (socket->backend) {
+        backendReceived += len;
+    }
+    return len;
+}
+
+int WiFiClient::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+WiFiClient WiFiServer::available() {
+    std::lock_guard<std::mutex> guard(networkLock);
+    if (pendingViewers.empty()) {
+        return WiFiClient();
+    }
+    WiFiClient client(pendingViewers.front());
+    pendingViewers.pop_front();
+    return client;
+}
+
+// --- WiFi ---
+
+WiFiClass WiFi;
+static uint8_t bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+wl_status_t WiFiClass::begin(const char * /*ssid*/, const char * /*password*/, int32_t /*channel*/,
+                             const uint8_t * /*bssid*/, bool /*connect*/) {
+    return WL_CONNECTED;
+}
+
+bool WiFiClass::config(IPAddress /*localIp*/, IPAddress /*gateway*/, IPAddress /*subnet*/,
+                       IPAddress /*dns1*/, IPAddress /*dns2*/) {
+    return true;
+}
+
+bool WiFiClass::disconnect(bool /*wifiOff*/, bool /*eraseAp*/) {
+    return true;
+}
+
+wl_status_t WiFiClass::status() {
+    return WL_CONNECTED;
+}
+
+bool WiFiClass::mode(wifi_mode_t /*mode*/) {
+    return true;
+}
+
+int WiFiClass::onEvent(WiFiEventFuncCb /*callback*/, WiFiEvent_t /*event*/) {
+    return 0;
+}
+
+IPAddress WiFiClass::localIP() { return IPAddress(192, 168, 4, 2); }
+IPAddress WiFiClass::gatewayIP() { return IPAddress(192, 168, 4, 1); }
+IPAddress WiFiClass::subnetMask() { return IPAddress(255, 255, 255, 0); }
+IPAddress WiFiClass::dnsIP(uint8_t /*index*/) { return IPAddress(192, 168, 4, 1); }
+uint8_t *WiFiClass::BSSID() { return bssid; }
+int32_t WiFiClass::channel() { return 6; }
+int8_t WiFiClass::RSSI() { return -58; }
@@ -0,0 +1,274 @@
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// --- LittleFS ---
+
+struct HostFsNode {
+    bool directory;
+    std::string data;
+};
+
+// Size of partitions_ota.csv's filesystem
+static const size_t FS_TOTAL_BYTES = 896 * 1024;
+
+static std::recursive_mutex fsLock;
+static std::map<std::string, std::shared_ptr<HostFsNode>> nodes;
+
+HostFs LittleFS;
+
+File::File(std::shared_ptr<HostFsNode> node, const std::string &path, bool append)
+    : node(node), path(path), pos(append ? node->data.size() : 0) {}
+
+size_t File::write(const uint8_t *buf, size_t len) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    if (!node || node->directory) {
+        return 0;
+    }
+    if (LittleFS.usedBytes() + len > FS_TOTAL_BYTES) {
+        return 0;
+    }
+    if (pos + len > node->data.size()) {
+        node->data.resize(pos + len);
+    }
+    memcpy(&node->data[pos], buf, len);
+    pos += len;
+    return len;
+}
+
+int File::available() {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    return node && pos < node->data.size() ? node->data.size() - pos : 0;
+}
+
+int File::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t File::read(uint8_t *buf, size_t len) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    len = min(len, (size_t)available());
+    if (len > 0) {
+        memcpy(buf, node->data.data() + pos, len);
+        pos += len;
+    }
+    return len;
+}
+
+bool File::seek(uint32_t to) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    if (!node || to > node->data.size()) {
+        return false;
+    }
+    pos = to;
+    return true;
+}
+
+size_t File::size() const {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    return node ? node->data.size() : 0;
+}
+
+const char *File::name() const {
+    size_t slash = path.rfind('/');
+    return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+bool File::isDirectory() const {
+    return node && node->directory;
+}
+
+File File::openNextFile() {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    if (!isDirectory()) {
+        return File();
+    }
+    std::string prefix = path + "/";
+    size_t index = 0;
+    for (auto &entry : nodes) {
+        const std::string &p = entry.first;
+        if (p.compare(0, prefix.size(), prefix) != 0 ||
+            p.find('/', prefix.size()) != std::string::npos) {
+            continue;
+        }
+        if (index++ == dirIndex) {
+            dirIndex++;
+            return File(entry.second, p, false);
+        }
+    }
+    return File();
+}
+
+void File::close() {
+    node.reset();
+}
+
+bool HostFs::begin(bool /*formatOnFail*/) {
+    return true;
+}
+
+File HostFs::open(const char *path, const char *mode) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    auto it = nodes.find(path);
+    if (mode[0] == 'r') {
+        return it == nodes.end() ? File() : File(it->second, path, false);
+    }
+    if (it == nodes.end() || mode[0] == 'w') {
+        nodes[path] = std::make_shared<HostFsNode>(HostFsNode{false, ""});
+    }
+    return File(nodes[path], path, mode[0] == 'a');
+}
+
+bool HostFs::exists(const char *path) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    return nodes.count(path) > 0;
+}
+
+bool HostFs::remove(const char *path) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    return nodes.erase(path) > 0;
+}
+
+bool HostFs::mkdir(const char *path) {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    if (!nodes.count(path)) {
+        nodes[path] = std::make_shared<HostFsNode>(HostFsNode{true, ""});
+    }
+    return true;
+}
+
+size_t HostFs::totalBytes() {
+    return FS_TOTAL_BYTES;
+}
+
+size_t HostFs::usedBytes() {
+    std::lock_guard<std::recursive_mutex> guard(fsLock);
+    size_t used = 0;
+    for (auto &entry : nodes) {
+        used += entry.second->data.size();
+    }
+    return used;
+}
+
+// --- Preferences ---
+
+static std::mutex nvsLock;
+static std::map<std::string, std::vector<uint8_t>> nvs;  // "namespace/key"
+
+bool Preferences::begin(const char *name, bool readOnly) {
+    ns = name;
+    this->readOnly = readOnly;
+    return true;
+}
+
+void Preferences::end() {
+    ns.clear();
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len) {
+    if (readOnly || ns.empty()) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(nvsLock);
+    const uint8_t *bytes = (const uint8_t *)value;
+    nvs[ns + "/" + key].assign(bytes, bytes + len);
+    return len;
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen) {
+    std::lock_guard<std::mutex> guard(nvsLock);
+    auto it = nvs.find(ns + "/" + key);
+    if (it == nvs.end() || it->second.size() > maxLen) {
+        return 0;
+    }
+    memcpy(buf, it->second.data(), it->second.size());
+    return it->second.size();
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    std::lock_guard<std::mutex> guard(nvsLock);
+    auto it = nvs.find(ns + "/" + key);
+    return it == nvs.end() ? 0 : it->second.size();
+}
+
+bool Preferences::remove(const char *key) {
+    std::lock_guard<std::mutex> guard(nvsLock);
+    return nvs.erase(ns + "/" + key) > 0;
+}
+
+// --- OTA ---
+
+static const esp_partition_t appSlots[2] = {
+    {0x10000, 0x180000, "app0"},
+    {0x190000, 0x180000, "app1"},
+};
+
+const esp_partition_t *esp_ota_get_running_partition() {
+    return &appSlots[0];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t * /*start*/) {
+    return &appSlots[1];
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t * /*partition*/, size_t /*imageSize*/,
+                        esp_ota_handle_t * /*handle*/) {
+    return ESP_FAIL;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t /*handle*/, const void * /*data*/, size_t /*size*/) {
+    return ESP_FAIL;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t /*handle*/) {
+    return ESP_FAIL;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t /*handle*/) {
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t * /*partition*/) {
+    return ESP_FAIL;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t * /*partition*/,
+                                      esp_ota_img_states_t *state) {
+    *state = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback() {
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot() {
+    return ESP_FAIL;
+}
+
+void mbedtls_sha256_init(mbedtls_sha256_context *ctx) {
+    ctx->length = 0;
+}
+
+void mbedtls_sha256_free(mbedtls_sha256_context * /*ctx*/) {}
+
+int mbedtls_sha256_starts(mbedtls_sha256_context *ctx, int /*is224*/) {
+    ctx->length = 0;
+    return 0;
+}
+
+int mbedtls_sha256_update(mbedtls_sha256_context *ctx, const unsigned char * /*input*/,
+                          size_t len) {
+    ctx->length += len;
+    return 0;
+}
+
+int mbedtls_sha256_finish(mbedtls_sha256_context * /*ctx*/, unsigned char output[32]) {
+    memset(output, 0, 32);
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef BACKEND_CHANNEL_H
+#define BACKEND_CHANNEL_H
+
+#include <Arduino.h>
+
+// One outbound WebSocket to API_CHANNEL_ENDPOINT on the backend, kept open by
+// its own task so the backend can reach the device without inbound
+// connections. The device pushes a metrics summary every CHANNEL_METRICS_MS;
+// the backend sends capture commands (answered with the frame, pushed on the
+// same connection), requests for the full frame behind a thumbnail upload,
+// and capture interval and ROI changes. Messages are binary: a type byte
+// and a little-endian u32 id, then the payload (see API.md "Backend
+// channel"). A lost connection is reopened with a backoff doubling
+// from CHANNEL_RECONNECT_MIN_MS to CHANNEL_RECONNECT_MAX_MS.
+bool startBackendChannel();
+
+struct ChannelStats {
+    bool connected;
+    uint32_t connects;         // Handshakes the backend accepted
+    uint32_t failures;         // Connect or handshake attempts that failed
+    uint32_t disconnects;      // Connections lost after being up
+    uint32_t commands;         // Commands received
+    uint32_t framesSent;       // Frames pushed for capture and full frame commands
+    uint32_t metricsSent;
+    uint32_t lastCaptureMs;    // Capture command until its frame was sent
+    uint32_t backoffMs;        // Wait before the next attempt, 0 while connected
+};
+
+void getChannelStats(ChannelStats &out);
+
+#endif // BACKEND_CHANNEL_H
@@ -0,0 +1,59 @@
+#ifndef CAMERA_CAPTURE_H
+#define CAMERA_CAPTURE_H
+
+#include <Arduino.h>
+#include "frame_pool.h"
+
+// What one reading capture cost
+struct CaptureInfo {
+    int warmupFrames;          // Frames discarded while exposure settled
+    bool settled;              // False if the warm-up hit its frame/time limit
+    uint32_t warmupUs;
+    uint32_t flashOnUs;        // How long the flash LED was lit
+    int burstFrames;           // Frames scored after warm-up
+    int bestFrame;             // Index of the kept one within the burst
+    int16_t score;             // Its FrameScore, -1 if none was taken
+    uint32_t scoreUs;          // Decode and scoring time over the burst
+    uint32_t totalUs;          // Including waiting for the camera
+};
+
+struct CaptureStats {
+    uint32_t captures;
+    uint32_t failures;
+    uint32_t unsettled;        // Captures taken at the warm-up limit
+    CaptureInfo last;
+    uint32_t avgTotalUs;
+    uint32_t avgWarmupFrames;  // Smoothed, in 1/16 frames
+    uint32_t snapshotsCached;  // captureSnapshot() calls served without an exposure
+    uint32_t snapshotsExposed; // ... that had to capture
+};
+
+// Call once from setup(), before the servers start.
+void captureInit();
+
+// Take one frame in the reading profile with the flash on. Instead of a
+// fixed number of warm-up frames, frames are discarded only until the
+// sensor's AEC/AGC readings stop moving (bounded by WARMUP_MAX_FRAMES and
+// WARMUP_TIMEOUT_MS), so the flash is on no longer than needed. Then
+// BURST_FRAMES frames are taken and scored (frame_score.h) and only the best
+// is kept, its score in the frame. Returns a pool frame with one reference,
+// or NULL.
+PooledFrame *captureReading(CaptureInfo &info);
+
+// A new reference to the frame the last successful captureReading() took,
+// whoever asked for it (/capture, auto-captures, the backend channel), or
+// NULL before the first one.
+PooledFrame *lastReading();
+
+// lastReading() if it is younger than `maxAgeMs`, otherwise a new
+// captureReading(). Lets viewers polling for a picture share one exposure
+// instead of each firing the flash; callers that find it stale at the same
+// time wait for one exposure. Returns a new reference or NULL.
+PooledFrame *captureSnapshot(uint32_t maxAgeMs);
+
+// Append an "X-Frame-Score: ..." upload header line for a scored frame.
+void captureScoreHeader(const PooledFrame *frame, char *buf, size_t size);
+
+void getCaptureStats(CaptureStats &out);
+
+#endif // CAMERA_CAPTURE_H
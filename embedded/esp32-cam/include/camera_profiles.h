@@ -0,0 +1,60 @@
+#ifndef CAMERA_PROFILES_H
+#define CAMERA_PROFILES_H
+
+#include <Arduino.h>
+#include <esp_camera.h>
+
+enum CameraProfileId {
+    PROFILE_PREVIEW = 0,   // Low resolution, high compression - aiming the camera
+    PROFILE_READING,       // Full resolution - frames sent for OCR
+    PROFILE_COUNT
+};
+
+struct CameraProfile {
+    const char *name;
+    framesize_t frameSize;
+    int jpegQuality;
+    bool grayscale;            // Sensor's grayscale effect, JPEG without chroma
+};
+
+// Sensor window applied on top of the reading profile
+struct CameraRoi {
+    bool enabled;
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+};
+
+struct CameraProfileStats {
+    CameraProfileId active;
+    uint32_t switches;
+    uint32_t lastSwitchUs;     // Register writes until the first frame at the new size
+    uint32_t maxSwitchUs;
+    uint32_t staleFrames;      // Frames discarded after switches, total
+};
+
+// Call once after esp_camera_init(); `initial` must match the init config.
+// Loads the ROI from NVS (or config.h defaults).
+void cameraProfilesInit(CameraProfileId initial);
+
+// Take exclusive use of the sensor in the given profile, switching to it
+// first if needed. Returns false if the camera stays busy for `wait` ticks
+// or the switch fails. Every successful acquire needs a cameraRelease().
+bool cameraAcquire(CameraProfileId id, TickType_t wait);
+void cameraRelease();
+
+const CameraProfile &cameraProfile(CameraProfileId id);
+
+// Set the reading-profile ROI. The window is aligned to the sensor's
+// granularity and must fit inside READING_FRAME_SIZE; the stored value is
+// written back to `roi`. Persisted in NVS and applied on the next acquire.
+bool cameraSetRoi(CameraRoi &roi);
+void cameraGetRoi(CameraRoi &out);
+
+// Upload header lines describing reading-profile frames (currently X-ROI
+// when the sensor window is on). Writes an empty string if there are none.
+void cameraFrameHeaders(char *buf, size_t size);
+void getCameraProfileStats(CameraProfileStats &out);
+
+#endif // CAMERA_PROFILES_H
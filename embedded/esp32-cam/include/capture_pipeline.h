@@ -0,0 +1,53 @@
+#ifndef CAPTURE_PIPELINE_H
+#define CAPTURE_PIPELINE_H
+
+#include <Arduino.h>
+
+// Auto-capture runs as two tasks joined by a queue of CAPTURE_QUEUE_LENGTH
+// frames: the capture task takes a reading-profile frame right away and then
+// once per capture interval, the upload task sends queued frames to the backend.
+// The interval starts at CAPTURE_INTERVAL_MS; any backend reply carrying an
+// X-Capture-Interval header (seconds) replaces it, within
+// CAPTURE_INTERVAL_MIN_MS..CAPTURE_INTERVAL_MAX_MS, from the next capture on.
+// When the queue is full the capture is skipped rather than piling up stale
+// readings, so a slow backend never stalls the web server or the camera.
+// With CHANGE_DETECTION_ENABLED and a sensor ROI set, frames matching the
+// last one sent are replaced by a heartbeat to API_HEARTBEAT_ENDPOINT. With edge OCR on,
+// confidently decoded frames are posted as a reading to API_READING_ENDPOINT.
+bool startCapturePipeline();
+
+struct PipelineStats {
+    uint32_t captured;
+    uint32_t captureFailures;
+    uint32_t skipped;          // Captures skipped because the queue was full
+    uint32_t uploaded;         // Uploads that got an HTTP 2xx
+    uint32_t unchanged;        // Frames not uploaded because the display looked the same
+    uint32_t heartbeats;       // Heartbeats the backend accepted in their place
+    uint32_t edgeReadings;     // Readings decoded on the device and posted as numbers
+    uint32_t uploadFailures;
+    uint32_t queued;           // Frames waiting right now
+    uint32_t queueHighWater;
+    uint32_t lastUploadUs;
+    uint32_t firstReadingMs;   // Uptime when the backend first accepted a reading, 0 until then
+    uint32_t intervalMs;       // Current capture interval
+    uint32_t intervalChanges;  // Times the backend changed it
+};
+
+void getPipelineStats(PipelineStats &out);
+
+// Take one reading and deliver it on the calling task, the same way the
+// upload task would (change check, edge OCR, upload or spool), then replay
+// the spool. For the deep-sleep duty cycle, which runs no pipeline tasks.
+// Returns true if the backend got the reading or a heartbeat.
+bool runCaptureCycle();
+
+// Current capture interval, as last set by the backend
+uint32_t captureIntervalMs();
+
+// Set the capture interval, clamped to CAPTURE_INTERVAL_MIN_MS..MAX_MS. The
+// next auto-capture is due that long after the last one, so a shorter
+// interval can start it right away. For X-Capture-Interval replies and the
+// backend channel.
+void setCaptureInterval(uint32_t ms);
+
+#endif // CAPTURE_PIPELINE_H
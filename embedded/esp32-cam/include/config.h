@@ -1,29 +1,54 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <esp_camera.h>
+
 // WiFi Configuration - Set these in your .env file (copy .env.example)
 // These will be injected at build time from environment variables
 #ifdef WIFI_SSID_ENV
-const char* WIFI_SSID = WIFI_SSID_ENV;
+const char* const WIFI_SSID = WIFI_SSID_ENV;
 #else
-const char* WIFI_SSID = "Hide yo Kids, Hide yo WiFi";  // Fallback value
+const char* const WIFI_SSID = "Hide yo Kids, Hide yo WiFi";  // Fallback value
 #endif
 
 #ifdef WIFI_PASSWORD_ENV
-const char* WIFI_PASSWORD = WIFI_PASSWORD_ENV;
+const char* const WIFI_PASSWORD = WIFI_PASSWORD_ENV;
 #else
-const char* WIFI_PASSWORD = "0ui0ui0ui";  // Fallback value
+const char* const WIFI_PASSWORD = "0ui0ui0ui";  // Fallback value
 #endif
 
+// Fast boot - the access point's BSSID/channel and the last DHCP lease are
+// cached (RTC memory, NVS for power loss) and reused to skip the scan and
+// DHCP on the next boot. Falls back to a normal connect if that fails.
+const bool FASTBOOT_ENABLED = true;
+const bool FASTBOOT_REUSE_IP = true;             // Configure the cached lease as a static IP
+const unsigned long FASTBOOT_WIFI_TIMEOUT_MS = 2000;  // Cached association attempt before a full scan
+const unsigned long WIFI_CONNECT_TIMEOUT_MS = 15000;  // One attempt, before backing off
+const unsigned long WIFI_RECONNECT_MIN_MS = 1000;    // First backoff after a failed attempt, doubling
+const unsigned long WIFI_RECONNECT_MAX_MS = 60000;   // Backoff limit
+
 // Camera Web Server Configuration
 const int WEB_SERVER_PORT = 80;                  // Port for web interface
+const int CONTROL_MAX_SOCKETS = 5;               // Concurrent web interface connections
+const int CONTROL_TASK_CORE = 1;                 // APP CPU, like the stream and pipeline tasks
+const int CONTROL_TASK_STACK_SIZE = 8192;        // Control server task stack in bytes
+const size_t REQUEST_ARENA_SIZE = 16384;         // PSRAM for building one response (request_arena.h)
+const int CONTROL_SOCKET_TIMEOUT_S = 5;          // Drop clients that stall mid-request
 const int STREAM_SERVER_PORT = 81;               // Port for video streaming
+const int STREAM_MAX_CLIENTS = 4;                // Viewers sharing each streamed frame
+const int STREAM_TASK_CORE = 1;                  // APP CPU - the WiFi stack runs on core 0
+const int STREAM_TASK_STACK_SIZE = 4096;         // Stream task stack in bytes
+const int STREAM_TARGET_FPS = 15;                // Stream frame rate the pacer aims for
+const int STREAM_MAX_PENDING = 4;                // Connections still sending their request
+const unsigned long STREAM_HANDSHAKE_MS = 1000;  // Time a new connection has to send it
+const unsigned long STREAM_SEND_TIMEOUT_MS = 100; // A viewer that takes longer for one frame is dropped
+const unsigned long STREAM_STATS_LOG_MS = 10000; // Serial stream stats interval while streaming
 
 // WattBox Backend API Configuration
 #ifdef API_HOST_ENV
-const char* API_HOST = API_HOST_ENV;
+const char* const API_HOST = API_HOST_ENV;
 #else
-const char* API_HOST = "192.168.10.17";          // Fallback value - Your Mac's IP
+const char* const API_HOST = "192.168.10.17";          // Fallback value - Your Mac's IP
 #endif
 
 #ifdef API_PORT_ENV
@@ -32,28 +57,220 @@ const int API_PORT = API_PORT_ENV;
 const int API_PORT = 8000;                       // Fallback value
 #endif
 
-const char* API_ENDPOINT = "/api/upload";        // Upload endpoint
+const char* const API_ENDPOINT = "/api/upload";  // Upload endpoint
+const char* const API_BATCH_ENDPOINT = "/api/upload/batch";  // Replay of spooled frames
+const char* const API_HEARTBEAT_ENDPOINT = "/api/upload/heartbeat";  // Unchanged frames
+const char* const API_READING_ENDPOINT = "/api/upload/reading";  // Readings decoded on the device
+const char* const API_METERS_ENDPOINT = "/api/upload/meters";  // One crop per meter in view
+const size_t UPLOAD_CHUNK_SIZE = 4096;           // Bytes handed to the socket per write, straight from the frame buffer
+const size_t UPLOAD_RESPONSE_MAX = 512;          // Backend reply bytes kept for /send_to_api, the rest is discarded
+const unsigned long UPLOAD_TIMEOUT_MS = 10000;   // Connect and response timeout for backend uploads
+
+// Backend channel - a WebSocket the device keeps open to the backend, which
+// sends capture commands and config changes over it (backend_channel.h)
+const bool CHANNEL_ENABLED = true;
+const char* const API_CHANNEL_ENDPOINT = "/api/device/channel";
+const unsigned long CHANNEL_METRICS_MS = 60000;  // Metrics summary push interval
+const unsigned long CHANNEL_PING_MS = 30000;     // Ping after this long without traffic; twice that drops the link
+const unsigned long CHANNEL_RECONNECT_MIN_MS = 1000;  // First backoff after a failed attempt, doubling
+const unsigned long CHANNEL_RECONNECT_MAX_MS = 60000;
+const unsigned long CHANNEL_POLL_MS = 20;        // Idle wait between reads of the connection
+const size_t CHANNEL_MESSAGE_MAX = 512;          // Largest message taken from the backend
+const size_t CHANNEL_WRITE_CHUNK = 1436;         // Masked bytes per socket write (one TCP segment)
+const int CHANNEL_TASK_STACK_SIZE = 4096;
+const int CHANNEL_TASK_CORE = 1;                 // APP CPU, like the other tasks
 
 // Camera Settings
-const int CAPTURE_INTERVAL_MS = 60000;           // Capture image every 60 seconds
+const int CAPTURE_INTERVAL_MS = 60000;           // Capture interval until the backend sets one
+const unsigned long CAPTURE_INTERVAL_MIN_MS = 30000;    // Bounds on the interval the backend may ask
+const unsigned long CAPTURE_INTERVAL_MAX_MS = 3600000;  // for with X-Capture-Interval
 const bool AUTO_CAPTURE_ENABLED = false;         // Set to true to enable automatic capture
+const int CAPTURE_QUEUE_LENGTH = 2;              // Frames waiting for upload (frame pool slots)
+const int PIPELINE_TASK_STACK_SIZE = 6144;       // Capture and upload task stacks in bytes
+const int PIPELINE_TASK_CORE = 1;                // APP CPU, next to loop() and the stream
+
+// Deep-sleep duty cycle - for battery installs. Each wake takes one reading,
+// delivers it (change detection, edge OCR and the spool still apply) and
+// sleeps until the next capture interval is due; the web and stream servers are
+// not started. The currents only feed the per-cycle energy estimate.
+const bool DEEP_SLEEP_ENABLED = false;
+const unsigned long DEEP_SLEEP_MIN_MS = 5000;    // Shortest sleep, even after a slow cycle
+const float DUTY_AWAKE_CURRENT_MA = 180.0f;      // Board with WiFi and camera running
+const float DUTY_SLEEP_CURRENT_MA = 3.0f;        // AI-Thinker board in deep sleep (regulator, PSRAM)
+
+// Offline spool - auto-captures that can't be uploaded are kept in LittleFS
+// (oldest dropped first) and replayed in batches once the backend is back
+const int SPOOL_MAX_FRAMES = 64;
+const size_t SPOOL_MAX_BYTES = 768 * 1024;       // Must fit the filesystem partition
+const int SPOOL_MAX_WIDTH = 800;                 // Wider frames are stored grayscale at 1/2^n scale (about 40 KB, not 180)
+const int SPOOL_JPEG_QUALITY = 50;               // 1-100, for those
+const size_t SPOOL_SHRINK_OUTPUT_SIZE = 128 * 1024;  // Largest downscaled frame (PSRAM while spooling)
+const int SPOOL_BATCH_MAX = 8;                   // Frames per replay request
+const unsigned long SPOOL_REPLY_TIMEOUT_MS = 90000;  // The backend OCRs the whole batch before it replies
+const unsigned long SPOOL_RETRY_MS = 30000;      // Replay attempt interval while frames are pending
+
+// Firmware updates (ota_update.h) - /ota streams an image from the backend
+// into the inactive app slot of partitions_ota.csv and reboots into it. The
+// new image is on trial until one capture and upload succeed on its first
+// boot; failing that, restarting OTA_TRIAL_BOOTS times first or not getting
+// there within OTA_HEALTH_TIMEOUT_MS boots the previous image again.
+const char* const API_FIRMWARE_ENDPOINT = "/api/firmware";  // Images are fetched from here/<name>
+const size_t OTA_CHUNK_SIZE = 4096;              // Bytes hashed and written to flash at once (one sector)
+const int OTA_TASK_STACK_SIZE = 4096;
+const int OTA_TASK_CORE = 1;                     // APP CPU, like the other tasks
+const int OTA_TRIAL_BOOTS = 3;                   // Boots of a new image before it has to pass
+const int OTA_HEALTH_ATTEMPTS = 3;               // Captures and uploads tried on the first boot
+const unsigned long OTA_HEALTH_RETRY_MS = 5000;  // Between those attempts
+const unsigned long OTA_HEALTH_TIMEOUT_MS = 120000;  // Boot until the health check has to have passed
+
+// Frame buffers - the driver's buffers are only borrowed; frames the firmware
+// keeps are copied into the PSRAM frame pool
+const int CAMERA_FB_COUNT = 2;                   // Camera driver frame buffers
+const int FRAME_POOL_SLOTS = 5;                  // Pool slots: last capture, upload queue, upload in flight, kept full frame
+const size_t FRAME_POOL_SLOT_SIZE = 1600 * 1200 / 5;  // Driver's JPEG buffer size at UXGA
+
+// Sensor profiles - switched with sensor register writes, no camera re-init.
+// The camera is initialised with the reading profile, so its frame size must
+// be the largest one (frame buffers are allocated for it).
+const framesize_t PREVIEW_FRAME_SIZE = FRAMESIZE_VGA;   // 640x480 for /stream
+const int PREVIEW_JPEG_QUALITY = 20;                    // 0-63, higher = smaller
+const framesize_t READING_FRAME_SIZE = FRAMESIZE_UXGA;  // 1600x1200 for /capture and auto-capture
+const int READING_JPEG_QUALITY = 10;
+const int PROFILE_SWITCH_MAX_FRAMES = 4;         // Stale frames discarded at most after a switch
+
+// Format of reading-profile frames sent for OCR. The backend only needs the
+// digits' shapes, so colour and fine JPEG detail are wasted upload bytes:
+// - OCR_FORMAT_JPEG: colour JPEG at READING_JPEG_QUALITY
+// - OCR_FORMAT_GRAY_JPEG: the sensor outputs grayscale JPEG at
+//   OCR_GRAY_JPEG_QUALITY (also what /capture returns)
+// - OCR_FORMAT_BITMAP: auto-captures are thresholded on the device and
+//   uploaded as a 1 bit per pixel PBM (image/x-portable-bitmap)
+enum OcrUploadFormat { OCR_FORMAT_JPEG, OCR_FORMAT_GRAY_JPEG, OCR_FORMAT_BITMAP };
+const OcrUploadFormat OCR_UPLOAD_FORMAT = OCR_FORMAT_JPEG;
+const int OCR_GRAY_JPEG_QUALITY = 14;
+const int OCR_BITMAP_MAX_WIDTH = 800;            // Bitmaps use the first 1/2^n scale that fits
+const size_t OCR_BITMAP_BUFFER_SIZE = 800 * 600 + 32;  // Grayscale plus PBM header (PSRAM)
+
+// Two-tier upload (thumbnail.h) - auto-captures are uploaded as a small
+// grayscale JPEG and the full frame is kept, for the backend to fetch by
+// sequence number when OCR on the thumbnail isn't confident. Not used with
+// OCR_FORMAT_BITMAP, whose uploads are small already, or in deep sleep.
+const bool THUMBNAIL_UPLOAD_ENABLED = true;
+const int THUMBNAIL_MAX_WIDTH = 400;             // Thumbnails use the first 1/2^n scale that fits
+const int THUMBNAIL_JPEG_QUALITY = 40;           // 1-100, higher = larger
+const size_t THUMBNAIL_GRAY_SIZE = 400 * 300;    // Decoded grayscale (PSRAM)
+const size_t THUMBNAIL_OUTPUT_SIZE = 48 * 1024;  // Encoded thumbnail (PSRAM)
+const int THUMBNAIL_KEEP_FRAMES = 1;             // Full frames kept at once, a frame pool slot each
+const unsigned long THUMBNAIL_KEEP_MS = 120000;  // How long the backend can fetch one
+
+// LCD region of interest for the reading profile, in pixels of a full
+// READING_FRAME_SIZE capture. When enabled the sensor outputs only this
+// window, so uploads carry just the display. Can be changed at runtime via
+// /roi (stored in NVS, which then takes precedence over these defaults).
+const bool ROI_ENABLED = false;
+const int ROI_X = 400;
+const int ROI_Y = 480;
+const int ROI_WIDTH = 800;                       // Rounded down to a multiple of 16
+const int ROI_HEIGHT = 240;                      // Rounded down to a multiple of 16
+
+// Multi-meter (meter_regions.h) - several meters in one camera's view, each
+// a named region of the reading frame (pixels of the sensor window when the
+// ROI is on) mapped to its own meter ID. An auto-capture is decoded once,
+// each region is cropped and encoded as grayscale JPEG, and all crops go to
+// API_METERS_ENDPOINT in one multipart request, instead of a thumbnail or
+// edge OCR reading. Set at runtime via /meters (stored in NVS); with no
+// regions whole frames are uploaded as before.
+const int METER_REGIONS_MAX = 4;
+const int METER_NAME_MAX = 15;                   // Region name length, e.g. "gas"
+const int METER_ID_MAX = 31;                     // Meter ID length; letters, digits, '-', '_' and '.'
+const int METER_JPEG_QUALITY = 80;               // 1-100, crops are full resolution
+const size_t METER_GRAY_SIZE = 384 * 1024;       // All regions' grayscale crops together (PSRAM)
+const size_t METER_OUTPUT_SIZE = 96 * 1024;      // All encoded crops together (PSRAM)
 
 // Device Configuration
 #ifdef DEVICE_NAME_ENV
-const char* DEVICE_NAME = DEVICE_NAME_ENV;
+const char* const DEVICE_NAME = DEVICE_NAME_ENV;
 #else
-const char* DEVICE_NAME = "ESP32-CAM-Meter-1";   // Fallback value
+const char* const DEVICE_NAME = "ESP32-CAM-Meter-1";   // Fallback value
 #endif
 
 #ifdef DEVICE_ID_ENV
-const char* DEVICE_ID = DEVICE_ID_ENV;
+const char* const DEVICE_ID = DEVICE_ID_ENV;
 #else
-const char* DEVICE_ID = "meter_cam_001";         // Fallback value
+const char* const DEVICE_ID = "meter_cam_001";         // Fallback value
 #endif
 
-// LED Flash Configuration
+// LED Flash Configuration - PWM driven (flash_led.h). Reading captures light
+// it from the first warm-up frame until the last burst frame is read out.
 const int FLASH_LED_PIN = 4;                     // GPIO4 controls the bright LED
 const bool USE_FLASH_FOR_CAPTURE = true;         // Use flash when capturing
+const uint8_t FLASH_INTENSITY_PERCENT = 60;      // PWM duty; full brightness glares off the LCD cover
+const int FLASH_LEDC_CHANNEL = 2;                // LEDC timer 1; the camera's XCLK has channel/timer 0
+const uint32_t FLASH_PWM_FREQ_HZ = 100000;       // Several periods per sensor line, so no banding
+const int FLASH_PWM_RESOLUTION_BITS = 8;
+const int FLASH_RAMP_STEPS = 8;                  // Duty steps when turning on
+const unsigned long FLASH_RAMP_US = 2000;        // Ramp-up time, limits the LED's inrush
+
+// Capture warm-up - frames are discarded until AEC/AGC settle
+const int WARMUP_MIN_FRAMES = 1;                 // Always drop the frame exposed before the flash
+const int WARMUP_MAX_FRAMES = 8;
+const unsigned long WARMUP_TIMEOUT_MS = 1500;
+const uint32_t WARMUP_SETTLE_PERCENT = 3;        // Max exposure change between frames when settled
+const int WARMUP_FALLBACK_FRAMES = 3;            // Fixed warm-up if the sensor can't report exposure
+
+// Burst capture - after warm-up, reading captures take several frames and
+// keep the sharpest with the least flash glare; the score goes with the upload
+const int BURST_FRAMES = 3;                      // Frames scored per capture; 1 just scores the one
+const int BURST_MAX_GRAY_WIDTH = 400;            // Scoring decode width limit (1/4 of UXGA)
+const size_t BURST_GRAY_SIZE = 400 * 300;        // Scoring grayscale buffer (PSRAM)
+const uint8_t BURST_GLARE_LEVEL = 250;           // Gray level counted as blown out by the flash
+
+// Snapshots - GET /snapshot serves the last reading frame, from whichever
+// capture took it, until it is this old; only then does it expose a new one
+const unsigned long SNAPSHOT_MAX_AGE_MS = 10000;
+
+// Change detection - auto-captures whose LCD region looks like the last
+// uploaded frame are not uploaded; a heartbeat keeps the device visible.
+// Frames are compared as a grid of average brightness cells decoded at 1/8
+// scale from the sensor ROI. Without an ROI every frame is uploaded: in a
+// whole-frame grid a changed digit moves too few cells to be seen.
+const bool CHANGE_DETECTION_ENABLED = true;
+const int CHANGE_GRID_COLS = 32;
+const int CHANGE_GRID_ROWS = 16;
+const int CHANGE_CELL_THRESHOLD = 12;            // Brightness delta (0-255) for a cell to count as changed
+const int CHANGE_MIN_CELLS = 2;                  // Changed cells that make the frame worth uploading
+const unsigned long CHANGE_MAX_SKIP_MS = 3600000;  // Upload at least hourly even if nothing changed
+
+// Edge OCR - seven-segment digits decoded on the device from fixed segment
+// positions. Confident readings are posted as numbers to API_READING_ENDPOINT;
+// the JPEG is only uploaded when confidence is low. The digit layout is in
+// pixels of the uploaded frame (the ROI when it's on) and can be calibrated
+// at runtime via /edge_ocr (stored in NVS).
+const bool EDGE_OCR_ENABLED = false;
+const int EDGE_OCR_MAX_DIGITS = 9;
+const int EDGE_OCR_DIGITS = 8;
+const int EDGE_OCR_DECIMALS = 1;                 // Digits after the decimal point
+const int EDGE_OCR_X = 40;                       // Left edge of the first digit
+const int EDGE_OCR_Y = 40;
+const int EDGE_OCR_DIGIT_WIDTH = 70;
+const int EDGE_OCR_DIGIT_HEIGHT = 160;
+const int EDGE_OCR_PITCH = 90;                   // Distance between digit left edges
+const bool EDGE_OCR_DARK_SEGMENTS = true;        // LCD: segments darker than the background
+const int EDGE_OCR_MIN_CONTRAST = 40;            // Segment/background brightness gap needed at all
+const int EDGE_OCR_MIN_CONFIDENCE = 80;          // 0-100, below this the JPEG is uploaded instead
+const int EDGE_OCR_MAX_GRAY_WIDTH = 400;         // Frames are decoded at the first 1/2^n scale that fits
+const size_t EDGE_OCR_GRAY_SIZE = 400 * 300;     // Grayscale buffer (PSRAM)
+
+// Telemetry - /metrics and the summary header on auto-uploads
+const unsigned long METRICS_SUMMARY_INTERVAL_MS = 300000;  // X-Device-Metrics at most every 5 min
+const size_t METRICS_BUFFER_SIZE = 12288;        // Prometheus text for /metrics (about 8 KB today); families past it are left out
+
+// Tracing (trace.h) - stage spans of captures, uploads, WiFi connects and
+// control requests, kept in a ring and dumped by /trace. A reading slower
+// than TRACE_SLOW_MS from the start of its capture to its delivery sends
+// its time per stage in an X-Slow-Trace header with the next upload.
+const int TRACE_RING_SIZE = 128;                 // Spans kept (a power of two), 24 bytes each
+const unsigned long TRACE_SLOW_MS = 5000;
 
 // Debug Configuration
 const bool SERIAL_DEBUG = true;                  // Enable serial debugging output
@@ -0,0 +1,59 @@
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include <Arduino.h>
+#include <esp_http_server.h>
+#include <ArduinoJson.h>
+
+// One request on the control server, with the WebServer-style calls the
+// handlers use. Only valid during the handler call.
+class HttpRequest {
+public:
+    explicit HttpRequest(httpd_req_t *req);
+
+    // Query string arguments; values are not URL-decoded
+    bool hasArg(const char *name) const;
+    String arg(const char *name) const;
+    int args() const;
+
+    // Request header, empty if absent
+    String header(const char *name) const;
+
+    // Response headers are copied; ones that don't fit HEADER_BYTES are dropped
+    void sendHeader(const char *name, const char *value);
+    void sendHeader(const char *name, const String &value) { sendHeader(name, value.c_str()); }
+    void sendHeader(const char *name, long value);
+    void send(int code, const char *contentType = "text/plain", const char *body = "");
+    void send(int code, const char *contentType, const char *data, size_t len);
+    // Serialized into the request arena, so no buffer size to pick
+    void sendJson(int code, const JsonDocument &doc);
+
+private:
+    static const size_t QUERY_MAX = 192;
+    static const size_t HEADER_BYTES = 256;
+
+    httpd_req_t *req;
+    char query[QUERY_MAX];
+    char headers[HEADER_BYTES];
+    size_t headersUsed;
+};
+
+typedef void (*RouteHandler)(HttpRequest &req);
+
+struct Route {
+    const char *uri;           // Exact path; the query string is not matched
+    RouteHandler handler;
+};
+
+// Start the control server on WEB_SERVER_PORT with the GET routes in
+// `routes`, which must stay valid. It runs its own task pinned to
+// CONTROL_TASK_CORE and multiplexes up to CONTROL_MAX_SOCKETS connections, so
+// an idle keep-alive client or a stuck one (dropped after
+// CONTROL_SOCKET_TIMEOUT_S) doesn't hold up the others. Handlers run one at a
+// time on that task; the request arena is reset after each.
+bool startControlServer(const Route *routes, size_t count);
+
+// Path of route `index` (as recorded in TRACE_HANDLER spans), "" if none
+const char *controlRouteUri(int index);
+
+#endif // CONTROL_SERVER_H
@@ -0,0 +1,28 @@
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include <Arduino.h>
+
+// Kept in RTC memory, so these add up over every cycle since power-on
+struct DutyCycleStats {
+    uint32_t cycles;           // Wakes that ran a capture cycle
+    uint32_t delivered;        // Cycles whose reading reached the backend
+    uint32_t lastAwakeMs;      // Boot until sleep in the previous cycle
+    uint64_t totalAwakeMs;
+    uint64_t totalSleepMs;     // Sleep time requested, not measured
+    float totalMah;            // Estimated charge from DUTY_*_CURRENT_MA
+};
+
+// First thing in setup() with DEEP_SLEEP_ENABLED: releases the pad holds
+// that kept the camera powered down and the flash LED off while asleep, and
+// logs why the chip woke.
+void dutyCycleWake();
+
+// Run one capture cycle, log its awake time and energy estimate, power down
+// the camera and radio and deep sleep until the next capture interval is
+// due. Does not return; the next cycle starts from setup().
+[[noreturn]] void dutyCycleRun();
+
+void getDutyCycleStats(DutyCycleStats &out);
+
+#endif // DUTY_CYCLE_H
@@ -0,0 +1,64 @@
+#ifndef EDGE_OCR_H
+#define EDGE_OCR_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Where the digits are, in pixels of the uploaded frame (the ROI when the
+// sensor window is on, otherwise the full reading frame)
+struct EdgeOcrLayout {
+    bool enabled;
+    uint8_t digits;
+    uint8_t decimals;
+    uint16_t x;                // Left edge of the first digit
+    uint16_t y;
+    uint16_t digitWidth;
+    uint16_t digitHeight;
+    uint16_t pitch;            // Distance between digit left edges
+};
+
+struct EdgeOcrResult {
+    char digits[EDGE_OCR_MAX_DIGITS + 1];  // As read, '?' for an unknown segment pattern
+    double reading;            // kWh, digits with the decimal point applied
+    uint8_t decimals;
+    uint8_t confidence;        // 0-100, the weakest segment decision of all digits
+    uint16_t contrast;         // Segment/background brightness gap
+    uint32_t decodeUs;
+    uint32_t totalUs;
+};
+
+struct EdgeOcrStats {
+    uint32_t attempts;
+    uint32_t confident;        // Readings at or above EDGE_OCR_MIN_CONFIDENCE
+    uint32_t decodeFailures;
+    uint32_t clipped;          // Frames the layout reached outside of
+    uint8_t lastConfidence;
+    char lastDigits[EDGE_OCR_MAX_DIGITS + 1];
+    uint32_t lastUs;
+};
+
+// Call once from setup(). Loads the layout from NVS (or config.h defaults)
+// and, if decoding is enabled, allocates the grayscale buffer in PSRAM.
+bool edgeOcrInit();
+
+bool edgeOcrEnabled();
+
+// Decode the digits of a reading-profile JPEG. The frame is decoded to
+// grayscale at the first 1/2^n scale no wider than EDGE_OCR_MAX_GRAY_WIDTH,
+// then each segment is sampled as a small patch at its fixed position and
+// compared against the unlit centres of the digit. Returns false if the
+// frame can't be decoded; a decoded frame always fills `out`, with
+// confidence 0 if any digit isn't a valid pattern or any patch falls
+// outside the frame. Not thread-safe; meant
+// for the upload task only.
+bool edgeOcrRead(const uint8_t *jpeg, size_t len, EdgeOcrResult &out);
+
+// Validates the layout against EDGE_OCR_MAX_DIGITS and stores it in NVS.
+// Enabling allocates the grayscale buffer, disabling frees it (after any
+// read in progress).
+bool edgeOcrSetLayout(const EdgeOcrLayout &layout);
+void edgeOcrGetLayout(EdgeOcrLayout &out);
+
+void getEdgeOcrStats(EdgeOcrStats &out);
+
+#endif // EDGE_OCR_H
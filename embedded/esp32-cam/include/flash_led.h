@@ -0,0 +1,28 @@
+#ifndef FLASH_LED_H
+#define FLASH_LED_H
+
+#include <Arduino.h>
+
+// The flash LED on FLASH_LED_PIN runs from an LEDC PWM channel instead of a
+// plain GPIO, so its brightness can be lowered (less glare on the LCD cover,
+// less current) and it is ramped up over FLASH_RAMP_US rather than switched
+// on at once, which keeps its inrush from browning out USB-powered boards.
+// Call flashInit() once from setup().
+void flashInit();
+
+// Light the flash at the current intensity, or turn it off
+void flashOn();
+void flashOff();
+bool flashIsOn();
+
+// Brightness used from the next flashOn(), 1-100 percent of full. Starts at
+// FLASH_INTENSITY_PERCENT; not kept across reboots. Values outside 1-100
+// are clamped to it.
+void flashSetIntensity(int percent);
+uint8_t flashIntensity();
+
+// Give the pin back to the GPIO matrix driven low, e.g. before deep sleep
+// holds it
+void flashRelease();
+
+#endif // FLASH_LED_H
@@ -0,0 +1,35 @@
+#ifndef FRAME_CHANGE_H
+#define FRAME_CHANGE_H
+
+#include <Arduino.h>
+
+// Outcome of comparing a frame with the last uploaded one
+struct FrameChange {
+    bool changed;              // Upload it: changed, no reference yet, or undecodable
+    uint16_t changedCells;     // Cells whose brightness moved by CHANGE_CELL_THRESHOLD or more
+    uint8_t maxDelta;          // Largest cell brightness change, after lighting compensation
+    uint32_t decodeUs;
+};
+
+struct FrameChangeStats {
+    uint32_t checked;
+    uint32_t decodeFailures;
+    uint16_t lastChangedCells;
+    uint8_t lastMaxDelta;
+    uint32_t lastDecodeUs;
+};
+
+// Compare a JPEG with the reference (the last frame passed to
+// frameChangeAccept()). The frame is decoded at 1/8 scale, which for a
+// baseline JPEG is little more than its DC coefficients, and reduced to a
+// CHANGE_GRID_COLS x CHANGE_GRID_ROWS brightness grid. An overall brightness
+// shift (flash, ambient light) is subtracted before cells are compared. Not
+// thread-safe; meant for the upload task only.
+bool frameChangeCheck(const uint8_t *jpeg, size_t len, FrameChange &out);
+
+// The frame last checked was uploaded: make it the new reference
+void frameChangeAccept();
+
+void getFrameChangeStats(FrameChangeStats &out);
+
+#endif // FRAME_CHANGE_H
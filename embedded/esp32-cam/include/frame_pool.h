@@ -0,0 +1,52 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <Arduino.h>
+#include <esp_camera.h>
+
+// Captured frames live in a small pool of fixed-size PSRAM slots instead of
+// in camera driver buffers. A driver frame is copied into a slot and handed
+// straight back, so holding a frame (e.g. between /capture and /send_to_api,
+// or while an upload is in flight) never starves the stream of driver
+// buffers. Slots are reference counted and safe to share between tasks.
+struct PooledFrame {
+    uint8_t *buf;
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    pixformat_t format;
+    int64_t capturedUs;        // esp_timer time of the copy
+    uint32_t seq;              // Increments with every frame taken into the pool
+    int16_t score;             // Burst capture score, -1 if not scored
+    int refs;                  // Managed by the pool, don't touch
+};
+
+struct FramePoolStats {
+    int slots;
+    int inUse;
+    int highWater;             // Most slots ever in use at once
+    uint32_t frames;           // Frames taken into the pool
+    uint32_t exhausted;        // Frames dropped because every slot was busy
+    uint32_t oversized;        // Frames larger than FRAME_POOL_SLOT_SIZE
+    uint32_t copyUs;           // Last driver-to-slot copy time
+};
+
+// Allocate FRAME_POOL_SLOTS slots in PSRAM. Call once from setup().
+bool framePoolInit();
+
+// Copy a driver frame into a free slot and return the driver buffer
+// (always, even on failure). The new frame starts with one reference.
+PooledFrame *framePoolTake(camera_fb_t *fb);
+
+void framePoolRetain(PooledFrame *frame);
+void framePoolRelease(PooledFrame *frame);
+
+// Shared frame variables (e.g. "the last captured frame"): replace the frame
+// held in `slot`, releasing the old one, or get a new reference to it.
+// Both are atomic with respect to each other.
+void framePoolExchange(PooledFrame *&slot, PooledFrame *frame);
+PooledFrame *framePoolGet(PooledFrame *&slot);
+
+void getFramePoolStats(FramePoolStats &out);
+
+#endif // FRAME_POOL_H
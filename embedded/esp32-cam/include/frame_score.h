@@ -0,0 +1,23 @@
+#ifndef FRAME_SCORE_H
+#define FRAME_SCORE_H
+
+#include <Arduino.h>
+
+// How readable a frame is likely to be, for picking one out of a burst
+struct FrameScore {
+    int16_t score;             // sharpness scaled down by glarePercent; higher is better
+    uint16_t sharpness;        // Mean |dx| + |dy| of the grayscale frame, x10
+    uint8_t glarePercent;      // Pixels at or above BURST_GLARE_LEVEL
+    bool bySize;               // No decode possible: score is the JPEG size in KB
+    uint32_t decodeUs;         // Decode and scoring time
+};
+
+// Allocate the scoring buffer in PSRAM. Call once from setup(); without it
+// frames are scored by JPEG size, which also grows with sharpness.
+bool frameScoreInit();
+
+// Score a JPEG from its grayscale decode at up to BURST_MAX_GRAY_WIDTH. A
+// frame that fails to decode scores 0.
+void frameScore(const uint8_t *jpeg, size_t len, FrameScore &out);
+
+#endif // FRAME_SCORE_H
@@ -0,0 +1,40 @@
+#ifndef FRAME_SPOOL_H
+#define FRAME_SPOOL_H
+
+#include <Arduino.h>
+
+// Bounded ring of JPEG frames on LittleFS for readings taken while the
+// backend is unreachable. Each record keeps its capture time (or uptime, if
+// the clock isn't set yet) and ROI. Frames wider than SPOOL_MAX_WIDTH are
+// stored as downscaled grayscale, so the spool holds a useful number of
+// them. Frames survive reboots; when the spool is full the oldest frame is
+// dropped. Not thread-safe: the upload task is the only user.
+bool spoolInit();
+
+// Store one frame. `roi` is the "x,y,w,h" ROI description or empty.
+bool spoolStore(const uint8_t *buf, size_t len, const char *roi);
+
+// Send up to SPOOL_BATCH_MAX spooled frames in one multipart request to
+// API_BATCH_ENDPOINT and delete them once the backend accepts the batch,
+// waiting up to SPOOL_REPLY_TIMEOUT_MS for its reply. Returns the number of
+// frames replayed, or -1 if the request failed. A batch refused with a 4xx
+// (other than 408 and 429) is deleted too.
+int spoolReplayBatch();
+
+int spoolPending();
+
+struct SpoolStats {
+    uint32_t pending;
+    uint32_t pendingBytes;
+    uint32_t spooled;          // Frames written since boot
+    uint32_t replayed;         // Frames accepted by the backend since boot
+    uint32_t dropped;          // Oldest frames evicted to make room
+    uint32_t rejected;         // Frames of batches the backend refused
+    uint32_t shrunk;           // Frames stored downscaled
+    uint32_t batches;
+    uint32_t batchFailures;
+};
+
+void getSpoolStats(SpoolStats &out);
+
+#endif // FRAME_SPOOL_H
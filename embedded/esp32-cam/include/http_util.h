@@ -0,0 +1,11 @@
+#ifndef HTTP_UTIL_H
+#define HTTP_UTIL_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Read one CRLF-terminated line into `line`, dropping anything that does not
+// fit. Returns false if the connection closes or the deadline passes first.
+bool readHttpLine(WiFiClient &client, char *line, size_t size, unsigned long deadline);
+
+#endif // HTTP_UTIL_H
@@ -0,0 +1,41 @@
+#ifndef JPEG_UTIL_H
+#define JPEG_UTIL_H
+
+#include <Arduino.h>
+#include <esp_jpg_decode.h>
+
+// The decoder behind esp_jpg_decode() keeps its state in one static work
+// buffer, so only one decode may run at a time on any task. Every decode in
+// the firmware goes through the functions below, which take turns.
+void jpegUtilInit();
+
+// Read the image size from the SOF marker of a JPEG. Only the headers are
+// scanned, so this is cheap enough to run on every frame.
+bool jpegDimensions(const uint8_t *buf, size_t len, uint16_t &width, uint16_t &height);
+
+// Decode a JPEG to 8-bit grayscale at the given scale into `out`, row by
+// row with a stride of `width`. Fails if the scaled image doesn't fit in
+// `outSize` bytes.
+bool jpegDecodeGray(const uint8_t *jpeg, size_t len, jpg_scale_t scale,
+                    uint8_t *out, size_t outSize, uint16_t &width, uint16_t &height);
+
+// A rectangle of a JPEG to keep, in pixels, stored row by row in `out`
+// with a stride of `width`
+struct GrayCrop {
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+    uint8_t *out;
+};
+
+// Decode a JPEG at full scale to 8-bit grayscale, keeping only `crops`.
+// One pass over the image fills all of them. Fails if a crop reaches
+// outside the image.
+bool jpegDecodeGrayCrops(const uint8_t *jpeg, size_t len, GrayCrop *crops, int count);
+
+// Decode a JPEG at the given scale, handing each RGB888 block to `writer`
+// as esp_jpg_decode() does. For callers that reduce blocks as they arrive.
+bool jpegDecode(const uint8_t *jpeg, size_t len, jpg_scale_t scale, jpg_writer_cb writer, void *arg);
+
+#endif // JPEG_UTIL_H
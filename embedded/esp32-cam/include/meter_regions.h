@@ -0,0 +1,65 @@
+#ifndef METER_REGIONS_H
+#define METER_REGIONS_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "frame_pool.h"
+#include "uploader.h"
+
+// Several meters in one camera's view: each named region of the reading
+// frame is cropped out of the same capture and uploaded under its own meter
+// ID, all in one multipart request to API_METERS_ENDPOINT.
+struct MeterRegion {
+    char name[METER_NAME_MAX + 1];   // What it is, e.g. "gas"
+    char meter[METER_ID_MAX + 1];    // Meter ID the backend records its readings under
+    uint16_t x;                      // Pixels of the reading frame
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+};
+
+struct MeterRegionStats {
+    uint32_t encoded;          // Frames cropped into all regions
+    uint32_t failures;         // Frames that couldn't be (outside the frame, crops too large)
+    uint32_t lastBytes;        // All crops of the last frame together
+    uint32_t lastFullBytes;    // Size of the frame they were cut from
+    uint32_t lastUs;           // Decode, crop and encode
+};
+
+// Call once from setup(). Loads the regions from NVS.
+void meterRegionsInit();
+
+int meterRegionCount();
+
+// Copies up to METER_REGIONS_MAX regions into `out`; returns how many
+int getMeterRegions(MeterRegion *out);
+
+// Add a region, or replace the one with the same name. Fails if the name
+// or meter ID is empty or has other characters than letters, digits, '-',
+// '_' and '.', if the region isn't inside a READING_FRAME_SIZE frame, or if
+// it would take the list past METER_REGIONS_MAX or METER_GRAY_SIZE.
+// Stored in NVS.
+bool meterRegionSet(const MeterRegion &region);
+
+// Remove the region with this name; false if there is none
+bool meterRegionRemove(const char *name);
+
+// JSON array describing `regions` as the backend expects them:
+// [{"meter":"...","name":"...","roi":"x,y,w,h"}, ...]
+size_t meterRegionsJson(const MeterRegion *regions, int count, char *buf, size_t size);
+
+// Crop every region out of a reading frame and encode each as grayscale
+// JPEG at METER_JPEG_QUALITY. The frame is decoded once at full scale into
+// PSRAM buffers allocated on first use. Not thread-safe; meant for the
+// upload task.
+bool meterRegionsEncode(const PooledFrame *frame);
+
+// POST the crops of the last meterRegionsEncode() call to
+// API_METERS_ENDPOINT: a "manifest" part (meterRegionsJson()) and one
+// "frames" part per region in the same order. Same results as
+// uploadToBackend().
+int meterRegionsUpload(const char *extraHeaders, UploadResult &result);
+
+void getMeterRegionStats(MeterRegionStats &out);
+
+#endif // METER_REGIONS_H
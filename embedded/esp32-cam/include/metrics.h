@@ -0,0 +1,46 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+// Latency and size distributions, each kept as a fixed-bucket histogram
+enum MetricId {
+    METRIC_CAPTURE_MS = 0,     // Reading capture incl. warm-up (/capture, auto-capture)
+    METRIC_FRAME_BYTES,        // JPEG size of reading captures
+    METRIC_UPLOAD_MS,          // Backend requests (/send_to_api, auto-upload)
+    METRIC_HTTP_MS,            // Control server handler time per request
+    METRIC_COUNT
+};
+
+// Record one observation. Cheap and safe to call from any task.
+void metricObserve(MetricId id, uint32_t value);
+
+// Requests to the handlers that do real work, by endpoint
+enum MetricRequestId {
+    REQUEST_CAPTURE = 0,       // /capture
+    REQUEST_SEND_TO_API,       // /send_to_api
+    REQUEST_STREAM,            // /stream redirects to port 81
+    REQUEST_SNAPSHOT,          // /snapshot
+    REQUEST_COUNT
+};
+
+void metricRequest(MetricRequestId id);
+
+// Render all metrics in Prometheus text format: the histograms above plus
+// heap, PSRAM, RSSI and the stats of the other modules, read at the time of
+// the call. Families that don't fit in METRICS_BUFFER_SIZE are left out
+// whole and counted in wattbox_metrics_dropped_families_total. The text
+// lives in a static buffer until the next call; use from the web server
+// task only.
+const char *metricsRender(size_t &len);
+
+// Format the device summary ("up=...,heap=...,rssi=...") into `buf`.
+// Returns what snprintf() does.
+int metricsSummary(char *buf, size_t size);
+
+// Write an "X-Device-Metrics: ..." upload header line summarising the device
+// if METRICS_SUMMARY_INTERVAL_MS has passed since the last one, otherwise an
+// empty string. Appends to what's already in `buf`.
+void metricsSummaryHeader(char *buf, size_t size);
+
+#endif // METRICS_H
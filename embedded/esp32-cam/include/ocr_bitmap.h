@@ -0,0 +1,29 @@
+#ifndef OCR_BITMAP_H
+#define OCR_BITMAP_H
+
+#include <Arduino.h>
+
+struct OcrBitmapStats {
+    uint32_t encoded;
+    uint32_t failures;
+    uint16_t lastWidth;
+    uint16_t lastHeight;
+    uint8_t lastThreshold;
+    uint32_t lastBytes;
+    uint32_t lastUs;
+};
+
+// Call once from setup() when OCR_UPLOAD_FORMAT is OCR_FORMAT_BITMAP;
+// allocates OCR_BITMAP_BUFFER_SIZE bytes of PSRAM.
+bool ocrBitmapInit();
+
+// Convert a JPEG to a binary PBM (P4) for upload. The frame is decoded to
+// grayscale at the first 1/2^n scale no wider than OCR_BITMAP_MAX_WIDTH,
+// thresholded with Otsu's method (dark pixels become black) and packed to
+// 1 bit per pixel in place. `out` points into the module's buffer and stays
+// valid until the next call. Not thread-safe; meant for the upload task.
+bool ocrBitmapEncode(const uint8_t *jpeg, size_t len, const uint8_t *&out, size_t &outLen);
+
+void getOcrBitmapStats(OcrBitmapStats &out);
+
+#endif // OCR_BITMAP_H
@@ -0,0 +1,70 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <Arduino.h>
+
+// Firmware updates over HTTP. An image is streamed from the backend's
+// API_FIRMWARE_ENDPOINT straight into the inactive app slot of
+// partitions_ota.csv, OTA_CHUNK_SIZE bytes at a time, hashing each chunk as
+// it is written, and booted with a single restart once its SHA-256 matches.
+// The new image is then on trial: it must capture a reading and upload it
+// on its first boot, or the previous image is booted again.
+enum OtaState : uint8_t {
+    OTA_IDLE,
+    OTA_DOWNLOADING,
+    OTA_REBOOTING,             // Verified and set to boot; restarting
+    OTA_FAILED,                // See lastError; the running image is unchanged
+};
+
+enum OtaError : uint8_t {
+    OTA_ERR_NONE,
+    OTA_ERR_CONNECT,           // Backend unreachable
+    OTA_ERR_HTTP,              // Not a 200
+    OTA_ERR_SIZE,              // No Content-Length, or larger than the slot
+    OTA_ERR_NO_HASH,           // Neither the caller nor the backend gave a SHA-256
+    OTA_ERR_BEGIN,             // The slot couldn't be prepared
+    OTA_ERR_READ,              // Connection lost or stalled mid-image
+    OTA_ERR_WRITE,             // Flash write failed, or not an ESP32 app image
+    OTA_ERR_HASH,              // SHA-256 mismatch
+    OTA_ERR_IMAGE,             // Image failed the bootloader's own checks
+    OTA_ERR_BOOT,              // Couldn't be set as the boot partition
+};
+
+struct OtaStats {
+    OtaState state;
+    OtaError lastError;
+    uint32_t received;         // Bytes of the image in progress (or the last one)
+    uint32_t imageSize;
+    uint32_t lastUs;           // Request to verified image, last successful download
+    uint32_t updates;          // Successful downloads since boot
+    uint32_t failures;
+    char running[17];          // Label of the app partition running now
+    bool trial;                // Running image not confirmed yet
+    uint8_t trialBoots;        // Boots of it so far
+};
+
+// First thing in setup(). If the running image is on trial, counts the
+// boot, rolls back once it has been booted OTA_TRIAL_BOOTS times without
+// passing otaHealthCheck(), and arms a rollback after OTA_HEALTH_TIMEOUT_MS
+// in case setup() hangs.
+void otaBootCheck();
+
+// Call once WiFi and the uploader are up, before the servers start. On a
+// trial boot: capture a reading and upload it, up to OTA_HEALTH_ATTEMPTS
+// times. Success confirms the image; failure boots the previous one. Does
+// nothing otherwise.
+void otaHealthCheck();
+
+// Start fetching API_FIRMWARE_ENDPOINT/<image> on a task of its own. The
+// image name may only have letters, digits, '-', '_' and '.'. `sha256Hex`
+// (64 hex digits) overrides the backend's X-Firmware-SHA256 header and may
+// be NULL. False if an update is already running, the arguments are
+// invalid, or the image is on trial.
+bool otaStart(const char *image, const char *sha256Hex);
+
+const char *otaStateName(OtaState state);
+const char *otaErrorName(OtaError error);
+
+void getOtaStats(OtaStats &out);
+
+#endif // OTA_UPDATE_H
@@ -0,0 +1,32 @@
+#ifndef REQUEST_ARENA_H
+#define REQUEST_ARENA_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Bump allocator in PSRAM for building control server responses. Handlers
+// pass it to their JsonDocument and the serialized text goes in it too; the
+// control server resets it in one go after each request, so responses never
+// allocate from (and fragment) the internal heap the WiFi stack lives on.
+// Only the control server task may use it. Requests that need more than
+// REQUEST_ARENA_SIZE fall back to the heap for the rest.
+struct RequestArenaStats {
+    size_t size;
+    size_t lastUsed;           // Bytes the last request took
+    size_t highWater;          // Most any request took
+    uint32_t requests;
+    uint32_t overflows;        // Allocations that went to the heap instead
+};
+
+// Allocate the arena in PSRAM. Call once before the control server starts.
+bool requestArenaInit();
+
+// Allocator for JsonDocument; works on the heap until requestArenaInit()
+ArduinoJson::Allocator *requestArena();
+
+// Drop everything allocated since the last reset
+void requestArenaReset();
+
+void getRequestArenaStats(RequestArenaStats &out);
+
+#endif // REQUEST_ARENA_H
@@ -0,0 +1,32 @@
+#ifndef STREAM_SERVER_H
+#define STREAM_SERVER_H
+
+#include <Arduino.h>
+
+// Start the MJPEG listener on STREAM_SERVER_PORT. Viewers are served from a
+// dedicated task pinned to STREAM_TASK_CORE, so streaming never blocks the
+// control server. Every connected viewer gets the same frame.
+bool startStreamServer();
+
+// Pacing statistics, maintained by the stream task. Frames are paced to
+// STREAM_TARGET_FPS; a viewer whose socket is still full from the previous
+// frame skips the current one, which is counted in framesDropped. Frames are
+// written without blocking, and a viewer that can't take one within
+// STREAM_SEND_TIMEOUT_MS is disconnected (slowViewers) so it can't hold up
+// the others.
+struct StreamStats {
+    int viewers;
+    float achievedFps;         // Frames captured per second over the last second
+    uint32_t framesSent;       // Frame deliveries, summed over viewers
+    uint32_t framesDropped;    // Frames skipped for backed-up viewers
+    uint32_t slowViewers;      // Viewers dropped mid-frame for STREAM_SEND_TIMEOUT_MS
+    uint32_t captureUs;        // Smoothed esp_camera_fb_get() time
+    uint32_t sendUs;           // Smoothed time to write a frame to all viewers
+};
+
+void getStreamStats(StreamStats &out);
+
+// Number of viewers currently attached to the stream.
+int streamClientCount();
+
+#endif // STREAM_SERVER_H
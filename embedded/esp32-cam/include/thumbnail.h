@@ -0,0 +1,57 @@
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include <Arduino.h>
+#include "frame_pool.h"
+
+// Two-tier upload: while the backend channel is up, auto-captures go to the
+// backend as a small grayscale JPEG, and the full frame stays in its pool
+// slot for THUMBNAIL_KEEP_MS in case OCR on the thumbnail isn't confident.
+// The backend then fetches it by the frame's sequence number, over the
+// backend channel or GET /frame?seq=.
+struct ThumbnailStats {
+    uint32_t encoded;
+    uint32_t failures;
+    uint16_t lastWidth;
+    uint16_t lastHeight;
+    uint32_t lastBytes;
+    uint32_t lastFullBytes;    // Size of the frame the last thumbnail stood in for
+    uint32_t lastUs;
+    uint32_t kept;             // Full frames currently held
+    uint32_t fetched;          // Full frames handed out on request
+    uint32_t misses;           // Requests for a frame no longer (or never) held
+};
+
+// Call once from setup() when THUMBNAIL_UPLOAD_ENABLED; allocates the
+// grayscale and output buffers in PSRAM.
+bool thumbnailInit();
+
+// Scale a reading frame down to no wider than THUMBNAIL_MAX_WIDTH (1/2^n,
+// as decoded) and re-encode it as grayscale JPEG at THUMBNAIL_JPEG_QUALITY.
+// `out` points into the module's buffer and stays valid until the next
+// call. Not thread-safe; meant for the upload task.
+bool thumbnailEncode(const PooledFrame *frame, const uint8_t *&out, size_t &outLen);
+
+// Hold a reference to the full frame for THUMBNAIL_KEEP_MS, replacing the
+// oldest one held once THUMBNAIL_KEEP_FRAMES are.
+void thumbnailKeepFull(PooledFrame *frame);
+
+// Let go of the held full frame with sequence number `seq` early, for a
+// thumbnail upload that failed. Does nothing if it isn't held.
+void thumbnailDropFull(uint32_t seq);
+
+// A new reference to the held full frame with sequence number `seq`, or
+// NULL if it has expired. Safe to call from any task.
+PooledFrame *thumbnailFullFrame(uint32_t seq);
+
+// Let go of frames held longer than THUMBNAIL_KEEP_MS; also done on every
+// keep and lookup.
+void thumbnailExpire();
+
+// Append "X-Frame-Seq: ..." and "X-Full-Size: ..." upload header lines
+// announcing a thumbnail of `frame`.
+void thumbnailHeaders(const PooledFrame *frame, char *buf, size_t size);
+
+void getThumbnailStats(ThumbnailStats &out);
+
+#endif // THUMBNAIL_H
@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// Where a reading spends its time: spans recorded at the boundaries of the
+// capture, delivery, upload and WiFi stages go into a fixed ring of the last
+// TRACE_RING_SIZE spans, dumped by /trace. Recording is a few stores with
+// one atomic increment and no lock, so spans are always on. Durations come
+// from the cycle counter, which is per core: a span must end on the task
+// that began it.
+enum TraceStage : uint8_t {
+    TRACE_CAPTURE,             // captureReading(), value = frame seq (-1 failed)
+    TRACE_CAMERA_WAIT,         // Waiting for the camera (e.g. the stream holding it)
+    TRACE_WARMUP,              // value = frames discarded
+    TRACE_BURST,               // value = frames scored
+    TRACE_CHANGE,              // Change detection, value = 1 if changed
+    TRACE_EDGE_OCR,            // value = confidence
+    TRACE_ENCODE,              // Thumbnail, meter crops or bitmap, value = bytes
+    TRACE_UPLOAD,              // A whole backend request, value = status or UPLOAD_ERR_*
+    TRACE_CONNECT,             // TCP connect (and DNS), value = 1 if connected
+    TRACE_SEND,                // Request head and body, value = bytes
+    TRACE_REPLY,               // Until the reply is read, value = status
+    TRACE_SPOOL,               // Storing a frame in flash, value = bytes
+    TRACE_WIFI,                // Association until the link is up, value = 1 on the cached network
+    TRACE_HANDLER,             // A control server request, value = route index
+    TRACE_STAGE_COUNT
+};
+
+struct TraceEvent {
+    int64_t startUs;           // esp_timer time
+    uint32_t durationUs;
+    int32_t value;
+    TraceStage stage;
+    uint8_t core;
+};
+
+// Start of a span, on the caller's stack
+struct TraceSpan {
+    int64_t startUs;
+    uint32_t startCycles;
+};
+
+inline TraceSpan traceBegin() {
+    return {esp_timer_get_time(), ESP.getCycleCount()};
+}
+
+void traceEnd(const TraceSpan &span, TraceStage stage, int32_t value = 0);
+
+// A span that wasn't timed with traceBegin(), e.g. one that runs across
+// several loop() calls
+void traceRecord(TraceStage stage, int64_t startUs, uint32_t durationUs, int32_t value = 0);
+
+const char *traceStageName(TraceStage stage);
+
+// Copy the spans still in the ring, oldest first; returns how many. Spans
+// being written while this runs are skipped.
+int traceSnapshot(TraceEvent *out, int max);
+
+// Call once a frame has been delivered (or given up on). If it took longer
+// than TRACE_SLOW_MS from the start of its capture, the time per stage
+// since then is kept for traceHeaders().
+void traceReadingDone(uint32_t seq);
+
+// Append an "X-Slow-Trace: total=...,warmup=...,..." upload header line
+// (milliseconds) for the last slow reading, once.
+void traceHeaders(char *buf, size_t size);
+
+#endif // TRACE_H
@@ -0,0 +1,76 @@
+#ifndef UPLOADER_H
+#define UPLOADER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "config.h"
+
+// Error codes mirror HTTPClient's HTTPC_ERROR_* values so the "code" field
+// reported by /send_to_api keeps its meaning.
+const int UPLOAD_ERR_CONNECT = -1;
+const int UPLOAD_ERR_SEND_HEADER = -2;
+const int UPLOAD_ERR_SEND_PAYLOAD = -3;
+const int UPLOAD_ERR_CONNECTION_LOST = -5;
+const int UPLOAD_ERR_NO_HTTP_SERVER = -7;
+const int UPLOAD_ERR_READ_TIMEOUT = -11;
+
+// Result of one upload. statusCode is the HTTP status returned by the
+// backend (> 0) or one of the UPLOAD_ERR_* codes (< 0).
+struct UploadResult {
+    int statusCode;
+    size_t bytesSent;
+    bool reusedConnection;                   // Sent on an already open connection
+    uint32_t latencyUs;                      // Whole request, including any reconnect
+    bool responseTruncated;
+    size_t responseLen;
+    uint32_t captureIntervalMs;              // From an X-Capture-Interval reply header, 0 if none
+    char response[UPLOAD_RESPONSE_MAX + 1];  // NUL-terminated head of the reply body
+};
+
+struct UploadStats {
+    uint32_t requests;
+    uint32_t failures;         // Requests that got no HTTP status
+    uint32_t connects;         // TCP connections opened
+    uint32_t reused;           // Requests sent on an open connection
+    uint32_t staleRetries;     // Reused connections found closed by the server
+    uint32_t lastLatencyUs;
+    uint32_t avgLatencyUs;     // Smoothed request latency
+    bool connected;
+};
+
+// Call once from setup() before the first upload.
+void uploaderInit();
+
+// POST a buffer to API_ENDPOINT on the backend. The body is written to the
+// socket in UPLOAD_CHUNK_SIZE pieces directly from `body` (e.g. the PSRAM
+// frame buffer), and only the first UPLOAD_RESPONSE_MAX bytes of the reply
+// are kept, so no heap copy of either side is made. The connection is kept
+// alive and reused by the next call; a connection the server has closed is
+// reopened transparently. Safe to call from several tasks. `extraHeaders` holds
+// optional preformatted "Name: value\r\n" lines and may be NULL.
+int uploadToBackend(const uint8_t *body, size_t len, const char *contentType,
+                    const char *extraHeaders, UploadResult &result);
+
+// Same as uploadToBackend() for a path other than API_ENDPOINT
+int postToBackend(const char *path, const uint8_t *body, size_t len, const char *contentType,
+                  const char *extraHeaders, UploadResult &result);
+
+// Writes a request body of exactly the announced length to the socket,
+// adding the bytes written to `sent`. Returns false if the socket fails.
+typedef bool (*UploadBodyWriter)(WiFiClient &client, void *ctx, size_t &sent);
+
+// Same as uploadToBackend(), for bodies that are produced while sending
+// (e.g. read from flash) and for paths other than API_ENDPOINT. Requests the
+// backend takes long to answer can wait longer than UPLOAD_TIMEOUT_MS for
+// the reply.
+int uploadStreamToBackend(const char *path, const char *contentType, size_t len,
+                          UploadBodyWriter writeBody, void *ctx,
+                          const char *extraHeaders, UploadResult &result,
+                          unsigned long replyTimeoutMs = UPLOAD_TIMEOUT_MS);
+
+// Helper for body writers: send `buf` in UPLOAD_CHUNK_SIZE pieces.
+bool uploadWriteAll(WiFiClient &client, const uint8_t *buf, size_t len, size_t &sent);
+
+void getUploadStats(UploadStats &out);
+
+#endif // UPLOADER_H
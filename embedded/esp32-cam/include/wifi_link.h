@@ -0,0 +1,40 @@
+#ifndef WIFI_LINK_H
+#define WIFI_LINK_H
+
+#include <Arduino.h>
+
+struct WifiLinkStats {
+    bool fastPath;             // Last connect used the cached BSSID/channel
+    uint32_t fastPathFailures; // Cached attempts that fell back to a full scan
+    uint32_t connects;
+    uint32_t lastConnectMs;    // Start of the successful attempt until connected
+    uint32_t disconnects;      // Links lost after being up
+    uint8_t lastDisconnectReason;  // wifi_err_reason_t of the last lost link
+    uint32_t backoffMs;        // Current wait before the next attempt, 0 while up
+};
+
+// Start associating without waiting. With FASTBOOT_ENABLED and a cached
+// network, connects straight to the cached BSSID on its channel (and with the
+// cached lease as a static IP when FASTBOOT_REUSE_IP), so the radio can come
+// up while setup() initialises the camera.
+void wifiBegin();
+
+// Advance the connection without blocking; call from loop(). A cached
+// attempt that hasn't connected after FASTBOOT_WIFI_TIMEOUT_MS is replaced by
+// a normal scan and DHCP. An attempt that fails for WIFI_CONNECT_TIMEOUT_MS
+// is retried after a backoff doubling from WIFI_RECONNECT_MIN_MS to
+// WIFI_RECONNECT_MAX_MS. A lost link (WiFi disconnect event) is retried
+// straight away. On success the network parameters are cached for the next
+// boot.
+void wifiService();
+
+// True while associated with an IP
+bool wifiConnected();
+
+// Run wifiService() until the attempt started by wifiBegin() connects, fails
+// or `timeoutMs` passes, for setup(). Returns true if connected.
+bool wifiWaitConnected(unsigned long timeoutMs);
+
+void getWifiLinkStats(WifiLinkStats &out);
+
+#endif // WIFI_LINK_H
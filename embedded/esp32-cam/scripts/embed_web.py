@@ -0,0 +1,57 @@
+"""
+Pre-build step: gzip web/index.html into include/index_html_gz.h so the
+firmware can serve the UI straight from flash with Content-Encoding: gzip.
+
+Runs from PlatformIO (extra_scripts) or standalone: python scripts/embed_web.py
+"""
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+    PROJECT_DIR = env["PROJECT_DIR"]  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE = os.path.join(PROJECT_DIR, "web", "index.html")
+TARGET = os.path.join(PROJECT_DIR, "include", "index_html_gz.h")
+
+
+def embed():
+    with open(SOURCE, "rb") as f:
+        html = f.read()
+
+    # mtime=0 keeps the output, and so the ETag, stable between builds
+    compressed = gzip.compress(html, compresslevel=9, mtime=0)
+    etag = hashlib.sha1(html).hexdigest()[:16]
+
+    lines = [
+        "// Generated by scripts/embed_web.py from web/index.html - do not edit",
+        "#ifndef INDEX_HTML_GZ_H",
+        "#define INDEX_HTML_GZ_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        f'#define INDEX_HTML_ETAG "\\"{etag}\\""',
+        "",
+        f"// {len(html)} bytes uncompressed",
+        "const uint8_t index_html_gz[] PROGMEM = {",
+    ]
+    for i in range(0, len(compressed), 16):
+        chunk = compressed[i:i + 16]
+        lines.append("    " + ", ".join(f"0x{b:02x}" for b in chunk) + ",")
+    lines += ["};", "", "#endif // INDEX_HTML_GZ_H", ""]
+    content = "\n".join(lines)
+
+    # Only touch the header when it changes, so it doesn't force a rebuild
+    if os.path.exists(TARGET):
+        with open(TARGET) as f:
+            if f.read() == content:
+                return
+    with open(TARGET, "w") as f:
+        f.write(content)
+    print(f"embed_web: {len(html)} -> {len(compressed)} bytes, ETag {etag}")
+
+
+embed()
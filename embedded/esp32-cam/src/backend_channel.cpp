@@ -0,0 +1,488 @@
+#include "backend_channel.h"
+#include <WiFi.h>
+#include "config.h"
+#include "http_util.h"
+#include "wifi_link.h"
+#include "camera_capture.h"
+#include "camera_profiles.h"
+#include "capture_pipeline.h"
+#include "thumbnail.h"
+#include "metrics.h"
+
+// WebSocket opcodes (RFC 6455)
+static const uint8_t WS_BINARY = 0x2;
+static const uint8_t WS_CLOSE = 0x8;
+static const uint8_t WS_PING = 0x9;
+static const uint8_t WS_PONG = 0xA;
+
+// Channel message types, mirrored in backend/api/device_channel.py. Each
+// message is the type byte and a little-endian u32 id, then the payload.
+static const uint8_t MSG_METRICS = 0x01;   // Summary text (metricsSummary)
+static const uint8_t MSG_FRAME = 0x02;     // i16 score, u8 ROI length, ROI text, JPEG
+static const uint8_t MSG_ACK = 0x03;
+static const uint8_t MSG_ERROR = 0x04;     // Reason text
+static const uint8_t CMD_CAPTURE = 0x81;
+static const uint8_t CMD_INTERVAL = 0x82;  // u32 seconds
+static const uint8_t CMD_ROI = 0x83;       // u16 x, y, w, h; w = 0 turns it off
+static const uint8_t MSG_RESULT = 0x84;    // OCR result JSON
+static const uint8_t CMD_FULL_FRAME = 0x85;  // u32 frame sequence number
+static const size_t MESSAGE_HEADER_SIZE = 5;
+
+// Only the channel task touches the connection and these buffers
+static WiFiClient channel;
+static ChannelStats stats;
+static uint8_t rx[CHANNEL_MESSAGE_MAX];
+static uint8_t tx[CHANNEL_WRITE_CHUNK];    // Masked copy of the payload being sent
+static unsigned long lastRxMs = 0;
+static unsigned long lastPingMs = 0;
+static unsigned long lastMetricsMs = 0;
+
+static void putU32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t getU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t getU16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+// Sec-WebSocket-Key: base64 of 16 random bytes, 24 characters
+static void makeKey(char *out) {
+    static const char ALPHABET[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t nonce[18] = {0};
+    for (int i = 0; i < 16; i += 4) {
+        uint32_t r = esp_random();
+        memcpy(nonce + i, &r, 4);
+    }
+    for (int i = 0; i < 6; i++) {
+        uint32_t v = (nonce[i * 3] << 16) | (nonce[i * 3 + 1] << 8) | nonce[i * 3 + 2];
+        for (int j = 0; j < 4; j++) {
+            out[i * 4 + j] = ALPHABET[(v >> (18 - 6 * j)) & 0x3F];
+        }
+    }
+    out[22] = out[23] = '=';
+    out[24] = '\0';
+}
+
+// Open the connection and ask for the upgrade. The accept hash isn't
+// checked: a 101 with "Upgrade: websocket" already means the backend
+// speaks WebSocket, which is all the key is there to prove.
+static bool connectChannel() {
+    if (!channel.connect(API_HOST, API_PORT, UPLOAD_TIMEOUT_MS)) {
+        return false;
+    }
+    channel.setNoDelay(true);
+
+    char key[25];
+    makeKey(key);
+    char head[384];
+    int len = snprintf(head, sizeof(head),
+        "GET %s HTTP/1.1\r\n"
+        "Host: %s:%d\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: %s\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "X-Device-ID: %s\r\n"
+        "X-Device-Name: %s\r\n"
+        "\r\n",
+        API_CHANNEL_ENDPOINT, API_HOST, API_PORT, key, DEVICE_ID, DEVICE_NAME);
+    if (len <= 0 || (size_t)len >= sizeof(head) ||
+        channel.write((const uint8_t *)head, len) != (size_t)len) {
+        channel.stop();
+        return false;
+    }
+
+    unsigned long deadline = millis() + UPLOAD_TIMEOUT_MS;
+    char line[128];
+    int statusCode = 0;
+    if (!readHttpLine(channel, line, sizeof(line), deadline) ||
+        sscanf(line, "HTTP/1.%*d %d", &statusCode) != 1 || statusCode != 101) {
+        Serial.printf("Backend channel refused: %s\n", line);
+        channel.stop();
+        return false;
+    }
+    bool upgraded = false;
+    bool headersDone = false;
+    while (readHttpLine(channel, line, sizeof(line), deadline)) {
+        if (line[0] == '\0') {
+            headersDone = true;
+            break;
+        }
+        if (strncasecmp(line, "Upgrade:", 8) == 0 && strcasestr(line + 8, "websocket")) {
+            upgraded = true;
+        }
+    }
+    if (!headersDone || !upgraded) {
+        channel.stop();
+        return false;
+    }
+    return true;
+}
+
+// Client frames must be masked; the payload is XORed chunk by chunk into
+// `tx` so a frame buffer is sent without a copy of its own
+static bool writeMasked(const uint8_t *data, size_t len, const uint8_t *mask, size_t &offset) {
+    while (len > 0) {
+        size_t n = min(len, sizeof(tx));
+        for (size_t i = 0; i < n; i++) {
+            tx[i] = data[i] ^ mask[(offset + i) & 3];
+        }
+        if (channel.write(tx, n) != n) {
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Send one WebSocket frame whose payload is `head` followed by `body`
+static bool wsSend(uint8_t opcode, const uint8_t *head, size_t headLen,
+                   const uint8_t *body, size_t bodyLen) {
+    uint64_t len = (uint64_t)headLen + bodyLen;
+    uint8_t frame[14];
+    size_t n = 0;
+    frame[n++] = 0x80 | opcode;  // FIN, never fragmented
+    if (len < 126) {
+        frame[n++] = 0x80 | len;
+    } else if (len <= 0xFFFF) {
+        frame[n++] = 0x80 | 126;
+        frame[n++] = len >> 8;
+        frame[n++] = len;
+    } else {
+        frame[n++] = 0x80 | 127;
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame[n++] = len >> shift;
+        }
+    }
+    uint32_t key = esp_random();
+    uint8_t *mask = frame + n;
+    memcpy(mask, &key, 4);
+    n += 4;
+    if (channel.write(frame, n) != n) {
+        return false;
+    }
+    size_t offset = 0;
+    return writeMasked(head, headLen, mask, offset) && writeMasked(body, bodyLen, mask, offset);
+}
+
+// Send a channel message: header and `payload`, then an optional `body`
+static bool sendMessage(uint8_t type, uint32_t id, const uint8_t *payload, size_t payloadLen,
+                        const uint8_t *body = NULL, size_t bodyLen = 0) {
+    uint8_t head[MESSAGE_HEADER_SIZE + 32];
+    if (payloadLen > sizeof(head) - MESSAGE_HEADER_SIZE) {
+        return false;
+    }
+    head[0] = type;
+    putU32(head + 1, id);
+    memcpy(head + MESSAGE_HEADER_SIZE, payload, payloadLen);
+    return wsSend(WS_BINARY, head, MESSAGE_HEADER_SIZE + payloadLen, body, bodyLen);
+}
+
+static bool sendText(uint8_t type, uint32_t id, const char *text) {
+    return sendMessage(type, id, NULL, 0, (const uint8_t *)text, strlen(text));
+}
+
+static bool sendMetrics() {
+    lastMetricsMs = millis();
+    char summary[160];
+    int len = metricsSummary(summary, sizeof(summary));
+    if (len <= 0 || (size_t)len >= sizeof(summary)) {
+        return true;
+    }
+    if (!sendText(MSG_METRICS, 0, summary)) {
+        return false;
+    }
+    stats.metricsSent++;
+    return true;
+}
+
+// Push a frame with its score and the ROI it was taken with; releases it
+static bool sendFrame(uint32_t id, PooledFrame *frame) {
+    CameraRoi roi;
+    cameraGetRoi(roi);
+    uint8_t meta[3 + 24];
+    int roiLen = 0;
+    if (roi.enabled) {
+        roiLen = snprintf((char *)meta + 3, sizeof(meta) - 3, "%u,%u,%u,%u", roi.x, roi.y,
+                          roi.width, roi.height);
+    }
+    meta[0] = (uint16_t)frame->score;
+    meta[1] = (uint16_t)frame->score >> 8;
+    meta[2] = roiLen;
+
+    bool sent = sendMessage(MSG_FRAME, id, meta, 3 + roiLen, frame->buf, frame->len);
+    framePoolRelease(frame);
+    if (sent) {
+        stats.framesSent++;
+    }
+    return sent;
+}
+
+// Take a reading for the backend and push it on the channel
+static bool sendCapture(uint32_t id) {
+    unsigned long start = millis();
+    CaptureInfo info;
+    PooledFrame *frame = captureReading(info);
+    if (!frame) {
+        return sendText(MSG_ERROR, id, "capture failed");
+    }
+    size_t len = frame->len;
+    if (!sendFrame(id, frame)) {
+        return false;
+    }
+    stats.lastCaptureMs = millis() - start;
+    Serial.printf("Channel capture %u: %u bytes in %u ms\n", (unsigned)id, (unsigned)len,
+                  (unsigned)stats.lastCaptureMs);
+    return true;
+}
+
+// The full frame behind a thumbnail upload, while it is still kept
+static bool sendFullFrame(uint32_t id, uint32_t seq) {
+    PooledFrame *frame = thumbnailFullFrame(seq);
+    if (!frame) {
+        return sendText(MSG_ERROR, id, "frame expired");
+    }
+    Serial.printf("Channel full frame %u: %u bytes\n", (unsigned)seq, (unsigned)frame->len);
+    return sendFrame(id, frame);
+}
+
+static bool applyRoi(uint32_t id, const uint8_t *payload) {
+    CameraRoi roi;
+    cameraGetRoi(roi);
+    roi.enabled = getU16(payload + 4) != 0;
+    if (roi.enabled) {
+        roi.x = getU16(payload);
+        roi.y = getU16(payload + 2);
+        roi.width = getU16(payload + 4);
+        roi.height = getU16(payload + 6);
+    }
+    if (!cameraSetRoi(roi)) {
+        return sendText(MSG_ERROR, id, "invalid ROI");
+    }
+    return sendMessage(MSG_ACK, id, NULL, 0);
+}
+
+// An interval command outside the CAPTURE_INTERVAL bounds is rejected. Updates
+// following a frame's result (id 0) aren't acknowledged, so they are clamped
+// like X-Capture-Interval instead.
+static bool applyInterval(uint32_t id, uint32_t seconds) {
+    // Bounds-check in seconds; multiplying first could wrap past 32 bits
+    uint32_t minSeconds = CAPTURE_INTERVAL_MIN_MS / 1000, maxSeconds = CAPTURE_INTERVAL_MAX_MS / 1000;
+    if (id != 0 && (seconds < minSeconds || seconds > maxSeconds)) {
+        return sendText(MSG_ERROR, id, "interval out of range");
+    }
+    setCaptureInterval(min(max(seconds, minSeconds), maxSeconds) * 1000);
+    return id == 0 || sendMessage(MSG_ACK, id, NULL, 0);
+}
+
+// Act on one message from the backend. Returns false if replying failed.
+static bool handleMessage(const uint8_t *msg, size_t len) {
+    if (len < MESSAGE_HEADER_SIZE) {
+        return true;
+    }
+    uint8_t type = msg[0];
+    uint32_t id = getU32(msg + 1);
+    const uint8_t *payload = msg + MESSAGE_HEADER_SIZE;
+    size_t payloadLen = len - MESSAGE_HEADER_SIZE;
+
+    switch (type) {
+    case CMD_CAPTURE:
+        stats.commands++;
+        return sendCapture(id);
+    case CMD_INTERVAL:
+        stats.commands++;
+        if (payloadLen < 4) {
+            return sendText(MSG_ERROR, id, "bad interval");
+        }
+        return applyInterval(id, getU32(payload));
+    case CMD_ROI:
+        stats.commands++;
+        if (payloadLen < 8) {
+            return sendText(MSG_ERROR, id, "bad ROI");
+        }
+        return applyRoi(id, payload);
+    case CMD_FULL_FRAME:
+        stats.commands++;
+        if (payloadLen < 4) {
+            return sendText(MSG_ERROR, id, "bad sequence number");
+        }
+        return sendFullFrame(id, getU32(payload));
+    case MSG_RESULT:
+        Serial.printf("Channel result %u: %.*s\n", (unsigned)id, (int)payloadLen,
+                      (const char *)payload);
+        return true;
+    default:
+        return id == 0 || sendText(MSG_ERROR, id, "unknown command");
+    }
+}
+
+// Read exactly `len` bytes unless the connection drops or stalls
+static bool readExact(uint8_t *buf, size_t len, unsigned long deadline) {
+    while (len > 0) {
+        int avail = channel.available();
+        if (avail <= 0) {
+            if (!channel.connected() || millis() > deadline) {
+                return false;
+            }
+            delay(1);
+            continue;
+        }
+        int n = channel.read(buf, min((size_t)avail, len));
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Handle one WebSocket frame from the backend if one has arrived. Messages
+// larger than CHANNEL_MESSAGE_MAX are read and dropped. Returns false when
+// the connection has to be closed.
+static bool pollChannel() {
+    if (channel.available() < 2) {
+        return channel.connected();
+    }
+    unsigned long deadline = millis() + UPLOAD_TIMEOUT_MS;
+    uint8_t frame[2];
+    if (!readExact(frame, 2, deadline)) {
+        return false;
+    }
+    bool fin = frame[0] & 0x80;
+    uint8_t opcode = frame[0] & 0x0F;
+    uint64_t len = frame[1] & 0x7F;
+    if (len >= 126) {
+        uint8_t ext[8];
+        size_t extLen = len == 126 ? 2 : 8;
+        if (!readExact(ext, extLen, deadline)) {
+            return false;
+        }
+        len = 0;
+        for (size_t i = 0; i < extLen; i++) {
+            len = (len << 8) | ext[i];
+        }
+    }
+    // Servers don't mask, but handle it anyway
+    uint8_t mask[4] = {0};
+    bool masked = frame[1] & 0x80;
+    if (masked && !readExact(mask, 4, deadline)) {
+        return false;
+    }
+
+    size_t kept = len < sizeof(rx) ? len : sizeof(rx);
+    if (!readExact(rx, kept, deadline)) {
+        return false;
+    }
+    for (size_t i = 0; masked && i < kept; i++) {
+        rx[i] ^= mask[i & 3];
+    }
+    for (uint64_t rest = len - kept; rest > 0;) {
+        uint8_t scratch[64];
+        size_t n = rest < sizeof(scratch) ? rest : sizeof(scratch);
+        if (!readExact(scratch, n, deadline)) {
+            return false;
+        }
+        rest -= n;
+    }
+    lastRxMs = millis();
+
+    switch (opcode) {
+    case WS_PING:
+        return wsSend(WS_PONG, rx, kept, NULL, 0);
+    case WS_CLOSE:
+        wsSend(WS_CLOSE, rx, min(kept, (size_t)2), NULL, 0);
+        return false;
+    case WS_BINARY:
+        if (!fin || kept < len) {
+            Serial.printf("Channel message of %u bytes dropped\n", (unsigned)len);
+            return true;
+        }
+        return handleMessage(rx, kept);
+    default:
+        return true;  // Pongs, text and continuations
+    }
+}
+
+static void channelTask(void *) {
+    unsigned long lastAttemptMs = 0;
+    uint32_t backoffMs = 0;
+    for (;;) {
+        if (!stats.connected) {
+            if (!wifiConnected() || millis() - lastAttemptMs < backoffMs) {
+                vTaskDelay(pdMS_TO_TICKS(CHANNEL_POLL_MS));
+                continue;
+            }
+            lastAttemptMs = millis();
+            if (!connectChannel()) {
+                stats.failures++;
+                backoffMs = backoffMs ? min(backoffMs * 2, (uint32_t)CHANNEL_RECONNECT_MAX_MS)
+                                      : CHANNEL_RECONNECT_MIN_MS;
+                stats.backoffMs = backoffMs;
+                continue;
+            }
+            Serial.println("Backend channel connected");
+            stats.connected = true;
+            stats.connects++;
+            stats.backoffMs = 0;
+            backoffMs = 0;
+            lastRxMs = lastPingMs = millis();
+            if (!sendMetrics()) {
+                stats.connected = false;
+            }
+        }
+
+        bool up = stats.connected && pollChannel();
+        unsigned long now = millis();
+        if (up && now - lastMetricsMs >= CHANNEL_METRICS_MS) {
+            up = sendMetrics();
+        }
+        // Keep NATs and the backend's idle timeout from closing a quiet
+        // connection, and notice one that died without a FIN
+        if (up && now - lastRxMs >= CHANNEL_PING_MS && now - lastPingMs >= CHANNEL_PING_MS) {
+            lastPingMs = now;
+            up = wsSend(WS_PING, NULL, 0, NULL, 0);
+        }
+        if (up && now - lastRxMs >= 2 * CHANNEL_PING_MS) {
+            Serial.println("Backend channel not answering");
+            up = false;
+        }
+        if (!up) {
+            if (stats.connected) {
+                Serial.println("Backend channel lost");
+                stats.disconnects++;
+            }
+            channel.stop();
+            stats.connected = false;
+            // Retry after the shortest backoff; the server may just have restarted
+            lastAttemptMs = millis();
+            backoffMs = CHANNEL_RECONNECT_MIN_MS;
+            stats.backoffMs = backoffMs;
+            continue;
+        }
+        vTaskDelay(pdMS_TO_TICKS(CHANNEL_POLL_MS));
+    }
+}
+
+bool startBackendChannel() {
+    if (xTaskCreatePinnedToCore(channelTask, "channel", CHANNEL_TASK_STACK_SIZE, NULL, 1, NULL,
+                                CHANNEL_TASK_CORE) != pdPASS) {
+        Serial.println("Failed to start backend channel");
+        return false;
+    }
+    return true;
+}
+
+void getChannelStats(ChannelStats &out) {
+    out = stats;
+}
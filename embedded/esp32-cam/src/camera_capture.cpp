@@ -0,0 +1,248 @@
+#include "camera_capture.h"
+#include <esp_timer.h>
+#include "config.h"
+#include "camera_profiles.h"
+#include "metrics.h"
+#include "frame_score.h"
+#include "flash_led.h"
+#include "trace.h"
+
+static CaptureStats stats;
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+static PooledFrame *latest = NULL;    // Last reading frame, one of the pool's references
+static SemaphoreHandle_t snapshotMutex = NULL;  // One stale snapshot exposes at a time
+
+// Current exposure (in lines) and gain from the OV2640 sensor bank; register
+// addresses carry the bank in bit 8 for get_reg()
+static bool readExposure(sensor_t *s, uint32_t &aec, uint32_t &gain) {
+    if (!s->get_reg) {
+        return false;
+    }
+    int aecHigh = s->get_reg(s, 0x145, 0x3F);  // REG45 AEC[15:10]
+    int aecMid = s->get_reg(s, 0x110, 0xFF);   // AEC[9:2]
+    int aecLow = s->get_reg(s, 0x104, 0x03);   // REG04 AEC[1:0]
+    int agc = s->get_reg(s, 0x100, 0xFF);      // GAIN
+    if (aecHigh < 0 || aecMid < 0 || aecLow < 0 || agc < 0) {
+        return false;
+    }
+    aec = (aecHigh << 10) | (aecMid << 2) | aecLow;
+    gain = agc;
+    return true;
+}
+
+static bool exposureStable(uint32_t aec, uint32_t gain, uint32_t lastAec, uint32_t lastGain) {
+    uint32_t aecDelta = aec > lastAec ? aec - lastAec : lastAec - aec;
+    uint32_t gainDelta = gain > lastGain ? gain - lastGain : lastGain - gain;
+    uint32_t aecTolerance = max(lastAec * WARMUP_SETTLE_PERCENT / 100, (uint32_t)2);
+    return aecDelta <= aecTolerance && gainDelta <= 1;
+}
+
+// Discard frames until exposure has converged
+static void warmUp(CaptureInfo &info) {
+    int64_t start = esp_timer_get_time();
+    sensor_t *s = esp_camera_sensor_get();
+
+    uint32_t lastAec = 0, lastGain = 0;
+    bool haveLast = false;
+    bool readable = true;
+    while (info.warmupFrames < WARMUP_MAX_FRAMES &&
+           esp_timer_get_time() - start < (int64_t)WARMUP_TIMEOUT_MS * 1000) {
+        camera_fb_t *warmup = esp_camera_fb_get();
+        if (warmup) {
+            esp_camera_fb_return(warmup);
+        }
+        info.warmupFrames++;
+
+        uint32_t aec, gain;
+        readable = readable && readExposure(s, aec, gain);
+        if (!readable) {
+            // No AEC readback on this sensor: the old fixed warm-up
+            if (info.warmupFrames >= WARMUP_FALLBACK_FRAMES) {
+                info.settled = true;
+                break;
+            }
+            continue;
+        }
+        if (haveLast && info.warmupFrames >= WARMUP_MIN_FRAMES &&
+            exposureStable(aec, gain, lastAec, lastGain)) {
+            info.settled = true;
+            break;
+        }
+        lastAec = aec;
+        lastGain = gain;
+        haveLast = true;
+    }
+
+    info.warmupUs = esp_timer_get_time() - start;
+}
+
+// fb_get() hands over a frame once its readout has ended at VSYNC, so the
+// flash goes off as soon as the last frame it has to light is in, before
+// that frame is scored and copied
+static void flashDone(CaptureInfo &info, int64_t flashStart) {
+    if (USE_FLASH_FOR_CAPTURE && info.flashOnUs == 0) {
+        flashOff();
+        info.flashOnUs = esp_timer_get_time() - flashStart;
+    }
+}
+
+// Take the burst and return the best frame's driver buffer. The best so far
+// stays in its buffer while the next frame fills the other one, so no pool
+// slots are used; with a single driver buffer there is nothing to compare.
+static camera_fb_t *captureBest(CaptureInfo &info, int64_t flashStart) {
+    int frames = CAMERA_FB_COUNT >= 2 ? max(BURST_FRAMES, 1) : 1;
+    camera_fb_t *best = NULL;
+    for (int i = 0; i < frames; i++) {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (i == frames - 1) {
+            flashDone(info, flashStart);
+        }
+        if (!fb) {
+            continue;
+        }
+        FrameScore score;
+        frameScore(fb->buf, fb->len, score);
+        info.burstFrames++;
+        info.scoreUs += score.decodeUs;
+        if (best && score.score <= info.score) {
+            esp_camera_fb_return(fb);
+            continue;
+        }
+        if (best) {
+            esp_camera_fb_return(best);
+        }
+        best = fb;
+        info.bestFrame = i;
+        info.score = score.score;
+    }
+    return best;
+}
+
+PooledFrame *captureReading(CaptureInfo &info) {
+    info = CaptureInfo();
+    info.score = -1;
+    int64_t start = esp_timer_get_time();
+    TraceSpan captureSpan = traceBegin();
+
+    // Full resolution; waits for the stream to finish its current frame
+    TraceSpan span = traceBegin();
+    bool acquired = cameraAcquire(PROFILE_READING, pdMS_TO_TICKS(5000));
+    traceEnd(span, TRACE_CAMERA_WAIT);
+    if (!acquired) {
+        portENTER_CRITICAL(&statsMux);
+        stats.failures++;
+        portEXIT_CRITICAL(&statsMux);
+        traceEnd(captureSpan, TRACE_CAPTURE, -1);
+        return NULL;
+    }
+
+    // Flash on for the warm-up, AEC has to settle under its light; the
+    // frame exposed before it is among the discarded ones
+    int64_t flashStart = esp_timer_get_time();
+    if (USE_FLASH_FOR_CAPTURE) {
+        flashOn();
+    }
+
+    span = traceBegin();
+    warmUp(info);
+    traceEnd(span, TRACE_WARMUP, info.warmupFrames);
+
+    // NOW capture the real frames with adjusted exposure; the kept driver
+    // buffer goes straight back once it is copied into the pool
+    span = traceBegin();
+    PooledFrame *frame = framePoolTake(captureBest(info, flashStart));
+    traceEnd(span, TRACE_BURST, info.burstFrames);
+    if (frame) {
+        frame->score = info.score;
+    }
+    flashDone(info, flashStart);
+    cameraRelease();
+
+    info.totalUs = esp_timer_get_time() - start;
+    traceEnd(captureSpan, TRACE_CAPTURE, frame ? (int32_t)frame->seq : -1);
+
+    portENTER_CRITICAL(&statsMux);
+    if (!frame) {
+        stats.failures++;
+    } else {
+        stats.captures++;
+        if (!info.settled) {
+            stats.unsettled++;
+        }
+        stats.last = info;
+        stats.avgTotalUs = stats.avgTotalUs == 0
+            ? info.totalUs
+            : stats.avgTotalUs - stats.avgTotalUs / 8 + info.totalUs / 8;
+        uint32_t frames16 = info.warmupFrames * 16;
+        stats.avgWarmupFrames = stats.avgWarmupFrames == 0
+            ? frames16
+            : stats.avgWarmupFrames - stats.avgWarmupFrames / 8 + frames16 / 8;
+    }
+    portEXIT_CRITICAL(&statsMux);
+
+    if (frame) {
+        metricObserve(METRIC_CAPTURE_MS, info.totalUs / 1000);
+        metricObserve(METRIC_FRAME_BYTES, frame->len);
+        framePoolRetain(frame);
+        framePoolExchange(latest, frame);
+    }
+    return frame;
+}
+
+PooledFrame *lastReading() {
+    return framePoolGet(latest);
+}
+
+void captureInit() {
+    snapshotMutex = xSemaphoreCreateMutex();
+}
+
+// A new reference to the last reading if it is younger than `maxAgeMs`
+static PooledFrame *freshReading(uint32_t maxAgeMs) {
+    PooledFrame *frame = framePoolGet(latest);
+    if (frame && esp_timer_get_time() - frame->capturedUs <= (int64_t)maxAgeMs * 1000) {
+        portENTER_CRITICAL(&statsMux);
+        stats.snapshotsCached++;
+        portEXIT_CRITICAL(&statsMux);
+        return frame;
+    }
+    if (frame) {
+        framePoolRelease(frame);
+    }
+    return NULL;
+}
+
+PooledFrame *captureSnapshot(uint32_t maxAgeMs) {
+    PooledFrame *frame = freshReading(maxAgeMs);
+    if (frame) {
+        return frame;
+    }
+
+    // Requests that found it stale together wait for the first one's
+    // exposure and share it, rather than each firing the flash in turn
+    xSemaphoreTake(snapshotMutex, portMAX_DELAY);
+    frame = freshReading(maxAgeMs);
+    if (!frame) {
+        CaptureInfo info;
+        frame = captureReading(info);
+        portENTER_CRITICAL(&statsMux);
+        stats.snapshotsExposed++;
+        portEXIT_CRITICAL(&statsMux);
+    }
+    xSemaphoreGive(snapshotMutex);
+    return frame;
+}
+
+void captureScoreHeader(const PooledFrame *frame, char *buf, size_t size) {
+    if (frame->score < 0) {
+        return;
+    }
+    size_t used = strlen(buf);
+    snprintf(buf + used, size - used, "X-Frame-Score: %d\r\n", frame->score);
+}
+
+void getCaptureStats(CaptureStats &out) {
+    portENTER_CRITICAL(&statsMux);
+    out = stats;
+    portEXIT_CRITICAL(&statsMux);
+}
@@ -0,0 +1,174 @@
+#include "camera_profiles.h"
+#include <esp_timer.h>
+#include <Preferences.h>
+#include "config.h"
+#include "jpeg_util.h"
+
+static const bool READING_GRAYSCALE = OCR_UPLOAD_FORMAT != OCR_FORMAT_JPEG;
+
+static const CameraProfile profiles[PROFILE_COUNT] = {
+    {"preview", PREVIEW_FRAME_SIZE, PREVIEW_JPEG_QUALITY, false},
+    {"reading", READING_FRAME_SIZE, READING_GRAYSCALE ? OCR_GRAY_JPEG_QUALITY : READING_JPEG_QUALITY,
+     READING_GRAYSCALE},
+};
+
+static SemaphoreHandle_t cameraMutex = NULL;
+static CameraProfileStats stats;
+static CameraRoi roi;
+static bool roiDirty = false;   // Reading profile must be re-applied for a new ROI
+
+// Reprogram frame size, JPEG quality and colour on the running sensor, then drain the
+// frames the driver captured with the old settings
+static bool switchProfile(CameraProfileId id) {
+    const CameraProfile &profile = profiles[id];
+    int64_t start = esp_timer_get_time();
+
+    sensor_t *s = esp_camera_sensor_get();
+    if (!s || s->set_framesize(s, profile.frameSize) != 0) {
+        Serial.printf("Failed to switch camera to %s profile\n", profile.name);
+        return false;
+    }
+    s->set_quality(s, profile.jpegQuality);
+    s->set_special_effect(s, profile.grayscale ? 2 : 0);  // 2 = grayscale
+
+    uint16_t expectWidth = resolution[profile.frameSize].width;
+    uint16_t expectHeight = resolution[profile.frameSize].height;
+    bool windowed = id == PROFILE_READING && roi.enabled;
+    if (windowed) {
+        // OV2640 DSP window in UXGA mode: offset and size of the window, then
+        // the output size, equal here so the LCD keeps full resolution
+        if (s->set_res_raw(s, 0, 0, 0, 0, roi.x, roi.y, roi.width, roi.height,
+                           roi.width, roi.height, false, false) != 0) {
+            Serial.println("Failed to apply camera ROI");
+            return false;
+        }
+        expectWidth = roi.width;
+        expectHeight = roi.height;
+    }
+
+    // fb->width follows the sensor setting immediately, so stale frames are
+    // recognised from the size in their JPEG header instead
+    for (int i = 0; i < PROFILE_SWITCH_MAX_FRAMES; i++) {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb) {
+            continue;
+        }
+        uint16_t width = 0, height = 0;
+        bool fresh = jpegDimensions(fb->buf, fb->len, width, height) &&
+                     width == expectWidth && height == expectHeight;
+        esp_camera_fb_return(fb);
+        if (fresh) {
+            break;
+        }
+        stats.staleFrames++;
+    }
+
+    uint32_t elapsed = esp_timer_get_time() - start;
+    stats.active = id;
+    stats.switches++;
+    stats.lastSwitchUs = elapsed;
+    if (elapsed > stats.maxSwitchUs) {
+        stats.maxSwitchUs = elapsed;
+    }
+    if (id == PROFILE_READING) {
+        roiDirty = false;
+    }
+    Serial.printf("Camera profile: %s%s (%u ms)\n", profile.name, windowed ? " + ROI" : "",
+                  (unsigned)(elapsed / 1000));
+    return true;
+}
+
+static void loadRoi() {
+    roi.enabled = ROI_ENABLED;
+    roi.x = ROI_X;
+    roi.y = ROI_Y;
+    roi.width = ROI_WIDTH;
+    roi.height = ROI_HEIGHT;
+
+    Preferences prefs;
+    if (prefs.begin("camera", true)) {
+        CameraRoi stored;
+        if (prefs.getBytesLength("roi") == sizeof(stored) &&
+            prefs.getBytes("roi", &stored, sizeof(stored)) == sizeof(stored)) {
+            roi = stored;
+        }
+        prefs.end();
+    }
+}
+
+void cameraProfilesInit(CameraProfileId initial) {
+    cameraMutex = xSemaphoreCreateMutex();
+    stats.active = initial;
+    loadRoi();
+    roiDirty = roi.enabled;
+}
+
+bool cameraAcquire(CameraProfileId id, TickType_t wait) {
+    if (xSemaphoreTake(cameraMutex, wait) != pdTRUE) {
+        return false;
+    }
+    bool stale = stats.active != id || (id == PROFILE_READING && roiDirty);
+    if (stale && !switchProfile(id)) {
+        xSemaphoreGive(cameraMutex);
+        return false;
+    }
+    return true;
+}
+
+void cameraRelease() {
+    xSemaphoreGive(cameraMutex);
+}
+
+const CameraProfile &cameraProfile(CameraProfileId id) {
+    return profiles[id];
+}
+
+void getCameraProfileStats(CameraProfileStats &out) {
+    // Only written under the camera mutex; a reader racing a switch may see a
+    // mix of old and new values, which is fine for reporting and never blocks
+    // behind a long capture
+    out = stats;
+}
+
+bool cameraSetRoi(CameraRoi &requested) {
+    uint16_t maxWidth = resolution[READING_FRAME_SIZE].width;
+    uint16_t maxHeight = resolution[READING_FRAME_SIZE].height;
+
+    CameraRoi aligned = requested;
+    if (aligned.enabled) {
+        // Offsets in steps of 4, size in whole 16x16 JPEG MCUs
+        aligned.x &= ~3;
+        aligned.y &= ~3;
+        aligned.width &= ~15;
+        aligned.height &= ~15;
+        if (aligned.width == 0 || aligned.height == 0 ||
+            aligned.x + aligned.width > maxWidth || aligned.y + aligned.height > maxHeight) {
+            return false;
+        }
+    }
+
+    xSemaphoreTake(cameraMutex, portMAX_DELAY);
+    roi = aligned;
+    roiDirty = true;
+    xSemaphoreGive(cameraMutex);
+
+    Preferences prefs;
+    if (prefs.begin("camera", false)) {
+        prefs.putBytes("roi", &aligned, sizeof(aligned));
+        prefs.end();
+    }
+
+    requested = aligned;
+    return true;
+}
+
+void cameraGetRoi(CameraRoi &out) {
+    out = roi;
+}
+
+void cameraFrameHeaders(char *buf, size_t size) {
+    buf[0] = '\0';
+    if (roi.enabled) {
+        snprintf(buf, size, "X-ROI: %u,%u,%u,%u\r\n", roi.x, roi.y, roi.width, roi.height);
+    }
+}
@@ -0,0 +1,403 @@
+#include "capture_pipeline.h"
+#include <WiFi.h>
+#include <sys/time.h>
+#include "config.h"
+#include "camera_profiles.h"
+#include "uploader.h"
+#include "frame_spool.h"
+#include "frame_pool.h"
+#include "camera_capture.h"
+#include "frame_change.h"
+#include "edge_ocr.h"
+#include "ocr_bitmap.h"
+#include "thumbnail.h"
+#include "backend_channel.h"
+#include "meter_regions.h"
+#include "metrics.h"
+#include "trace.h"
+
+static QueueHandle_t frameQueue = NULL;
+static TaskHandle_t captureTaskHandle = NULL;
+static PipelineStats stats;
+// Kept in RTC memory so the change detector's skip limit also holds across
+// deep-sleep cycles, where millis() restarts on every wake
+RTC_DATA_ATTR static uint64_t lastSentMs = 0;     // Last frame uploaded or spooled, clockMs()
+RTC_DATA_ATTR static uint32_t unchangedSinceSent = 0;
+// Set by the backend's replies; in RTC memory so the duty cycle keeps it too
+RTC_DATA_ATTR static uint32_t intervalMs = CAPTURE_INTERVAL_MS;
+
+// Wall-clock milliseconds; unlike millis() it keeps running through deep sleep
+static uint64_t clockMs() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+// The backend fetches the full frame behind a thumbnail over the channel;
+// without it the thumbnail could be all the backend ever gets
+static bool channelConnected() {
+    ChannelStats channel;
+    getChannelStats(channel);
+    return channel.connected;
+}
+
+static void captureTask(void *) {
+    // The first reading is taken immediately so a reboot doesn't cost an interval
+    TickType_t lastCapture = xTaskGetTickCount();
+    bool first = true;
+    for (;;) {
+        // Wait out the interval from the last capture. setCaptureInterval()
+        // cuts the wait short so it is measured again against the new one.
+        while (!first) {
+            TickType_t interval = pdMS_TO_TICKS(intervalMs);
+            TickType_t elapsed = xTaskGetTickCount() - lastCapture;
+            if (elapsed >= interval) {
+                break;
+            }
+            ulTaskNotifyTake(pdTRUE, interval - elapsed);
+        }
+        lastCapture = xTaskGetTickCount();
+        first = false;
+
+        // Backpressure: don't take a frame the upload task has no room for
+        if (uxQueueSpacesAvailable(frameQueue) == 0) {
+            stats.skipped++;
+            Serial.println("Auto-capture skipped, upload still pending");
+            continue;
+        }
+
+        Serial.println("Auto-capturing image...");
+        CaptureInfo info;
+        PooledFrame *frame = captureReading(info);
+        if (!frame) {
+            Serial.println("Auto-capture failed");
+            stats.captureFailures++;
+            continue;
+        }
+        stats.captured++;
+
+        xQueueSend(frameQueue, &frame, 0);
+        uint32_t waiting = uxQueueMessagesWaiting(frameQueue);
+        if (waiting > stats.queueHighWater) {
+            stats.queueHighWater = waiting;
+        }
+        Serial.printf("Auto-capture successful: %d warm-up frames, %u ms\n", info.warmupFrames,
+                      (unsigned)(info.totalUs / 1000));
+    }
+}
+
+// The backend has a reading from this boot
+static void readingDelivered() {
+    if (stats.firstReadingMs == 0) {
+        stats.firstReadingMs = millis();
+        Serial.printf("Time to first reading: %u ms\n", (unsigned)stats.firstReadingMs);
+    }
+}
+
+// Take the next capture interval from the backend's reply, if it sent one
+static void followSchedule(const UploadResult &upload) {
+    if (upload.captureIntervalMs != 0) {
+        setCaptureInterval(upload.captureIntervalMs);
+    }
+}
+
+// The frame last checked for changes is on its way to the backend
+static void frameSent() {
+    frameChangeAccept();
+    lastSentMs = clockMs();
+    unchangedSinceSent = 0;
+}
+
+// Decide whether a frame is worth uploading. Unchanged frames are still sent
+// once CHANGE_MAX_SKIP_MS has passed, so the backend sees the meter at least
+// that often even if the detector misses a slow change.
+static bool needsUpload(PooledFrame *frame) {
+    CameraRoi roi;
+    cameraGetRoi(roi);
+    if (!CHANGE_DETECTION_ENABLED || !roi.enabled) {
+        return true;
+    }
+    FrameChange change;
+    TraceSpan span = traceBegin();
+    bool changed = frameChangeCheck(frame->buf, frame->len, change);
+    traceEnd(span, TRACE_CHANGE, changed);
+    if (changed) {
+        return true;
+    }
+    if (clockMs() - lastSentMs >= CHANGE_MAX_SKIP_MS) {
+        Serial.println("Frame unchanged, uploading anyway (max skip time reached)");
+        return true;
+    }
+    stats.unchanged++;
+    unchangedSinceSent++;
+    Serial.printf("Frame unchanged (%u cells, max delta %u, %u ms), not uploaded\n",
+                  change.changedCells, change.maxDelta, (unsigned)(change.decodeUs / 1000));
+    return false;
+}
+
+// Tell the backend the device is alive and the display hasn't changed
+static void sendHeartbeat(UploadResult &upload) {
+    char body[96];
+    int len = snprintf(body, sizeof(body),
+                       "{\"unchanged\":%u,\"last_upload_age_ms\":%lu}",
+                       (unsigned)unchangedSinceSent, (unsigned long)(clockMs() - lastSentMs));
+    char extraHeaders[288] = "";
+    traceHeaders(extraHeaders, sizeof(extraHeaders));
+    metricsSummaryHeader(extraHeaders, sizeof(extraHeaders));
+    int code = postToBackend(API_HEARTBEAT_ENDPOINT, (const uint8_t *)body, len,
+                             "application/json", extraHeaders, upload);
+    followSchedule(upload);
+    if (code >= 200 && code < 300) {
+        stats.heartbeats++;
+    } else {
+        Serial.printf("Heartbeat failed: %d\n", code);
+    }
+}
+
+// Post a reading decoded on the device instead of the frame
+static bool sendReading(const EdgeOcrResult &ocr, UploadResult &upload) {
+    char body[128];
+    int len = snprintf(body, sizeof(body),
+                       "{\"reading\":%.*f,\"digits\":\"%s\",\"confidence\":%u}",
+                       ocr.decimals, ocr.reading, ocr.digits, ocr.confidence);
+    int code = postToBackend(API_READING_ENDPOINT, (const uint8_t *)body, len,
+                             "application/json", NULL, upload);
+    followSchedule(upload);
+    if (code >= 200 && code < 300) {
+        Serial.printf("Edge reading %s (%u%%) sent in %u ms\n", ocr.digits, ocr.confidence,
+                      (unsigned)(upload.latencyUs / 1000));
+        return true;
+    }
+    // Rejected or not delivered: the frame goes to the server OCR instead
+    Serial.printf("Edge reading %s not accepted: %d\n", ocr.digits, code);
+    return false;
+}
+
+// Keep a frame the backend couldn't take for a later batched replay
+static void spoolFrame(PooledFrame *frame, const char *reason) {
+    CameraRoi roi;
+    cameraGetRoi(roi);
+    char roiText[24] = "";
+    if (roi.enabled) {
+        snprintf(roiText, sizeof(roiText), "%u,%u,%u,%u", roi.x, roi.y, roi.width, roi.height);
+    }
+    TraceSpan span = traceBegin();
+    bool stored = spoolStore(frame->buf, frame->len, roiText);
+    traceEnd(span, TRACE_SPOOL, stored ? frame->len : 0);
+    if (stored) {
+        frameSent();
+        Serial.printf("Frame spooled (%s), %d pending\n", reason, spoolPending());
+    } else {
+        Serial.printf("Frame lost (%s), spool unavailable\n", reason);
+    }
+}
+
+// Drain the spool while the backend keeps accepting batches
+static void replaySpool() {
+    while (spoolPending() > 0 && WiFi.status() == WL_CONNECTED) {
+        if (spoolReplayBatch() <= 0) {
+            break;
+        }
+    }
+}
+
+// Upload one frame, or what it boils down to (nothing, a heartbeat, an edge
+// reading), spooling it if the backend can't take it. Releases the frame.
+static void deliverOrSpool(PooledFrame *frame) {
+    static UploadResult upload;
+    char extraHeaders[448] = "";
+
+    if (!needsUpload(frame)) {
+        framePoolRelease(frame);
+        if (WiFi.status() == WL_CONNECTED) {
+            sendHeartbeat(upload);
+        }
+        return;
+    }
+
+    if (WiFi.status() != WL_CONNECTED) {
+        spoolFrame(frame, "WiFi down");
+        framePoolRelease(frame);
+        stats.uploadFailures++;
+        return;
+    }
+
+    // Several meters in view: one crop per meter replaces the frame, and
+    // edge OCR, which reads a single display, doesn't apply
+    TraceSpan span = traceBegin();
+    bool meters = meterRegionCount() > 0 && meterRegionsEncode(frame);
+    if (meters) {
+        MeterRegionStats cropped;
+        getMeterRegionStats(cropped);
+        traceEnd(span, TRACE_ENCODE, cropped.lastBytes);
+    }
+
+    // Confident edge readings replace the upload; otherwise the server
+    // OCR gets the frame along with what the device made of it
+    EdgeOcrResult ocr;
+    bool haveOcr = false;
+    if (!meters && edgeOcrEnabled()) {
+        span = traceBegin();
+        haveOcr = edgeOcrRead(frame->buf, frame->len, ocr);
+        traceEnd(span, TRACE_EDGE_OCR, haveOcr ? ocr.confidence : -1);
+    }
+    if (haveOcr && ocr.confidence >= EDGE_OCR_MIN_CONFIDENCE && sendReading(ocr, upload)) {
+        framePoolRelease(frame);
+        frameSent();
+        readingDelivered();
+        stats.edgeReadings++;
+        return;
+    }
+
+    traceHeaders(extraHeaders, sizeof(extraHeaders));
+    cameraFrameHeaders(extraHeaders, sizeof(extraHeaders));
+    captureScoreHeader(frame, extraHeaders, sizeof(extraHeaders));
+    if (haveOcr) {
+        size_t used = strlen(extraHeaders);
+        snprintf(extraHeaders + used, sizeof(extraHeaders) - used,
+                 "X-Edge-Reading: %s\r\nX-Edge-Confidence: %u\r\n", ocr.digits, ocr.confidence);
+    }
+    // Spooled frames stay full JPEG; only live uploads are converted
+    const uint8_t *body = frame->buf;
+    size_t len = frame->len;
+    const char *contentType = "image/jpeg";
+    bool thumbnail = false;
+    span = traceBegin();
+    if (meters) {
+        // The crops go as multipart, built by meterRegionsUpload()
+    } else if (OCR_UPLOAD_FORMAT == OCR_FORMAT_BITMAP) {
+        if (ocrBitmapEncode(frame->buf, frame->len, body, len)) {
+            contentType = "image/x-portable-bitmap";
+            traceEnd(span, TRACE_ENCODE, len);
+        }
+    } else if (THUMBNAIL_UPLOAD_ENABLED && !DEEP_SLEEP_ENABLED && channelConnected() &&
+               thumbnailEncode(frame, body, len)) {
+        traceEnd(span, TRACE_ENCODE, len);
+        thumbnailHeaders(frame, extraHeaders, sizeof(extraHeaders));
+        // Held before the upload: the backend may ask for it before the reply
+        thumbnailKeepFull(frame);
+        thumbnail = true;
+    }
+    metricsSummaryHeader(extraHeaders, sizeof(extraHeaders));
+    int code = meters ? meterRegionsUpload(extraHeaders, upload)
+                      : uploadToBackend(body, len, contentType, extraHeaders, upload);
+    followSchedule(upload);
+    if (meters) {
+        len = upload.bytesSent;
+    }
+
+    stats.lastUploadUs = upload.latencyUs;
+    if (code >= 200 && code < 300) {
+        framePoolRelease(frame);
+        frameSent();
+        readingDelivered();
+        stats.uploaded++;
+        Serial.printf("Auto-upload: %u bytes in %u ms\n", (unsigned)len,
+                      (unsigned)(upload.latencyUs / 1000));
+        // Backend is reachable again: catch up on anything spooled
+        replaySpool();
+        return;
+    }
+
+    stats.uploadFailures++;
+    Serial.printf("Auto-upload failed: %d\n", code);
+    if (thumbnail) {
+        thumbnailDropFull(frame->seq);
+    }
+    // Unreachable or failing backend; a 4xx would fail again on replay
+    if (code <= 0 || code >= 500) {
+        spoolFrame(frame, "backend unavailable");
+    }
+    framePoolRelease(frame);
+}
+
+static void deliverFrame(PooledFrame *frame) {
+    // The frame is released by then; a slow reading goes out with the next upload
+    uint32_t seq = frame->seq;
+    deliverOrSpool(frame);
+    traceReadingDone(seq);
+}
+
+static void uploadTask(void *) {
+    for (;;) {
+        // Wake up periodically even without new frames to retry the spool
+        PooledFrame *frame = NULL;
+        if (xQueueReceive(frameQueue, &frame, pdMS_TO_TICKS(SPOOL_RETRY_MS)) != pdTRUE) {
+            replaySpool();
+            thumbnailExpire();
+            continue;
+        }
+        deliverFrame(frame);
+    }
+}
+
+bool runCaptureCycle() {
+    static bool spoolReady = false;
+    if (!spoolReady) {
+        spoolInit();
+        spoolReady = true;
+    }
+
+    CaptureInfo info;
+    PooledFrame *frame = captureReading(info);
+    if (!frame) {
+        Serial.println("Capture failed");
+        stats.captureFailures++;
+        return false;
+    }
+    stats.captured++;
+
+    uint32_t before = stats.uploaded + stats.edgeReadings + stats.heartbeats;
+    deliverFrame(frame);
+    bool delivered = stats.uploaded + stats.edgeReadings + stats.heartbeats != before;
+    if (delivered) {
+        // The backend is reachable: send what earlier wakes had to spool
+        replaySpool();
+    }
+    return delivered;
+}
+
+bool startCapturePipeline() {
+    spoolInit();
+
+    frameQueue = xQueueCreate(CAPTURE_QUEUE_LENGTH, sizeof(PooledFrame *));
+    if (!frameQueue) {
+        Serial.println("Failed to create capture queue");
+        return false;
+    }
+
+    if (xTaskCreatePinnedToCore(uploadTask, "upload", PIPELINE_TASK_STACK_SIZE, NULL, 1, NULL,
+                                PIPELINE_TASK_CORE) != pdPASS ||
+        xTaskCreatePinnedToCore(captureTask, "capture", PIPELINE_TASK_STACK_SIZE, NULL, 1,
+                                &captureTaskHandle, PIPELINE_TASK_CORE) != pdPASS) {
+        Serial.println("Failed to start capture pipeline");
+        return false;
+    }
+
+    Serial.printf("Auto-capture every %u s until the backend sets an interval\n",
+                  (unsigned)(intervalMs / 1000));
+    return true;
+}
+
+void getPipelineStats(PipelineStats &out) {
+    out = stats;
+    out.queued = frameQueue ? uxQueueMessagesWaiting(frameQueue) : 0;
+    out.intervalMs = intervalMs;
+}
+
+uint32_t captureIntervalMs() {
+    return intervalMs;
+}
+
+void setCaptureInterval(uint32_t ms) {
+    uint32_t next = min(max(ms, (uint32_t)CAPTURE_INTERVAL_MIN_MS), (uint32_t)CAPTURE_INTERVAL_MAX_MS);
+    if (next != intervalMs) {
+        Serial.printf("Capture interval %u s -> %u s (backend)\n", (unsigned)(intervalMs / 1000),
+                      (unsigned)(next / 1000));
+        intervalMs = next;
+        stats.intervalChanges++;
+        if (captureTaskHandle) {
+            xTaskNotifyGive(captureTaskHandle);
+        }
+    }
+}
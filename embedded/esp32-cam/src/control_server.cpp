@@ -0,0 +1,175 @@
+#include "control_server.h"
+#include <esp_timer.h>
+#include "config.h"
+#include "metrics.h"
+#include "request_arena.h"
+#include "trace.h"
+
+static httpd_handle_t server = NULL;
+static const Route *routeTable = NULL;   // Trace spans name a route by its index
+static size_t routeCount = 0;
+
+HttpRequest::HttpRequest(httpd_req_t *req) : req(req), headersUsed(0) {
+    query[0] = '\0';
+    size_t len = httpd_req_get_url_query_len(req);
+    if (len > 0 && len < sizeof(query)) {
+        httpd_req_get_url_query_str(req, query, sizeof(query));
+    }
+}
+
+bool HttpRequest::hasArg(const char *name) const {
+    char value[2];
+    // ESP_ERR_HTTPD_RESULT_TRUNC still means the key is there
+    return query[0] && httpd_query_key_value(query, name, value, sizeof(value)) != ESP_ERR_NOT_FOUND;
+}
+
+String HttpRequest::arg(const char *name) const {
+    char value[64];
+    if (!query[0] || httpd_query_key_value(query, name, value, sizeof(value)) != ESP_OK) {
+        return String();
+    }
+    return String(value);
+}
+
+int HttpRequest::args() const {
+    if (!query[0]) {
+        return 0;
+    }
+    int count = 1;
+    for (const char *p = query; *p; p++) {
+        if (*p == '&') {
+            count++;
+        }
+    }
+    return count;
+}
+
+String HttpRequest::header(const char *name) const {
+    char value[96];
+    size_t len = httpd_req_get_hdr_value_len(req, name);
+    if (len == 0 || len >= sizeof(value) ||
+        httpd_req_get_hdr_value_str(req, name, value, sizeof(value)) != ESP_OK) {
+        return String();
+    }
+    return String(value);
+}
+
+void HttpRequest::sendHeader(const char *name, const char *value) {
+    // httpd keeps pointers until the response is sent, so both go in `headers`
+    size_t nameLen = strlen(name) + 1;
+    size_t valueLen = strlen(value) + 1;
+    if (headersUsed + nameLen + valueLen > sizeof(headers)) {
+        return;
+    }
+    char *namePtr = headers + headersUsed;
+    memcpy(namePtr, name, nameLen);
+    char *valuePtr = namePtr + nameLen;
+    memcpy(valuePtr, value, valueLen);
+    headersUsed += nameLen + valueLen;
+    httpd_resp_set_hdr(req, namePtr, valuePtr);
+}
+
+void HttpRequest::sendHeader(const char *name, long value) {
+    char text[12];
+    snprintf(text, sizeof(text), "%ld", value);
+    sendHeader(name, text);
+}
+
+// httpd wants the whole status line; `buf` holds it for codes not listed
+static const char *statusLine(int code, char *buf, size_t size) {
+    switch (code) {
+    case 200: return "200 OK";
+    case 202: return "202 Accepted";
+    case 204: return "204 No Content";
+    case 301: return "301 Moved Permanently";
+    case 302: return "302 Found";
+    case 304: return "304 Not Modified";
+    case 400: return "400 Bad Request";
+    case 403: return "403 Forbidden";
+    case 404: return "404 Not Found";
+    case 405: return "405 Method Not Allowed";
+    case 408: return "408 Request Timeout";
+    case 409: return "409 Conflict";
+    case 413: return "413 Payload Too Large";
+    case 429: return "429 Too Many Requests";
+    case 500: return "500 Internal Server Error";
+    case 503: return "503 Service Unavailable";
+    }
+    // Anything else keeps its code, with the reason phrase of its class
+    const char *reason = code >= 500 ? "Server Error" : code >= 400 ? "Client Error"
+                       : code >= 300 ? "Redirect" : "OK";
+    snprintf(buf, size, "%d %s", code, reason);
+    return buf;
+}
+
+void HttpRequest::send(int code, const char *contentType, const char *body) {
+    send(code, contentType, body, strlen(body));
+}
+
+void HttpRequest::send(int code, const char *contentType, const char *data, size_t len) {
+    char status[32];  // httpd keeps the pointer until the response is sent
+    httpd_resp_set_status(req, statusLine(code, status, sizeof(status)));
+    httpd_resp_set_type(req, contentType);
+    httpd_resp_send(req, data, len);
+}
+
+void HttpRequest::sendJson(int code, const JsonDocument &doc) {
+    size_t len = measureJson(doc);
+    char *text = (char *)requestArena()->allocate(len + 1);
+    if (!text) {
+        send(500, "text/plain", "Out of memory");
+        return;
+    }
+    serializeJson(doc, text, len + 1);
+    send(code, "application/json", text, len);
+    requestArena()->deallocate(text);
+}
+
+static esp_err_t dispatch(httpd_req_t *r) {
+    const Route *route = (const Route *)r->user_ctx;
+    int64_t start = esp_timer_get_time();
+    TraceSpan span = traceBegin();
+    HttpRequest req(r);
+    route->handler(req);
+    requestArenaReset();
+    traceEnd(span, TRACE_HANDLER, route - routeTable);
+    metricObserve(METRIC_HTTP_MS, (esp_timer_get_time() - start) / 1000);
+    return ESP_OK;
+}
+
+bool startControlServer(const Route *routes, size_t count) {
+    if (!requestArenaInit()) {
+        Serial.println("Request arena allocation failed, responses use the heap");
+    }
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = WEB_SERVER_PORT;
+    config.core_id = CONTROL_TASK_CORE;
+    config.stack_size = CONTROL_TASK_STACK_SIZE;
+    config.max_open_sockets = CONTROL_MAX_SOCKETS;
+    config.max_uri_handlers = count;
+    config.lru_purge_enable = true;  // A new client evicts the longest idle one
+    config.recv_wait_timeout = CONTROL_SOCKET_TIMEOUT_S;
+    config.send_wait_timeout = CONTROL_SOCKET_TIMEOUT_S;
+
+    routeTable = routes;
+    routeCount = count;
+    if (httpd_start(&server, &config) != ESP_OK) {
+        Serial.println("Control server start failed");
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        httpd_uri_t uri = {};
+        uri.uri = routes[i].uri;
+        uri.method = HTTP_GET;
+        uri.handler = dispatch;
+        uri.user_ctx = (void *)&routes[i];
+        httpd_register_uri_handler(server, &uri);
+    }
+    Serial.printf("HTTP server started on port %d\n", WEB_SERVER_PORT);
+    return true;
+}
+
+const char *controlRouteUri(int index) {
+    return index >= 0 && (size_t)index < routeCount ? routeTable[index].uri : "";
+}
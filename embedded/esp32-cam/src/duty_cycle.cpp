@@ -0,0 +1,76 @@
+#include "duty_cycle.h"
+#include <WiFi.h>
+#include <esp_camera.h>
+#include <esp_sleep.h>
+#include <driver/rtc_io.h>
+#include "config.h"
+#include "capture_pipeline.h"
+#include "flash_led.h"
+
+RTC_DATA_ATTR static DutyCycleStats stats;
+
+// mA over ms to mAh
+static float chargeMah(float currentMa, uint64_t ms) {
+    return currentMa * ms / 3600000.0f;
+}
+
+void dutyCycleWake() {
+    // Held through sleep by dutyCycleRun(); the pins can't be driven until released
+    rtc_gpio_hold_dis((gpio_num_t)PWDN_GPIO_NUM);
+    rtc_gpio_hold_dis((gpio_num_t)FLASH_LED_PIN);
+
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER) {
+        Serial.println("Duty cycle: cold start");
+        return;
+    }
+    Serial.printf("Duty cycle: wake %lu, last cycle awake %lu ms, %.2f mAh since power-on\n",
+                  (unsigned long)stats.cycles + 1, (unsigned long)stats.lastAwakeMs,
+                  stats.totalMah);
+}
+
+void dutyCycleRun() {
+    bool delivered = runCaptureCycle();
+
+    // millis() starts at boot, so this covers the whole wake
+    unsigned long awakeMs = millis();
+    unsigned long sleepMs = DEEP_SLEEP_MIN_MS;
+    unsigned long intervalMs = captureIntervalMs();
+    if (awakeMs + DEEP_SLEEP_MIN_MS < intervalMs) {
+        sleepMs = intervalMs - awakeMs;
+    }
+
+    float cycleMah = chargeMah(DUTY_AWAKE_CURRENT_MA, awakeMs) +
+                     chargeMah(DUTY_SLEEP_CURRENT_MA, sleepMs);
+    stats.cycles++;
+    if (delivered) {
+        stats.delivered++;
+    }
+    stats.lastAwakeMs = awakeMs;
+    stats.totalAwakeMs += awakeMs;
+    stats.totalSleepMs += sleepMs;
+    stats.totalMah += cycleMah;
+
+    uint64_t totalMs = stats.totalAwakeMs + stats.totalSleepMs;
+    Serial.printf("Duty cycle %lu: %s, awake %lu ms, sleeping %lu ms, ~%.3f mAh "
+                  "(%.1f%% awake, avg %.2f mA)\n",
+                  (unsigned long)stats.cycles, delivered ? "delivered" : "not delivered",
+                  awakeMs, sleepMs, cycleMah, totalMs ? 100.0 * stats.totalAwakeMs / totalMs : 0.0,
+                  totalMs ? stats.totalMah * 3600000.0 / totalMs : 0.0);
+    Serial.flush();
+
+    // Camera and flash stay off while asleep: drive the pins, then hold them
+    esp_camera_deinit();
+    pinMode(PWDN_GPIO_NUM, OUTPUT);
+    digitalWrite(PWDN_GPIO_NUM, HIGH);
+    flashRelease();
+    rtc_gpio_hold_en((gpio_num_t)PWDN_GPIO_NUM);
+    rtc_gpio_hold_en((gpio_num_t)FLASH_LED_PIN);
+
+    WiFi.disconnect(true);
+    esp_sleep_enable_timer_wakeup((uint64_t)sleepMs * 1000);
+    esp_deep_sleep_start();
+}
+
+void getDutyCycleStats(DutyCycleStats &out) {
+    out = stats;
+}
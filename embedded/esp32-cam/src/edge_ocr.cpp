@@ -0,0 +1,248 @@
+#include "edge_ocr.h"
+#include <Preferences.h>
+#include <esp_timer.h>
+#include "jpeg_util.h"
+
+// Segment sample points within a digit cell (percent of width, height), in
+// the order the backend's SEGMENTS table uses: top, top-left, top-right,
+// middle, bottom-left, bottom-right, bottom
+static const uint8_t SEGMENT_POS[7][2] = {
+    {50, 8}, {15, 28}, {85, 28}, {50, 50}, {15, 72}, {85, 72}, {50, 92}
+};
+
+// Centres of the upper and lower loops, never lit in any digit
+static const uint8_t BACKGROUND_POS[2][2] = {{50, 28}, {50, 72}};
+
+struct DigitPattern {
+    uint8_t segments;          // Bit 6 = top ... bit 0 = bottom
+    char digit;
+};
+
+static const DigitPattern PATTERNS[] = {
+    {0b1110111, '0'}, {0b0010010, '1'}, {0b1011101, '2'}, {0b1011011, '3'},
+    {0b0111010, '4'}, {0b1101011, '5'}, {0b1101111, '6'}, {0b1010010, '7'},
+    {0b1111111, '8'}, {0b1111011, '9'},
+    // Variants some meters use
+    {0b0101111, '6'}, {0b1110010, '7'}, {0b1111010, '9'},
+};
+
+static EdgeOcrLayout layout;
+static portMUX_TYPE layoutLock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t *gray = NULL;    // Only allocated while decoding is enabled
+static SemaphoreHandle_t grayLock = NULL;  // Held by a read and while (re)allocating
+static EdgeOcrStats stats;
+
+// Allocate the grayscale buffer when decoding is enabled and give the
+// 120 KB of PSRAM back when it isn't. Call with grayLock held.
+static bool updateBuffer(bool enabled) {
+    if (enabled && !gray) {
+        gray = (uint8_t *)ps_malloc(EDGE_OCR_GRAY_SIZE);
+        if (!gray) {
+            Serial.println("Edge OCR buffer allocation failed");
+            return false;
+        }
+    } else if (!enabled && gray) {
+        free(gray);
+        gray = NULL;
+    }
+    return true;
+}
+
+bool edgeOcrInit() {
+    layout.enabled = EDGE_OCR_ENABLED;
+    layout.digits = EDGE_OCR_DIGITS;
+    layout.decimals = EDGE_OCR_DECIMALS;
+    layout.x = EDGE_OCR_X;
+    layout.y = EDGE_OCR_Y;
+    layout.digitWidth = EDGE_OCR_DIGIT_WIDTH;
+    layout.digitHeight = EDGE_OCR_DIGIT_HEIGHT;
+    layout.pitch = EDGE_OCR_PITCH;
+
+    Preferences prefs;
+    if (prefs.begin("edgeocr", true)) {
+        EdgeOcrLayout stored;
+        if (prefs.getBytesLength("layout") == sizeof(stored) &&
+            prefs.getBytes("layout", &stored, sizeof(stored)) == sizeof(stored)) {
+            layout = stored;
+        }
+        prefs.end();
+    }
+
+    grayLock = xSemaphoreCreateMutex();
+    Serial.printf("Edge OCR %s, %u digits\n", layout.enabled ? "enabled" : "disabled", layout.digits);
+    return updateBuffer(layout.enabled);
+}
+
+bool edgeOcrEnabled() {
+    return gray && layout.enabled;
+}
+
+bool edgeOcrSetLayout(const EdgeOcrLayout &value) {
+    if (value.digits == 0 || value.digits > EDGE_OCR_MAX_DIGITS || value.decimals >= value.digits ||
+        value.digitWidth < 8 || value.digitHeight < 16 || value.pitch < value.digitWidth) {
+        return false;
+    }
+    portENTER_CRITICAL(&layoutLock);
+    layout = value;
+    portEXIT_CRITICAL(&layoutLock);
+
+    xSemaphoreTake(grayLock, portMAX_DELAY);
+    updateBuffer(value.enabled);
+    xSemaphoreGive(grayLock);
+
+    Preferences prefs;
+    if (prefs.begin("edgeocr", false)) {
+        prefs.putBytes("layout", &value, sizeof(value));
+        prefs.end();
+    }
+    return true;
+}
+
+void edgeOcrGetLayout(EdgeOcrLayout &out) {
+    portENTER_CRITICAL(&layoutLock);
+    out = layout;
+    portEXIT_CRITICAL(&layoutLock);
+}
+
+// Mean brightness of a patch centred on (cx, cy). False if the patch
+// reaches outside the image: what's left of it says nothing about the
+// segment, and an empty one would read as lit on a dark-digit display.
+static bool patchMean(uint16_t width, uint16_t height, int cx, int cy, int rx, int ry,
+                      uint8_t &mean) {
+    int x0 = cx - rx, x1 = cx + rx;
+    int y0 = cy - ry, y1 = cy + ry;
+    if (x0 < 0 || y0 < 0 || x1 >= width || y1 >= height) {
+        mean = 0;
+        return false;
+    }
+    uint32_t sum = 0;
+    for (int y = y0; y <= y1; y++) {
+        const uint8_t *row = gray + (size_t)y * width;
+        for (int x = x0; x <= x1; x++) {
+            sum += row[x];
+        }
+    }
+    mean = sum / ((x1 - x0 + 1) * (y1 - y0 + 1));
+    return true;
+}
+
+static bool readDigits(const uint8_t *jpeg, size_t len, EdgeOcrResult &out) {
+    int64_t start = esp_timer_get_time();
+    stats.attempts++;
+    if (!gray) {
+        return false;  // Disabled since edgeOcrEnabled() was checked
+    }
+
+    EdgeOcrLayout l;
+    edgeOcrGetLayout(l);
+
+    // Decode at the coarsest scale that keeps some detail in each segment
+    uint16_t frameWidth = 0, frameHeight = 0;
+    if (!jpegDimensions(jpeg, len, frameWidth, frameHeight)) {
+        stats.decodeFailures++;
+        return false;
+    }
+    int shift = 0;
+    while (shift < JPG_SCALE_8X && (frameWidth >> shift) > EDGE_OCR_MAX_GRAY_WIDTH) {
+        shift++;
+    }
+    uint16_t width = 0, height = 0;
+    if (!jpegDecodeGray(jpeg, len, (jpg_scale_t)shift, gray, EDGE_OCR_GRAY_SIZE, width, height)) {
+        stats.decodeFailures++;
+        return false;
+    }
+    out.decodeUs = esp_timer_get_time() - start;
+
+    // Sample every segment and background patch in scaled coordinates
+    uint8_t segment[EDGE_OCR_MAX_DIGITS][7];
+    uint8_t lo = 255, hi = 0;
+    bool clipped = false;
+    int dw = l.digitWidth >> shift, dh = l.digitHeight >> shift;
+    int rx = max(dw / 10, 1), ry = max(dh / 20, 1);
+    for (int d = 0; d < l.digits; d++) {
+        int left = (l.x + d * l.pitch) >> shift;
+        int top = l.y >> shift;
+        for (int s = 0; s < 7; s++) {
+            clipped |= !patchMean(width, height, left + dw * SEGMENT_POS[s][0] / 100,
+                                  top + dh * SEGMENT_POS[s][1] / 100, rx, ry, segment[d][s]);
+            lo = min(lo, segment[d][s]);
+            hi = max(hi, segment[d][s]);
+        }
+        for (int b = 0; b < 2; b++) {
+            uint8_t level;
+            clipped |= !patchMean(width, height, left + dw * BACKGROUND_POS[b][0] / 100,
+                                  top + dh * BACKGROUND_POS[b][1] / 100, rx, ry, level);
+            lo = min(lo, level);
+            hi = max(hi, level);
+        }
+    }
+
+    // One threshold halfway between lit and unlit; a segment's confidence is
+    // how far it sits from that threshold, relative to the contrast
+    out.contrast = hi > lo ? hi - lo : 0;
+    int threshold = (lo + hi) / 2;
+    // A layout that doesn't fit the frame (set for another ROI) can't be read
+    int confidence = out.contrast >= EDGE_OCR_MIN_CONTRAST && !clipped ? 100 : 0;
+    bool leading = true;
+    uint32_t value = 0;
+    for (int d = 0; d < l.digits; d++) {
+        uint8_t mask = 0;
+        for (int s = 0; s < 7; s++) {
+            bool lit = EDGE_OCR_DARK_SEGMENTS ? segment[d][s] < threshold : segment[d][s] > threshold;
+            mask = (mask << 1) | (lit ? 1 : 0);
+            int margin = out.contrast ? abs(segment[d][s] - threshold) * 200 / out.contrast : 0;
+            confidence = min(confidence, margin);
+        }
+
+        char digit = '?';
+        if (mask == 0 && leading) {
+            digit = '0';  // Blank leading digit
+        } else {
+            for (const DigitPattern &p : PATTERNS) {
+                if (p.segments == mask) {
+                    digit = p.digit;
+                    break;
+                }
+            }
+        }
+        if (digit == '?') {
+            confidence = 0;
+        } else {
+            value = value * 10 + (digit - '0');
+        }
+        leading = leading && mask == 0;
+        out.digits[d] = digit;
+    }
+    out.digits[l.digits] = '\0';
+
+    double scale = 1;
+    for (int i = 0; i < l.decimals; i++) {
+        scale *= 10;
+    }
+    out.reading = value / scale;
+    out.decimals = l.decimals;
+    out.confidence = confidence;
+    out.totalUs = esp_timer_get_time() - start;
+
+    if (clipped) {
+        stats.clipped++;
+    }
+    if (out.confidence >= EDGE_OCR_MIN_CONFIDENCE) {
+        stats.confident++;
+    }
+    stats.lastConfidence = out.confidence;
+    memcpy(stats.lastDigits, out.digits, sizeof(stats.lastDigits));
+    stats.lastUs = out.totalUs;
+    return true;
+}
+
+bool edgeOcrRead(const uint8_t *jpeg, size_t len, EdgeOcrResult &out) {
+    xSemaphoreTake(grayLock, portMAX_DELAY);
+    bool ok = readDigits(jpeg, len, out);
+    xSemaphoreGive(grayLock);
+    return ok;
+}
+
+void getEdgeOcrStats(EdgeOcrStats &out) {
+    out = stats;
+}
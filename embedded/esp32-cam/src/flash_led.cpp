@@ -0,0 +1,58 @@
+#include "flash_led.h"
+#include "config.h"
+
+static const uint32_t FLASH_DUTY_MAX = (1 << FLASH_PWM_RESOLUTION_BITS) - 1;
+
+static uint8_t intensity = FLASH_INTENSITY_PERCENT;
+static bool lit = false;
+
+static uint32_t dutyFor(uint8_t percent) {
+    return FLASH_DUTY_MAX * percent / 100;
+}
+
+void flashInit() {
+    ledcSetup(FLASH_LEDC_CHANNEL, FLASH_PWM_FREQ_HZ, FLASH_PWM_RESOLUTION_BITS);
+    ledcAttachPin(FLASH_LED_PIN, FLASH_LEDC_CHANNEL);
+    ledcWrite(FLASH_LEDC_CHANNEL, 0);
+}
+
+void flashOn() {
+    uint32_t target = dutyFor(intensity);
+    if (!lit) {
+        // Step up to the target so the supply sees a slope, not a step
+        for (int step = 1; step < FLASH_RAMP_STEPS; step++) {
+            ledcWrite(FLASH_LEDC_CHANNEL, target * step / FLASH_RAMP_STEPS);
+            delayMicroseconds(FLASH_RAMP_US / FLASH_RAMP_STEPS);
+        }
+    }
+    ledcWrite(FLASH_LEDC_CHANNEL, target);
+    lit = true;
+}
+
+void flashOff() {
+    ledcWrite(FLASH_LEDC_CHANNEL, 0);
+    lit = false;
+}
+
+bool flashIsOn() {
+    return lit;
+}
+
+void flashSetIntensity(int percent) {
+    intensity = min(max(percent, 1), 100);
+    if (lit) {
+        ledcWrite(FLASH_LEDC_CHANNEL, dutyFor(intensity));
+    }
+}
+
+uint8_t flashIntensity() {
+    return intensity;
+}
+
+void flashRelease() {
+    ledcWrite(FLASH_LEDC_CHANNEL, 0);
+    ledcDetachPin(FLASH_LED_PIN);
+    pinMode(FLASH_LED_PIN, OUTPUT);
+    digitalWrite(FLASH_LED_PIN, LOW);
+    lit = false;
+}
@@ -0,0 +1,128 @@
+#include "frame_change.h"
+#include <esp_timer.h>
+#include "config.h"
+#include "jpeg_util.h"
+
+static const int GRID_CELLS = CHANGE_GRID_COLS * CHANGE_GRID_ROWS;
+
+// Decode accumulators and the grid of the frame just checked. Static so the
+// upload task's stack stays small.
+static uint32_t cellSum[GRID_CELLS];
+static uint16_t cellCount[GRID_CELLS];
+static uint8_t candidate[GRID_CELLS];
+static uint32_t candidateTotal;
+static uint16_t candidateWidth, candidateHeight;
+static bool haveCandidate = false;
+
+// The reference lives in RTC memory so it survives deep sleep
+RTC_DATA_ATTR static uint8_t reference[GRID_CELLS];
+RTC_DATA_ATTR static uint32_t referenceTotal;
+RTC_DATA_ATTR static uint16_t referenceWidth, referenceHeight;
+RTC_DATA_ATTR static bool haveReference = false;
+static FrameChangeStats stats;
+
+struct DecodeJob {
+    uint16_t width;            // Output size at 1/8 scale, set by the decoder
+    uint16_t height;
+};
+
+// Receives decoded RGB888 blocks; each pixel is added to its grid cell
+static bool writeBlock(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    DecodeJob *job = (DecodeJob *)arg;
+    if (!data) {
+        if (x == 0 && y == 0) {  // Start of image, carries the output size
+            job->width = w;
+            job->height = h;
+        }
+        return true;
+    }
+    if (job->width == 0 || job->height == 0) {
+        return false;
+    }
+
+    for (uint16_t row = 0; row < h; row++) {
+        int cy = (y + row) * CHANGE_GRID_ROWS / job->height;
+        if (cy >= CHANGE_GRID_ROWS) {
+            break;
+        }
+        const uint8_t *px = data + (size_t)row * w * 3;
+        for (uint16_t col = 0; col < w; col++, px += 3) {
+            int cx = (x + col) * CHANGE_GRID_COLS / job->width;
+            if (cx >= CHANGE_GRID_COLS) {
+                break;
+            }
+            int cell = cy * CHANGE_GRID_COLS + cx;
+            cellSum[cell] += (px[0] + 2 * px[1] + px[2]) >> 2;
+            cellCount[cell]++;
+        }
+    }
+    return true;
+}
+
+bool frameChangeCheck(const uint8_t *jpeg, size_t len, FrameChange &out) {
+    int64_t start = esp_timer_get_time();
+    memset(cellSum, 0, sizeof(cellSum));
+    memset(cellCount, 0, sizeof(cellCount));
+
+    DecodeJob job = {0, 0};
+    bool decoded = jpegDecode(jpeg, len, JPG_SCALE_8X, writeBlock, &job);
+    out.decodeUs = esp_timer_get_time() - start;
+    out.changedCells = 0;
+    out.maxDelta = 0;
+    out.changed = true;
+
+    stats.checked++;
+    stats.lastDecodeUs = out.decodeUs;
+    if (!decoded) {
+        // Nothing to compare; upload it and start over from the next frame
+        stats.decodeFailures++;
+        haveCandidate = false;
+        return true;
+    }
+
+    candidateTotal = 0;
+    for (int i = 0; i < GRID_CELLS; i++) {
+        candidate[i] = cellCount[i] ? cellSum[i] / cellCount[i] : 0;
+        candidateTotal += candidate[i];
+    }
+    candidateWidth = job.width;
+    candidateHeight = job.height;
+    haveCandidate = true;
+
+    // A different size means the ROI changed: always a new picture
+    if (!haveReference || candidateWidth != referenceWidth || candidateHeight != referenceHeight) {
+        out.changedCells = GRID_CELLS;
+        out.maxDelta = 255;
+    } else {
+        int shift = ((int)candidateTotal - (int)referenceTotal) / GRID_CELLS;
+        for (int i = 0; i < GRID_CELLS; i++) {
+            int delta = abs((int)candidate[i] - (int)reference[i] - shift);
+            if (delta >= CHANGE_CELL_THRESHOLD) {
+                out.changedCells++;
+            }
+            if (delta > out.maxDelta) {
+                out.maxDelta = min(delta, 255);
+            }
+        }
+        out.changed = out.changedCells >= CHANGE_MIN_CELLS;
+    }
+
+    stats.lastChangedCells = out.changedCells;
+    stats.lastMaxDelta = out.maxDelta;
+    return out.changed;
+}
+
+void frameChangeAccept() {
+    haveReference = haveCandidate;
+    if (!haveCandidate) {
+        return;
+    }
+    memcpy(reference, candidate, sizeof(reference));
+    referenceTotal = candidateTotal;
+    referenceWidth = candidateWidth;
+    referenceHeight = candidateHeight;
+}
+
+void getFrameChangeStats(FrameChangeStats &out) {
+    out = stats;
+}
@@ -0,0 +1,117 @@
+#include "frame_pool.h"
+#include <esp_timer.h>
+#include "config.h"
+
+static PooledFrame slots[FRAME_POOL_SLOTS];
+static portMUX_TYPE poolMux = portMUX_INITIALIZER_UNLOCKED;
+static FramePoolStats stats;
+
+bool framePoolInit() {
+    for (int i = 0; i < FRAME_POOL_SLOTS; i++) {
+        slots[i].buf = (uint8_t *)ps_malloc(FRAME_POOL_SLOT_SIZE);
+        if (!slots[i].buf) {
+            Serial.printf("Frame pool: only %d of %d slots allocated\n", i, FRAME_POOL_SLOTS);
+            break;
+        }
+        slots[i].refs = 0;
+        stats.slots++;
+    }
+    return stats.slots > 0;
+}
+
+PooledFrame *framePoolTake(camera_fb_t *fb) {
+    if (!fb) {
+        return NULL;
+    }
+
+    if (fb->len > FRAME_POOL_SLOT_SIZE) {
+        esp_camera_fb_return(fb);
+        portENTER_CRITICAL(&poolMux);
+        stats.oversized++;
+        portEXIT_CRITICAL(&poolMux);
+        return NULL;
+    }
+
+    // Reserve a slot under the lock, copy outside it
+    PooledFrame *frame = NULL;
+    portENTER_CRITICAL(&poolMux);
+    for (int i = 0; i < stats.slots; i++) {
+        if (slots[i].refs == 0) {
+            frame = &slots[i];
+            frame->refs = 1;
+            frame->seq = ++stats.frames;
+            stats.inUse++;
+            if (stats.inUse > stats.highWater) {
+                stats.highWater = stats.inUse;
+            }
+            break;
+        }
+    }
+    if (!frame) {
+        stats.exhausted++;
+    }
+    portEXIT_CRITICAL(&poolMux);
+
+    if (!frame) {
+        esp_camera_fb_return(fb);
+        return NULL;
+    }
+
+    int64_t start = esp_timer_get_time();
+    memcpy(frame->buf, fb->buf, fb->len);
+    frame->len = fb->len;
+    frame->width = fb->width;
+    frame->height = fb->height;
+    frame->format = fb->format;
+    frame->score = -1;
+    esp_camera_fb_return(fb);
+    frame->capturedUs = esp_timer_get_time();
+    stats.copyUs = frame->capturedUs - start;
+    return frame;
+}
+
+void framePoolRetain(PooledFrame *frame) {
+    if (!frame) {
+        return;
+    }
+    portENTER_CRITICAL(&poolMux);
+    frame->refs++;
+    portEXIT_CRITICAL(&poolMux);
+}
+
+void framePoolRelease(PooledFrame *frame) {
+    if (!frame) {
+        return;
+    }
+    portENTER_CRITICAL(&poolMux);
+    if (frame->refs > 0 && --frame->refs == 0) {
+        stats.inUse--;
+    }
+    portEXIT_CRITICAL(&poolMux);
+}
+
+void framePoolExchange(PooledFrame *&slot, PooledFrame *frame) {
+    portENTER_CRITICAL(&poolMux);
+    PooledFrame *old = slot;
+    slot = frame;
+    if (old && old->refs > 0 && --old->refs == 0) {
+        stats.inUse--;
+    }
+    portEXIT_CRITICAL(&poolMux);
+}
+
+PooledFrame *framePoolGet(PooledFrame *&slot) {
+    portENTER_CRITICAL(&poolMux);
+    PooledFrame *frame = slot;
+    if (frame) {
+        frame->refs++;
+    }
+    portEXIT_CRITICAL(&poolMux);
+    return frame;
+}
+
+void getFramePoolStats(FramePoolStats &out) {
+    portENTER_CRITICAL(&poolMux);
+    out = stats;
+    portEXIT_CRITICAL(&poolMux);
+}
@@ -0,0 +1,59 @@
+#include "frame_score.h"
+#include <esp_timer.h>
+#include "config.h"
+#include "jpeg_util.h"
+
+static uint8_t *gray = NULL;
+
+bool frameScoreInit() {
+    gray = (uint8_t *)ps_malloc(BURST_GRAY_SIZE);
+    if (!gray) {
+        Serial.println("Frame score buffer allocation failed, scoring by size");
+        return false;
+    }
+    return true;
+}
+
+void frameScore(const uint8_t *jpeg, size_t len, FrameScore &out) {
+    int64_t start = esp_timer_get_time();
+    out = FrameScore();
+
+    uint16_t frameWidth = 0, frameHeight = 0;
+    if (!gray || !jpegDimensions(jpeg, len, frameWidth, frameHeight)) {
+        out.bySize = true;
+        out.score = min(len / 1024, (size_t)INT16_MAX);
+        out.decodeUs = esp_timer_get_time() - start;
+        return;
+    }
+
+    int shift = 0;
+    while (shift < JPG_SCALE_8X && (frameWidth >> shift) > BURST_MAX_GRAY_WIDTH) {
+        shift++;
+    }
+    uint16_t width = 0, height = 0;
+    if (!jpegDecodeGray(jpeg, len, (jpg_scale_t)shift, gray, BURST_GRAY_SIZE, width, height) ||
+        width < 2 || height < 2) {
+        out.decodeUs = esp_timer_get_time() - start;
+        return;
+    }
+
+    // Gradient energy drops with motion blur and defocus; blown-out pixels
+    // are where the flash reflects off the LCD cover and hides segments
+    uint64_t gradient = 0;
+    uint32_t glare = 0;
+    for (int y = 0; y < height - 1; y++) {
+        const uint8_t *row = gray + (size_t)y * width;
+        const uint8_t *next = row + width;
+        for (int x = 0; x < width - 1; x++) {
+            gradient += abs(row[x + 1] - row[x]) + abs(next[x] - row[x]);
+            if (row[x] >= BURST_GLARE_LEVEL) {
+                glare++;
+            }
+        }
+    }
+    uint32_t pixels = (uint32_t)(width - 1) * (height - 1);
+    out.sharpness = min(gradient * 10 / pixels, (uint64_t)UINT16_MAX);
+    out.glarePercent = glare * 100 / pixels;
+    out.score = min((uint32_t)out.sharpness * (100 - out.glarePercent) / 100, (uint32_t)INT16_MAX);
+    out.decodeUs = esp_timer_get_time() - start;
+}
@@ -0,0 +1,413 @@
+#include "frame_spool.h"
+#include <LittleFS.h>
+#include <time.h>
+#include <img_converters.h>
+#include "config.h"
+#include "uploader.h"
+#include "meter_regions.h"
+#include "jpeg_util.h"
+
+static const uint32_t SPOOL_MAGIC = 0x57425350;  // "WBSP"
+static const char *SPOOL_DIR = "/spool";
+static const char *BOUNDARY = "wattbox-spool";
+
+struct SpoolRecordHeader {
+    uint32_t magic;
+    uint32_t seq;
+    int64_t capturedAt;        // Unix seconds, 0 if the clock wasn't set
+    uint32_t uptimeMs;         // millis() at capture
+    uint32_t bootId;
+    uint32_t jpegLen;
+    char roi[23];
+    uint8_t scale;             // log2 of the downscale applied when stored, 0 if whole
+};
+
+static bool mounted = false;
+static uint32_t headSeq = 0;   // Oldest record still on flash
+static uint32_t nextSeq = 0;   // Sequence number of the next record
+static uint32_t bootId = 0;
+static uint8_t *chunk = NULL;  // Flash read buffer, UPLOAD_CHUNK_SIZE bytes
+static SpoolStats stats;
+
+static void recordPath(char *path, size_t size, uint32_t seq) {
+    snprintf(path, size, "%s/%08lu.bin", SPOOL_DIR, (unsigned long)seq);
+}
+
+static bool readHeader(uint32_t seq, SpoolRecordHeader &header) {
+    char path[32];
+    recordPath(path, sizeof(path), seq);
+    File f = LittleFS.open(path, "r");
+    if (!f) {
+        return false;
+    }
+    bool ok = f.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+              header.magic == SPOOL_MAGIC && header.seq == seq &&
+              f.size() == sizeof(header) + header.jpegLen;
+    f.close();
+    return ok;
+}
+
+static void removeRecord(uint32_t seq) {
+    char path[32];
+    recordPath(path, sizeof(path), seq);
+    SpoolRecordHeader header;
+    if (readHeader(seq, header)) {
+        stats.pendingBytes -= min(stats.pendingBytes, header.jpegLen);
+    }
+    if (LittleFS.remove(path) && stats.pending > 0) {
+        stats.pending--;
+    }
+}
+
+static void dropOldest() {
+    removeRecord(headSeq);
+    headSeq++;
+    stats.dropped++;
+}
+
+bool spoolInit() {
+    bootId = esp_random();
+    chunk = (uint8_t *)ps_malloc(UPLOAD_CHUNK_SIZE);
+    if (!chunk || !LittleFS.begin(true)) {
+        Serial.println("Frame spool unavailable");
+        return false;
+    }
+    LittleFS.mkdir(SPOOL_DIR);
+
+    // Recover the ring from the file names left by a previous boot
+    bool any = false;
+    File dir = LittleFS.open(SPOOL_DIR);
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+        uint32_t seq = strtoul(f.name(), NULL, 10);
+        if (!any || seq < headSeq) {
+            headSeq = seq;
+        }
+        if (!any || seq >= nextSeq) {
+            nextSeq = seq + 1;
+        }
+        any = true;
+        stats.pending++;
+        stats.pendingBytes += f.size() > sizeof(SpoolRecordHeader) ? f.size() - sizeof(SpoolRecordHeader) : 0;
+        f.close();
+    }
+    dir.close();
+
+    mounted = true;
+    Serial.printf("Frame spool: %u frames pending\n", (unsigned)stats.pending);
+    return true;
+}
+
+struct ShrinkCursor {
+    uint8_t *out;
+    size_t len;
+    bool overflow;
+};
+
+static size_t writeShrunk(void *arg, size_t index, const void *data, size_t len) {
+    ShrinkCursor *cursor = (ShrinkCursor *)arg;
+    if (index + len > SPOOL_SHRINK_OUTPUT_SIZE) {
+        cursor->overflow = true;
+        return 0;
+    }
+    memcpy(cursor->out + index, data, len);
+    cursor->len = index + len;
+    return len;
+}
+
+// Re-encode a frame wider than SPOOL_MAX_WIDTH as grayscale JPEG at the
+// first 1/2^n scale that fits. The buffers are only allocated while an
+// outage is spooling, not held for the rare case. `out` is ps_malloc()ed.
+static bool shrinkFrame(const uint8_t *buf, size_t len, uint8_t *&out, size_t &outLen,
+                        uint8_t &scale) {
+    uint16_t width = 0, height = 0;
+    if (!jpegDimensions(buf, len, width, height) || width <= SPOOL_MAX_WIDTH) {
+        return false;
+    }
+    int shift = 1;
+    while (shift < JPG_SCALE_8X && (width >> shift) > SPOOL_MAX_WIDTH) {
+        shift++;
+    }
+    size_t graySize = (size_t)(width >> shift) * (height >> shift);
+    uint8_t *gray = (uint8_t *)ps_malloc(graySize);
+    out = (uint8_t *)ps_malloc(SPOOL_SHRINK_OUTPUT_SIZE);
+    ShrinkCursor cursor = {out, 0, false};
+    bool ok = gray && out &&
+              jpegDecodeGray(buf, len, (jpg_scale_t)shift, gray, graySize, width, height) &&
+              fmt2jpg_cb(gray, (size_t)width * height, width, height, PIXFORMAT_GRAYSCALE,
+                         SPOOL_JPEG_QUALITY, writeShrunk, &cursor) &&
+              !cursor.overflow;
+    free(gray);
+    if (!ok) {
+        free(out);
+        out = NULL;
+        return false;
+    }
+    outLen = cursor.len;
+    scale = shift;
+    return true;
+}
+
+// Write one record, dropping the oldest ones to make room
+static bool storeRecord(const uint8_t *buf, size_t len, const char *roi, uint8_t scale) {
+    // Make room: frame count, byte budget and what the filesystem really has
+    while (stats.pending > 0 && headSeq < nextSeq &&
+           (stats.pending >= (uint32_t)SPOOL_MAX_FRAMES ||
+            stats.pendingBytes + len > SPOOL_MAX_BYTES ||
+            LittleFS.totalBytes() - LittleFS.usedBytes() < len + 2 * sizeof(SpoolRecordHeader))) {
+        dropOldest();
+    }
+
+    SpoolRecordHeader header = {};
+    header.magic = SPOOL_MAGIC;
+    header.seq = nextSeq;
+    time_t now = time(NULL);
+    header.capturedAt = now > 1600000000 ? now : 0;
+    header.uptimeMs = millis();
+    header.bootId = bootId;
+    header.jpegLen = len;
+    header.scale = scale;
+    strncpy(header.roi, roi ? roi : "", sizeof(header.roi) - 1);
+
+    char path[32];
+    recordPath(path, sizeof(path), nextSeq);
+    File f = LittleFS.open(path, "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = f.write((const uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+              f.write(buf, len) == len;
+    f.close();
+    if (!ok) {
+        LittleFS.remove(path);
+        return false;
+    }
+
+    if (stats.pending == 0) {
+        headSeq = nextSeq;
+    }
+    nextSeq++;
+    stats.pending++;
+    stats.pendingBytes += len;
+    stats.spooled++;
+    return true;
+}
+
+bool spoolStore(const uint8_t *buf, size_t len, const char *roi) {
+    if (!mounted) {
+        return false;
+    }
+    uint8_t *shrunk = NULL;
+    size_t shrunkLen = 0;
+    uint8_t scale = 0;
+    if (shrinkFrame(buf, len, shrunk, shrunkLen, scale)) {
+        buf = shrunk;
+        len = shrunkLen;
+        stats.shrunk++;
+    }
+    bool stored = len + sizeof(SpoolRecordHeader) <= SPOOL_MAX_BYTES && storeRecord(buf, len, roi, scale);
+    free(shrunk);
+    return stored;
+}
+
+int spoolPending() {
+    return stats.pending;
+}
+
+struct ReplayBatch {
+    int count;
+    SpoolRecordHeader headers[SPOOL_BATCH_MAX];
+    char manifest[SPOOL_BATCH_MAX * 128 + 8];
+    size_t manifestLen;
+    char meters[METER_REGIONS_MAX * 112 + 8];  // Regions to crop the frames into, if any
+    size_t metersLen;
+};
+
+static size_t framePartHead(char *buf, size_t size, uint32_t seq) {
+    return snprintf(buf, size,
+        "--%s\r\n"
+        "Content-Disposition: form-data; name=\"frames\"; filename=\"%08lu.jpg\"\r\n"
+        "Content-Type: image/jpeg\r\n"
+        "\r\n",
+        BOUNDARY, (unsigned long)seq);
+}
+
+static size_t jsonPartHead(char *buf, size_t size, const char *name) {
+    return snprintf(buf, size,
+        "--%s\r\n"
+        "Content-Disposition: form-data; name=\"%s\"\r\n"
+        "Content-Type: application/json\r\n"
+        "\r\n",
+        BOUNDARY, name);
+}
+
+static size_t closingBoundary(char *buf, size_t size) {
+    return snprintf(buf, size, "--%s--\r\n", BOUNDARY);
+}
+
+static bool writeText(WiFiClient &client, const char *text, size_t len, size_t &sent) {
+    return uploadWriteAll(client, (const uint8_t *)text, len, sent);
+}
+
+// Streams the multipart body: manifest, meter regions, then each frame read
+// from flash in UPLOAD_CHUNK_SIZE pieces, so no frame is ever held in RAM as
+// a whole
+static bool writeReplayBody(WiFiClient &client, void *ctx, size_t &sent) {
+    const ReplayBatch *batch = (const ReplayBatch *)ctx;
+    char part[160];
+
+    if (!writeText(client, part, jsonPartHead(part, sizeof(part), "manifest"), sent) ||
+        !writeText(client, batch->manifest, batch->manifestLen, sent) ||
+        !writeText(client, "\r\n", 2, sent)) {
+        return false;
+    }
+    if (batch->metersLen > 0 &&
+        (!writeText(client, part, jsonPartHead(part, sizeof(part), "meters"), sent) ||
+         !writeText(client, batch->meters, batch->metersLen, sent) ||
+         !writeText(client, "\r\n", 2, sent))) {
+        return false;
+    }
+
+    for (int i = 0; i < batch->count; i++) {
+        const SpoolRecordHeader &header = batch->headers[i];
+        if (!writeText(client, part, framePartHead(part, sizeof(part), header.seq), sent)) {
+            return false;
+        }
+
+        char path[32];
+        recordPath(path, sizeof(path), header.seq);
+        File f = LittleFS.open(path, "r");
+        if (!f || !f.seek(sizeof(SpoolRecordHeader))) {
+            return false;
+        }
+        size_t remaining = header.jpegLen;
+        while (remaining > 0) {
+            size_t n = f.read(chunk, min(UPLOAD_CHUNK_SIZE, remaining));
+            if (n == 0 || !uploadWriteAll(client, chunk, n, sent)) {
+                f.close();
+                return false;
+            }
+            remaining -= n;
+        }
+        f.close();
+
+        if (!writeText(client, "\r\n", 2, sent)) {
+            return false;
+        }
+    }
+
+    return writeText(client, part, closingBoundary(part, sizeof(part)), sent);
+}
+
+int spoolReplayBatch() {
+    if (!mounted || stats.pending == 0) {
+        return 0;
+    }
+
+    static ReplayBatch batch;
+    batch.count = 0;
+    batch.manifestLen = 1;
+    batch.manifest[0] = '[';
+
+    // Collect the oldest records, skipping any that are missing or corrupt
+    uint32_t seq = headSeq;
+    while (batch.count < SPOOL_BATCH_MAX && seq < nextSeq) {
+        SpoolRecordHeader &header = batch.headers[batch.count];
+        if (!readHeader(seq, header)) {
+            removeRecord(seq);
+            if (seq == headSeq) {
+                headSeq++;
+            }
+            seq++;
+            continue;
+        }
+
+        // `id` stays the same across retries of a record, so the backend can
+        // skip frames of a batch it processed but whose reply was lost
+        char entry[128];
+        int entryLen = snprintf(entry, sizeof(entry), "%s{\"seq\":%lu,\"id\":\"%08lx%08lx\"",
+                                batch.count ? "," : "", (unsigned long)seq,
+                                (unsigned long)header.bootId, (unsigned long)seq);
+        if (header.capturedAt > 0) {
+            entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, ",\"captured_at\":%lld",
+                                 (long long)header.capturedAt);
+        } else if (header.bootId == bootId) {
+            entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, ",\"age_ms\":%lu",
+                                 (unsigned long)(millis() - header.uptimeMs));
+        }
+        // Otherwise taken before a reboot with no clock: the time is unknown
+        if (header.roi[0]) {
+            entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, ",\"roi\":\"%s\"", header.roi);
+        }
+        if (header.scale) {
+            entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, ",\"scale\":%u", 1u << header.scale);
+        }
+        entryLen += snprintf(entry + entryLen, sizeof(entry) - entryLen, "}");
+        if (batch.manifestLen + entryLen + 2 > sizeof(batch.manifest)) {
+            break;
+        }
+        memcpy(batch.manifest + batch.manifestLen, entry, entryLen);
+        batch.manifestLen += entryLen;
+
+        batch.count++;
+        seq++;
+    }
+    batch.manifest[batch.manifestLen++] = ']';
+    batch.manifest[batch.manifestLen] = '\0';
+    if (batch.count == 0) {
+        return 0;
+    }
+
+    // Frames of a multi-meter device are cropped by the backend, with the
+    // regions as they are now
+    batch.metersLen = 0;
+    MeterRegion regions[METER_REGIONS_MAX];
+    int regionCount = getMeterRegions(regions);
+    if (regionCount > 0) {
+        batch.metersLen = meterRegionsJson(regions, regionCount, batch.meters, sizeof(batch.meters));
+    }
+
+    // Content-Length is known before anything is sent
+    char part[160];
+    size_t length = jsonPartHead(part, sizeof(part), "manifest") + batch.manifestLen + 2 +
+                    closingBoundary(part, sizeof(part));
+    if (batch.metersLen > 0) {
+        length += jsonPartHead(part, sizeof(part), "meters") + batch.metersLen + 2;
+    }
+    for (int i = 0; i < batch.count; i++) {
+        length += framePartHead(part, sizeof(part), batch.headers[i].seq) + batch.headers[i].jpegLen + 2;
+    }
+
+    char contentType[64];
+    snprintf(contentType, sizeof(contentType), "multipart/form-data; boundary=%s", BOUNDARY);
+
+    static UploadResult upload;
+    int code = uploadStreamToBackend(API_BATCH_ENDPOINT, contentType, length, writeReplayBody, &batch,
+                                     NULL, upload, SPOOL_REPLY_TIMEOUT_MS);
+    stats.batches++;
+    if (code < 200 || code >= 300) {
+        stats.batchFailures++;
+        Serial.printf("Spool replay failed: %d\n", code);
+        // A batch the backend refuses would be refused again on every retry
+        if (code >= 400 && code < 500 && code != 408 && code != 429) {
+            for (int i = 0; i < batch.count; i++) {
+                removeRecord(batch.headers[i].seq);
+            }
+            headSeq = seq;
+            stats.rejected += batch.count;
+        }
+        return -1;
+    }
+
+    for (int i = 0; i < batch.count; i++) {
+        removeRecord(batch.headers[i].seq);
+    }
+    headSeq = seq;
+    stats.replayed += batch.count;
+    Serial.printf("Spool replay: %d frames (%u bytes) in %u ms, %u pending\n", batch.count,
+                  (unsigned)length, (unsigned)(upload.latencyUs / 1000), (unsigned)stats.pending);
+    return batch.count;
+}
+
+void getSpoolStats(SpoolStats &out) {
+    out = stats;
+}
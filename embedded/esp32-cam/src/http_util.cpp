@@ -0,0 +1,24 @@
+#include "http_util.h"
+
+bool readHttpLine(WiFiClient &client, char *line, size_t size, unsigned long deadline) {
+    size_t pos = 0;
+    while (millis() < deadline) {
+        if (!client.available()) {
+            if (!client.connected()) {
+                break;
+            }
+            delay(1);
+            continue;
+        }
+        int c = client.read();
+        if (c == '\n') {
+            line[pos] = '\0';
+            return true;
+        }
+        if (c != '\r' && pos < size - 1) {
+            line[pos++] = (char)c;
+        }
+    }
+    line[pos] = '\0';
+    return false;
+}
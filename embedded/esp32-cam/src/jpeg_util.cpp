@@ -0,0 +1,160 @@
+#include "jpeg_util.h"
+
+static SemaphoreHandle_t decodeMutex = NULL;
+
+void jpegUtilInit() {
+    decodeMutex = xSemaphoreCreateMutex();
+}
+
+// esp_jpg_decode() with the decoder to ourselves
+static bool lockedDecode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer,
+                         void *arg) {
+    xSemaphoreTake(decodeMutex, portMAX_DELAY);
+    bool ok = esp_jpg_decode(len, scale, reader, writer, arg) == ESP_OK;
+    xSemaphoreGive(decodeMutex);
+    return ok;
+}
+
+bool jpegDimensions(const uint8_t *buf, size_t len, uint16_t &width, uint16_t &height) {
+    if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) {
+        return false;
+    }
+
+    // Walk marker segments until a start-of-frame (SOF0..SOF15 except DHT,
+    // JPG and DAC, which share the range)
+    size_t pos = 2;
+    while (pos + 9 < len) {
+        if (buf[pos] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = buf[pos + 1];
+        if (marker == 0xFF) {
+            pos++;  // Fill byte
+            continue;
+        }
+        uint16_t segmentLen = (buf[pos + 2] << 8) | buf[pos + 3];
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            height = (buf[pos + 5] << 8) | buf[pos + 6];
+            width = (buf[pos + 7] << 8) | buf[pos + 8];
+            return true;
+        }
+        if (marker == 0xDA) {
+            return false;  // Start of scan without a frame header
+        }
+        pos += 2 + segmentLen;
+    }
+    return false;
+}
+
+struct GrayJob {
+    const uint8_t *jpeg;
+    size_t len;
+    uint8_t *out;
+    size_t outSize;
+    uint16_t width;
+    uint16_t height;
+};
+
+static size_t readJpeg(void *arg, size_t index, uint8_t *buf, size_t len) {
+    const GrayJob *job = (const GrayJob *)arg;
+    if (index >= job->len) {
+        return 0;
+    }
+    len = min(len, job->len - index);
+    if (buf) {
+        memcpy(buf, job->jpeg + index, len);
+    }
+    return len;
+}
+
+// Receives decoded RGB888 blocks and stores their luma
+static bool writeGray(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    GrayJob *job = (GrayJob *)arg;
+    if (!data) {
+        if (x == 0 && y == 0) {  // Start of image, carries the output size
+            job->width = w;
+            job->height = h;
+            return (size_t)w * h <= job->outSize;
+        }
+        return true;
+    }
+
+    for (uint16_t row = 0; row < h && y + row < job->height; row++) {
+        const uint8_t *px = data + (size_t)row * w * 3;
+        uint8_t *dst = job->out + (size_t)(y + row) * job->width + x;
+        for (uint16_t col = 0; col < w && x + col < job->width; col++, px += 3) {
+            dst[col] = (px[0] + 2 * px[1] + px[2]) >> 2;
+        }
+    }
+    return true;
+}
+
+bool jpegDecodeGray(const uint8_t *jpeg, size_t len, jpg_scale_t scale,
+                    uint8_t *out, size_t outSize, uint16_t &width, uint16_t &height) {
+    GrayJob job = {jpeg, len, out, outSize, 0, 0};
+    if (!lockedDecode(len, scale, readJpeg, writeGray, &job) || job.width == 0) {
+        return false;
+    }
+    width = job.width;
+    height = job.height;
+    return true;
+}
+
+struct CropJob {
+    GrayJob source;            // Only the input fields are used
+    GrayCrop *crops;
+    int count;
+};
+
+// Stores the luma of the part of each block that falls into a crop
+static bool writeCrops(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    CropJob *job = (CropJob *)arg;
+    if (!data) {
+        if (x == 0 && y == 0) {  // Start of image, carries the image size
+            for (int i = 0; i < job->count; i++) {
+                const GrayCrop &crop = job->crops[i];
+                if (crop.x + crop.width > w || crop.y + crop.height > h) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    for (int i = 0; i < job->count; i++) {
+        const GrayCrop &crop = job->crops[i];
+        int left = max((int)x, (int)crop.x);
+        int right = min(x + w, crop.x + crop.width);
+        int top = max((int)y, (int)crop.y);
+        int bottom = min(y + h, crop.y + crop.height);
+        for (int row = top; row < bottom; row++) {
+            const uint8_t *px = data + ((size_t)(row - y) * w + (left - x)) * 3;
+            uint8_t *dst = crop.out + (size_t)(row - crop.y) * crop.width + (left - crop.x);
+            for (int col = left; col < right; col++, px += 3) {
+                *dst++ = (px[0] + 2 * px[1] + px[2]) >> 2;
+            }
+        }
+    }
+    return true;
+}
+
+bool jpegDecodeGrayCrops(const uint8_t *jpeg, size_t len, GrayCrop *crops, int count) {
+    CropJob job = {{jpeg, len, NULL, 0, 0, 0}, crops, count};
+    return lockedDecode(len, JPG_SCALE_NONE, readJpeg, writeCrops, &job);
+}
+
+struct BlockJob {
+    GrayJob source;            // Only the input fields are used
+    jpg_writer_cb writer;
+    void *arg;
+};
+
+static bool writeBlock(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    const BlockJob *job = (const BlockJob *)arg;
+    return job->writer(job->arg, x, y, w, h, data);
+}
+
+bool jpegDecode(const uint8_t *jpeg, size_t len, jpg_scale_t scale, jpg_writer_cb writer, void *arg) {
+    BlockJob job = {{jpeg, len, NULL, 0, 0, 0}, writer, arg};
+    return lockedDecode(len, scale, readJpeg, writeBlock, &job);
+}
@@ -1,110 +1,35 @@
 #include <Arduino.h>
 #include <WiFi.h>
-#include <WebServer.h>
 #include <esp_camera.h>
-#include <HTTPClient.h>
+#include <esp_timer.h>
 #include <ArduinoJson.h>
 #include "config.h"
+#include "index_html_gz.h"  // web/index.html, generated by scripts/embed_web.py
+#include "uploader.h"
+#include "stream_server.h"
+#include "control_server.h"
+#include "request_arena.h"
+#include "camera_profiles.h"
+#include "capture_pipeline.h"
+#include "frame_spool.h"
+#include "frame_pool.h"
+#include "camera_capture.h"
+#include "frame_score.h"
+#include "frame_change.h"
+#include "edge_ocr.h"
+#include "ocr_bitmap.h"
+#include "metrics.h"
+#include "wifi_link.h"
+#include "duty_cycle.h"
+#include "backend_channel.h"
+#include "flash_led.h"
+#include "thumbnail.h"
+#include "meter_regions.h"
+#include "trace.h"
+#include "ota_update.h"
+#include "jpeg_util.h"
 
-WebServer server(WEB_SERVER_PORT);
-
-// HTML page for web interface
-const char index_html[] PROGMEM = R"rawliteral(
-<!DOCTYPE HTML>
-<html>
-<head>
-    <title>ESP32-CAM WattBox Meter Reader</title>
-    <meta name="viewport" content="width=device-width, initial-scale=1">
-    <style>
-        body { font-family: Arial; text-align: center; margin: 0; padding: 20px; background: #f4f4f4; }
-        .container { max-width: 800px; margin: 0 auto; background: white; padding: 20px; border-radius: 10px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }
-        h1 { color: #333; }
-        img { max-width: 100%; height: auto; border: 2px solid #ddd; border-radius: 5px; }
-        button { background-color: #4CAF50; color: white; padding: 12px 24px; border: none; border-radius: 4px; cursor: pointer; font-size: 16px; margin: 10px; }
-        button:hover { background-color: #45a049; }
-        .status { margin: 20px 0; padding: 10px; background: #e8f5e9; border-radius: 5px; }
-        .error { background: #ffebee; color: #c62828; }
-        .success { background: #e8f5e9; color: #2e7d32; }
-    </style>
-</head>
-<body>
-    <div class="container">
-        <h1>WattBox ESP32-CAM Meter Reader</h1>
-        <p>Device: <strong>%DEVICE_NAME%</strong></p>
-        <div id="status" class="status">Ready</div>
-        
-        <h2>Live Stream</h2>
-        <img src="" id="stream">
-        
-        <div>
-            <button onclick="startStream()">Start Stream</button>
-            <button onclick="stopStream()">Stop Stream</button>
-            <button onclick="captureImage()">Capture & Send</button>
-            <button onclick="toggleFlash()">Toggle Flash</button>
-        </div>
-        
-        <h3>Captured Image</h3>
-        <img src="" id="captured" style="display:none;">
-    </div>
-    
-    <script>
-        const streamUrl = window.location.hostname;
-        
-        function startStream() {
-            document.getElementById('stream').src = '/stream';
-            updateStatus('Streaming...', 'success');
-        }
-        
-        function stopStream() {
-            document.getElementById('stream').src = '';
-            updateStatus('Stream stopped', '');
-        }
-        
-        function captureImage() {
-            updateStatus('Capturing image...', '');
-            fetch('/capture')
-                .then(response => response.blob())
-                .then(blob => {
-                    const url = URL.createObjectURL(blob);
-                    document.getElementById('captured').src = url;
-                    document.getElementById('captured').style.display = 'block';
-                    updateStatus('Image captured! Sending to backend...', 'success');
-                    sendToBackend();
-                })
-                .catch(err => updateStatus('Capture failed: ' + err, 'error'));
-        }
-        
-        function sendToBackend() {
-            fetch('/send_to_api')
-                .then(response => response.json())
-                .then(data => {
-                    if(data.success) {
-                        updateStatus('Image sent to backend successfully!', 'success');
-                    } else {
-                        updateStatus('Failed to send: ' + data.error, 'error');
-                    }
-                })
-                .catch(err => updateStatus('API error: ' + err, 'error'));
-        }
-        
-        function toggleFlash() {
-            fetch('/flash')
-                .then(response => response.text())
-                .then(state => updateStatus('Flash: ' + state, ''));
-        }
-        
-        function updateStatus(message, type) {
-            const status = document.getElementById('status');
-            status.textContent = message;
-            status.className = 'status ' + type;
-        }
-    </script>
-</body>
-</html>
-)rawliteral";
-
-camera_fb_t * captured_fb = NULL;
-bool flashState = false;
+unsigned long bootCameraMs = 0;       // initCamera() time, reported by /info
 
 // Initialize camera with AI-Thinker ESP32-CAM settings
 bool initCamera() {
@@ -129,9 +54,10 @@ bool initCamera() {
     config.pin_reset = RESET_GPIO_NUM;
     config.xclk_freq_hz = 20000000;
     config.pixel_format = PIXFORMAT_JPEG;
-    config.frame_size = FRAMESIZE_UXGA;  // 1600x1200 for high quality capture
-    config.jpeg_quality = 10;
-    config.fb_count = 2;
+    // Buffers are sized for the reading profile; preview only shrinks frames
+    config.frame_size = READING_FRAME_SIZE;
+    config.jpeg_quality = cameraProfile(PROFILE_READING).jpegQuality;
+    config.fb_count = CAMERA_FB_COUNT;
 
     // Camera init
     esp_err_t err = esp_camera_init(&config);
@@ -145,7 +71,7 @@ bool initCamera() {
     s->set_brightness(s, 1);      // -2 to 2 (increased for indoor)
     s->set_contrast(s, 0);        // -2 to 2
     s->set_saturation(s, 0);      // -2 to 2
-    s->set_special_effect(s, 0);  // 0 to 6 (0 - No Effect)
+    s->set_special_effect(s, cameraProfile(PROFILE_READING).grayscale ? 2 : 0);  // 0 to 6 (0 - No Effect, 2 - Grayscale)
     s->set_whitebal(s, 1);        // 0 = disable , 1 = enable
     s->set_awb_gain(s, 1);        // 0 = disable , 1 = enable
     s->set_wb_mode(s, 0);         // 0 to 4 - if awb_gain enabled (0 - Auto)
@@ -165,123 +91,195 @@ bool initCamera() {
     s->set_dcw(s, 1);             // 0 = disable , 1 = enable
     s->set_colorbar(s, 0);        // 0 = disable , 1 = enable
 
+    cameraProfilesInit(PROFILE_READING);
     return true;
 }
 
-// Connect to WiFi network
-void connectWiFi() {
-    Serial.print("Connecting to WiFi: ");
-    Serial.println(WIFI_SSID);
-    
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-    
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 30) {
-        delay(500);
-        Serial.print(".");
-        attempts++;
-    }
-    
-    if (WiFi.status() == WL_CONNECTED) {
-        Serial.println("\nWiFi Connected!");
+// Wait for the association started by wifiBegin() and log the outcome
+void reportWiFi() {
+    if (wifiWaitConnected(WIFI_CONNECT_TIMEOUT_MS)) {
+        WifiLinkStats link;
+        getWifiLinkStats(link);
+        Serial.printf("WiFi Connected in %u ms%s\n", (unsigned)link.lastConnectMs,
+                      link.fastPath ? " (cached network)" : "");
         Serial.print("IP Address: ");
         Serial.println(WiFi.localIP());
         Serial.print("Camera Ready! Use 'http://");
         Serial.print(WiFi.localIP());
         Serial.println("' to connect");
     } else {
-        Serial.println("\nWiFi Connection Failed!");
+        Serial.println("WiFi Connection Failed! Retrying in the background");
     }
 }
 
-// Handle root page request
-void handleRoot() {
-    String html = String(index_html);
-    html.replace("%DEVICE_NAME%", DEVICE_NAME);
-    server.send(200, "text/html", html);
+// Handle root page request - the page is served gzipped straight from flash;
+// browsers revalidate with the ETag and usually get a 304
+void handleRoot(HttpRequest &req) {
+    if (req.header("If-None-Match") == INDEX_HTML_ETAG) {
+        req.send(304);
+        return;
+    }
+    req.sendHeader("Content-Encoding", "gzip");
+    req.sendHeader("Cache-Control", "no-cache");
+    req.sendHeader("ETag", INDEX_HTML_ETAG);
+    req.send(200, "text/html", (const char *)index_html_gz, sizeof(index_html_gz));
 }
 
-// Handle image capture
-void handleCapture() {
-    // Release previous frame buffer if exists
-    if (captured_fb) {
-        esp_camera_fb_return(captured_fb);
-        captured_fb = NULL;
+// Device identity for the web UI
+void handleInfo(HttpRequest &req) {
+    JsonDocument response(requestArena());
+    response["name"] = DEVICE_NAME;
+    response["id"] = DEVICE_ID;
+    
+    // How long this boot took to become useful
+    WifiLinkStats link;
+    getWifiLinkStats(link);
+    PipelineStats pipeline;
+    getPipelineStats(pipeline);
+    JsonObject boot = response["boot"].to<JsonObject>();
+    boot["cameraMs"] = bootCameraMs;
+    boot["wifiMs"] = link.lastConnectMs;
+    boot["fastWifi"] = link.fastPath;
+    if (pipeline.firstReadingMs) {
+        boot["firstReadingMs"] = pipeline.firstReadingMs;
     }
+    
+    req.sendJson(200, response);
+}
 
-    // Turn flash ON
-    if (USE_FLASH_FOR_CAPTURE) {
-        digitalWrite(FLASH_LED_PIN, HIGH);
-    }
+// Handle image capture
+void handleCapture(HttpRequest &req) {
+    metricRequest(REQUEST_CAPTURE);
+    CaptureInfo info;
+    PooledFrame *frame = captureReading(info);
 
-    // Capture 3 warmup frames - let auto-exposure adjust to flash
-    for(int i = 0; i < 3; i++) {
-        camera_fb_t *warmup = esp_camera_fb_get();
-        if (warmup) {
-            esp_camera_fb_return(warmup);
-        }
-        delay(50);  // Small delay between frames
+    if (!frame) {
+        Serial.println("Camera capture failed");
+        req.send(500, "text/plain", "Camera capture failed");
+        return;
     }
 
-    // NOW capture the real frame with adjusted exposure
-    captured_fb = esp_camera_fb_get();
+    Serial.printf("Captured %u bytes: %d warm-up frames%s, best of %d (score %d), %u ms\n",
+                  (unsigned)frame->len, info.warmupFrames, info.settled ? "" : " (not settled)",
+                  info.burstFrames, info.score, (unsigned)(info.totalUs / 1000));
 
-    // Turn flash OFF
-    if (USE_FLASH_FOR_CAPTURE) {
-        digitalWrite(FLASH_LED_PIN, LOW);
-    }
+    req.sendHeader("X-Warmup-Frames", info.warmupFrames);
+    req.sendHeader("X-Capture-Ms", (long)(info.totalUs / 1000));
+    req.sendHeader("X-Burst-Frames", info.burstFrames);
+    req.sendHeader("X-Frame-Score", info.score);
+    req.send(200, "image/jpeg", (const char *)frame->buf, frame->len);
+    framePoolRelease(frame);
+}
 
-    if (!captured_fb) {
-        Serial.println("Camera capture failed");
-        server.send(500, "text/plain", "Camera capture failed");
+// Last reading frame without a new exposure while it is younger than
+// SNAPSHOT_MAX_AGE_MS (or ?max_age=, in ms). The ETag names the frame, so a
+// poller sending If-None-Match gets a 304 until there is a newer one.
+void handleSnapshot(HttpRequest &req) {
+    metricRequest(REQUEST_SNAPSHOT);
+    uint32_t maxAgeMs = req.hasArg("max_age") ? strtoul(req.arg("max_age").c_str(), NULL, 10)
+                                              : SNAPSHOT_MAX_AGE_MS;
+    PooledFrame *frame = captureSnapshot(maxAgeMs);
+    if (!frame) {
+        req.send(500, "text/plain", "Camera capture failed");
         return;
     }
 
-    server.send_P(200, "image/jpeg", (const char *)captured_fb->buf, captured_fb->len);
+    // Sequence numbers restart at boot; the capture time tells boots apart
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)frame->seq,
+             (unsigned long)(frame->capturedUs & 0xFFFFFFFF));
+    long ageMs = (esp_timer_get_time() - frame->capturedUs) / 1000;
+    req.sendHeader("ETag", etag);
+    req.sendHeader("Cache-Control", "no-cache");
+    req.sendHeader("X-Frame-Age-Ms", ageMs);
+    if (strstr(req.header("If-None-Match").c_str(), etag)) {
+        req.send(304);
+    } else {
+        req.sendHeader("X-Frame-Score", frame->score);
+        req.send(200, "image/jpeg", (const char *)frame->buf, frame->len);
+    }
+    framePoolRelease(frame);
 }
 
-// Handle flash toggle
-void handleFlash() {
-    flashState = !flashState;
-    digitalWrite(FLASH_LED_PIN, flashState ? HIGH : LOW);
-    server.send(200, "text/plain", flashState ? "ON" : "OFF");
+// Full frame behind a thumbnail upload: /frame?seq=N, while it is still kept
+void handleFrame(HttpRequest &req) {
+    PooledFrame *frame = NULL;
+    if (req.hasArg("seq")) {
+        frame = thumbnailFullFrame(strtoul(req.arg("seq").c_str(), NULL, 10));
+    }
+    if (!frame) {
+        req.send(404, "text/plain", "Frame not kept");
+        return;
+    }
+    req.sendHeader("X-Frame-Seq", (long)frame->seq);
+    req.send(200, "image/jpeg", (const char *)frame->buf, frame->len);
+    framePoolRelease(frame);
+}
+
+// Handle flash toggle; /flash?intensity=40 sets the brightness (percent)
+// for captures and the toggle instead
+void handleFlash(HttpRequest &req) {
+    if (req.hasArg("intensity")) {
+        String value = req.arg("intensity");
+        char *end = NULL;
+        long percent = strtol(value.c_str(), &end, 10);
+        if (value.length() == 0 || *end != '\0') {
+            req.send(400, "text/plain", "Intensity must be a number");
+            return;
+        }
+        flashSetIntensity(min(max(percent, 1L), 100L));
+        char text[8];
+        snprintf(text, sizeof(text), "%u%%", flashIntensity());
+        req.send(200, "text/plain", text);
+        return;
+    }
+    if (flashIsOn()) {
+        flashOff();
+    } else {
+        flashOn();
+    }
+    req.send(200, "text/plain", flashIsOn() ? "ON" : "OFF");
 }
 
 // Send captured image to backend API
-void handleSendToAPI() {
-    JsonDocument response;
+void handleSendToAPI(HttpRequest &req) {
+    metricRequest(REQUEST_SEND_TO_API);
+    JsonDocument response(requestArena());
     
-    if (!captured_fb) {
+    PooledFrame *frame = lastReading();
+    if (!frame) {
         response["success"] = false;
         response["error"] = "No image captured";
-        String jsonStr;
-        serializeJson(response, jsonStr);
-        server.send(400, "application/json", jsonStr);
+        req.sendJson(400, response);
         return;
     }
     
-    // Create HTTP client
-    HTTPClient http;
-    String url = String("http://") + API_HOST + ":" + String(API_PORT) + API_ENDPOINT;
-    
-    http.begin(url);
-    http.addHeader("Content-Type", "image/jpeg");
-    http.addHeader("X-Device-ID", DEVICE_ID);
-    http.addHeader("X-Device-Name", DEVICE_NAME);
+    Serial.printf("Sending image to: http://%s:%d%s (%u bytes)\n",
+                  API_HOST, API_PORT, API_ENDPOINT, (unsigned)frame->len);
     
-    Serial.print("Sending image to: ");
-    Serial.println(url);
+    // Tell the backend the frame is already cropped to the LCD, and how sharp it is
+    char extraHeaders[96];
+    cameraFrameHeaders(extraHeaders, sizeof(extraHeaders));
+    captureScoreHeader(frame, extraHeaders, sizeof(extraHeaders));
     
-    int httpResponseCode = http.POST(captured_fb->buf, captured_fb->len);
+    // Streams straight from the frame buffer, keeps only the head of the reply
+    static UploadResult upload;
+    int httpResponseCode = uploadToBackend(frame->buf, frame->len, "image/jpeg",
+                                           extraHeaders, upload);
+    framePoolRelease(frame);
     
     if (httpResponseCode > 0) {
-        String payload = http.getString();
         Serial.print("Response: ");
-        Serial.println(payload);
+        Serial.println(upload.response);
         
         response["success"] = true;
         response["statusCode"] = httpResponseCode;
-        response["response"] = payload;
+        response["latencyMs"] = upload.latencyUs / 1000.0f;
+        response["reused"] = upload.reusedConnection;
+        response["response"] = (const char *)upload.response;
+        if (upload.responseTruncated) {
+            response["truncated"] = true;
+        }
     } else {
         Serial.print("Error sending image: ");
         Serial.println(httpResponseCode);
@@ -291,123 +289,492 @@ void handleSendToAPI() {
         response["code"] = httpResponseCode;
     }
     
-    http.end();
+    req.sendJson(200, response);
+}
+
+// Stream lives on its own port so it never blocks this server; keep /stream
+// working for existing links by redirecting there
+void handleStream(HttpRequest &req) {
+    metricRequest(REQUEST_STREAM);
+    IPAddress ip = WiFi.localIP();
+    char location[48];
+    snprintf(location, sizeof(location), "http://%u.%u.%u.%u:%d/stream", ip[0], ip[1], ip[2], ip[3],
+             STREAM_SERVER_PORT);
+    req.sendHeader("Location", location);
+    req.send(302, "text/plain", "");
+}
+
+// Report stream pacing statistics
+void handleStreamStats(HttpRequest &req) {
+    StreamStats stats;
+    getStreamStats(stats);
+    
+    JsonDocument response(requestArena());
+    response["viewers"] = stats.viewers;
+    response["targetFps"] = STREAM_TARGET_FPS;
+    response["achievedFps"] = stats.achievedFps;
+    response["framesSent"] = stats.framesSent;
+    response["framesDropped"] = stats.framesDropped;
+    response["slowViewers"] = stats.slowViewers;
+    response["captureMs"] = stats.captureUs / 1000.0f;
+    response["sendMs"] = stats.sendUs / 1000.0f;
+    
+    req.sendJson(200, response);
+}
+
+// Report backend connection reuse and upload latency
+void handleUploadStats(HttpRequest &req) {
+    UploadStats stats;
+    getUploadStats(stats);
+    
+    JsonDocument response(requestArena());
+    response["requests"] = stats.requests;
+    response["failures"] = stats.failures;
+    response["connects"] = stats.connects;
+    response["reused"] = stats.reused;
+    response["staleRetries"] = stats.staleRetries;
+    response["lastLatencyMs"] = stats.lastLatencyUs / 1000.0f;
+    response["avgLatencyMs"] = stats.avgLatencyUs / 1000.0f;
+    response["connected"] = stats.connected;
+    
+    req.sendJson(200, response);
+}
+
+// Report the backend channel's connection and the commands it carried
+void handleChannelStats(HttpRequest &req) {
+    ChannelStats stats;
+    getChannelStats(stats);
+    
+    JsonDocument response(requestArena());
+    response["enabled"] = CHANNEL_ENABLED;
+    response["connected"] = stats.connected;
+    response["connects"] = stats.connects;
+    response["failures"] = stats.failures;
+    response["disconnects"] = stats.disconnects;
+    response["commands"] = stats.commands;
+    response["framesSent"] = stats.framesSent;
+    response["metricsSent"] = stats.metricsSent;
+    response["lastCaptureMs"] = stats.lastCaptureMs;
+    response["backoffMs"] = stats.backoffMs;
+    
+    req.sendJson(200, response);
+}
+
+// Report auto-capture pipeline progress
+void handlePipelineStats(HttpRequest &req) {
+    PipelineStats stats;
+    getPipelineStats(stats);
+    
+    JsonDocument response(requestArena());
+    response["enabled"] = AUTO_CAPTURE_ENABLED;
+    response["captured"] = stats.captured;
+    response["captureFailures"] = stats.captureFailures;
+    response["skipped"] = stats.skipped;
+    response["uploaded"] = stats.uploaded;
+    response["unchanged"] = stats.unchanged;
+    response["heartbeats"] = stats.heartbeats;
+    response["edgeReadings"] = stats.edgeReadings;
+    response["uploadFailures"] = stats.uploadFailures;
+    response["queued"] = stats.queued;
+    response["queueHighWater"] = stats.queueHighWater;
+    response["lastUploadMs"] = stats.lastUploadUs / 1000.0f;
+    response["intervalMs"] = stats.intervalMs;
+    response["intervalChanges"] = stats.intervalChanges;
+    
+    ThumbnailStats thumb;
+    getThumbnailStats(thumb);
+    JsonObject thumbJson = response["thumbnail"].to<JsonObject>();
+    thumbJson["enabled"] = THUMBNAIL_UPLOAD_ENABLED;
+    thumbJson["encoded"] = thumb.encoded;
+    thumbJson["failures"] = thumb.failures;
+    thumbJson["lastWidth"] = thumb.lastWidth;
+    thumbJson["lastHeight"] = thumb.lastHeight;
+    thumbJson["lastBytes"] = thumb.lastBytes;
+    thumbJson["lastFullBytes"] = thumb.lastFullBytes;
+    thumbJson["lastMs"] = thumb.lastUs / 1000.0f;
+    thumbJson["kept"] = thumb.kept;
+    thumbJson["fetched"] = thumb.fetched;
+    thumbJson["misses"] = thumb.misses;
+    
+    SpoolStats spool;
+    getSpoolStats(spool);
+    JsonObject spoolJson = response["spool"].to<JsonObject>();
+    spoolJson["pending"] = spool.pending;
+    spoolJson["pendingBytes"] = spool.pendingBytes;
+    spoolJson["spooled"] = spool.spooled;
+    spoolJson["replayed"] = spool.replayed;
+    spoolJson["dropped"] = spool.dropped;
+    spoolJson["rejected"] = spool.rejected;
+    spoolJson["shrunk"] = spool.shrunk;
+    spoolJson["batches"] = spool.batches;
+    spoolJson["batchFailures"] = spool.batchFailures;
+    
+    OcrBitmapStats bitmap;
+    getOcrBitmapStats(bitmap);
+    JsonObject bitmapJson = response["bitmap"].to<JsonObject>();
+    bitmapJson["encoded"] = bitmap.encoded;
+    bitmapJson["failures"] = bitmap.failures;
+    bitmapJson["lastWidth"] = bitmap.lastWidth;
+    bitmapJson["lastHeight"] = bitmap.lastHeight;
+    bitmapJson["lastThreshold"] = bitmap.lastThreshold;
+    bitmapJson["lastBytes"] = bitmap.lastBytes;
+    bitmapJson["lastMs"] = bitmap.lastUs / 1000.0f;
     
-    String jsonStr;
-    serializeJson(response, jsonStr);
-    server.send(200, "application/json", jsonStr);
+    FrameChangeStats change;
+    getFrameChangeStats(change);
+    JsonObject changeJson = response["change"].to<JsonObject>();
+    changeJson["enabled"] = CHANGE_DETECTION_ENABLED;
+    changeJson["checked"] = change.checked;
+    changeJson["decodeFailures"] = change.decodeFailures;
+    changeJson["lastChangedCells"] = change.lastChangedCells;
+    changeJson["lastMaxDelta"] = change.lastMaxDelta;
+    changeJson["lastDecodeMs"] = change.lastDecodeUs / 1000.0f;
+    
+    req.sendJson(200, response);
 }
 
-// Handle stream endpoint
-void handleStream() {
-    WiFiClient client = server.client();
+// Report frame pool occupancy, for sizing FRAME_POOL_SLOTS and CAMERA_FB_COUNT
+void handleFramePool(HttpRequest &req) {
+    FramePoolStats stats;
+    getFramePoolStats(stats);
+    
+    JsonDocument response(requestArena());
+    response["slots"] = stats.slots;
+    response["inUse"] = stats.inUse;
+    response["highWater"] = stats.highWater;
+    response["frames"] = stats.frames;
+    response["exhausted"] = stats.exhausted;
+    response["oversized"] = stats.oversized;
+    response["copyMs"] = stats.copyUs / 1000.0f;
+    response["driverBuffers"] = CAMERA_FB_COUNT;
     
-    String response = "HTTP/1.1 200 OK\r\n";
-    response += "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
-    client.print(response);
+    req.sendJson(200, response);
+}
+
+// Report warm-up and capture latency
+void handleCaptureStats(HttpRequest &req) {
+    CaptureStats stats;
+    getCaptureStats(stats);
     
-    Serial.println("Stream started");
+    JsonDocument response(requestArena());
+    response["captures"] = stats.captures;
+    response["failures"] = stats.failures;
+    response["unsettled"] = stats.unsettled;
+    response["lastWarmupFrames"] = stats.last.warmupFrames;
+    response["lastWarmupMs"] = stats.last.warmupUs / 1000.0f;
+    response["lastFlashOnMs"] = stats.last.flashOnUs / 1000.0f;
+    response["lastCaptureMs"] = stats.last.totalUs / 1000.0f;
+    response["avgCaptureMs"] = stats.avgTotalUs / 1000.0f;
+    response["avgWarmupFrames"] = stats.avgWarmupFrames / 16.0f;
+    response["lastBurstFrames"] = stats.last.burstFrames;
+    response["lastBestFrame"] = stats.last.bestFrame;
+    response["lastScore"] = stats.last.score;
+    response["lastScoreMs"] = stats.last.scoreUs / 1000.0f;
+    response["snapshotsCached"] = stats.snapshotsCached;
+    response["snapshotsExposed"] = stats.snapshotsExposed;
     
-    while (client.connected()) {
-        camera_fb_t *fb = esp_camera_fb_get();
-        if (!fb) {
-            Serial.println("Camera capture failed during stream");
-            delay(100);
-            continue;
+    req.sendJson(200, response);
+}
+
+// Report the active sensor profile and what switching between profiles costs
+void handleCameraProfile(HttpRequest &req) {
+    CameraProfileStats stats;
+    getCameraProfileStats(stats);
+    
+    JsonDocument response(requestArena());
+    response["profile"] = cameraProfile(stats.active).name;
+    response["switches"] = stats.switches;
+    response["lastSwitchMs"] = stats.lastSwitchUs / 1000.0f;
+    response["maxSwitchMs"] = stats.maxSwitchUs / 1000.0f;
+    response["staleFrames"] = stats.staleFrames;
+    
+    req.sendJson(200, response);
+}
+
+// Get or set the LCD region of interest: /roi?x=&y=&w=&h= enables it,
+// /roi?enabled=0 turns it off, no arguments just reports it
+void handleRoi(HttpRequest &req) {
+    CameraRoi roi;
+    cameraGetRoi(roi);
+    
+    if (req.hasArg("enabled") || req.hasArg("x")) {
+        roi.enabled = !req.hasArg("enabled") || req.arg("enabled").toInt() != 0;
+        if (req.hasArg("x")) roi.x = req.arg("x").toInt();
+        if (req.hasArg("y")) roi.y = req.arg("y").toInt();
+        if (req.hasArg("w")) roi.width = req.arg("w").toInt();
+        if (req.hasArg("h")) roi.height = req.arg("h").toInt();
+        if (!cameraSetRoi(roi)) {
+            req.send(400, "text/plain", "ROI outside the reading frame");
+            return;
         }
-        
-        client.print("--frame\r\n");
-        client.print("Content-Type: image/jpeg\r\n\r\n");
-        
-        size_t sent = 0;
-        size_t chunkSize = 1024;
-        while (sent < fb->len) {
-            size_t toSend = min(chunkSize, fb->len - sent);
-            size_t written = client.write(fb->buf + sent, toSend);
-            if (written == 0) {
-                break;
-            }
-            sent += written;
+    }
+    
+    JsonDocument response(requestArena());
+    response["enabled"] = roi.enabled;
+    response["x"] = roi.x;
+    response["y"] = roi.y;
+    response["w"] = roi.width;
+    response["h"] = roi.height;
+    
+    req.sendJson(200, response);
+}
+
+// Meters in view: /meters?name=gas&meter=site1-gas&x=&y=&w=&h= adds a
+// region (or replaces the one of that name), /meters?remove=gas drops it,
+// no arguments just lists them
+void handleMeters(HttpRequest &req) {
+    if (req.hasArg("remove")) {
+        if (!meterRegionRemove(req.arg("remove").c_str())) {
+            req.send(404, "text/plain", "No such region");
+            return;
         }
-        
-        client.print("\r\n");
-        
-        esp_camera_fb_return(fb);
-        
-        // Small delay to control frame rate
-        delay(33); // ~30 FPS
+    } else if (req.hasArg("name")) {
+        MeterRegion region = {};
+        strncpy(region.name, req.arg("name").c_str(), sizeof(region.name) - 1);
+        strncpy(region.meter, req.arg("meter").c_str(), sizeof(region.meter) - 1);
+        region.x = req.arg("x").toInt();
+        region.y = req.arg("y").toInt();
+        region.width = req.arg("w").toInt();
+        region.height = req.arg("h").toInt();
+        if (req.arg("name").length() > METER_NAME_MAX || req.arg("meter").length() > METER_ID_MAX ||
+            !meterRegionSet(region)) {
+            req.send(400, "text/plain", "Invalid region");
+            return;
+        }
+    }
+    
+    MeterRegion regions[METER_REGIONS_MAX];
+    int count = getMeterRegions(regions);
+    MeterRegionStats stats;
+    getMeterRegionStats(stats);
+    
+    JsonDocument response(requestArena());
+    JsonArray list = response["regions"].to<JsonArray>();
+    for (int i = 0; i < count; i++) {
+        JsonObject entry = list.add<JsonObject>();
+        entry["name"] = regions[i].name;
+        entry["meter"] = regions[i].meter;
+        entry["x"] = regions[i].x;
+        entry["y"] = regions[i].y;
+        entry["w"] = regions[i].width;
+        entry["h"] = regions[i].height;
+    }
+    response["encoded"] = stats.encoded;
+    response["failures"] = stats.failures;
+    response["lastBytes"] = stats.lastBytes;
+    response["lastFullBytes"] = stats.lastFullBytes;
+    response["lastMs"] = stats.lastUs / 1000.0f;
+    
+    req.sendJson(200, response);
+}
+
+// Calibrate the edge OCR digit layout and report its last result, e.g.
+// /edge_ocr?x=40&y=40&w=70&h=160&pitch=90&digits=8&decimals=1
+void handleEdgeOcr(HttpRequest &req) {
+    EdgeOcrLayout layout;
+    edgeOcrGetLayout(layout);
+    
+    if (req.args() > 0) {
+        if (req.hasArg("enabled")) layout.enabled = req.arg("enabled").toInt() != 0;
+        if (req.hasArg("digits")) layout.digits = req.arg("digits").toInt();
+        if (req.hasArg("decimals")) layout.decimals = req.arg("decimals").toInt();
+        if (req.hasArg("x")) layout.x = req.arg("x").toInt();
+        if (req.hasArg("y")) layout.y = req.arg("y").toInt();
+        if (req.hasArg("w")) layout.digitWidth = req.arg("w").toInt();
+        if (req.hasArg("h")) layout.digitHeight = req.arg("h").toInt();
+        if (req.hasArg("pitch")) layout.pitch = req.arg("pitch").toInt();
+        if (!edgeOcrSetLayout(layout)) {
+            req.send(400, "text/plain", "Invalid digit layout");
+            return;
+        }
+    }
+    
+    EdgeOcrStats stats;
+    getEdgeOcrStats(stats);
+    
+    JsonDocument response(requestArena());
+    response["enabled"] = layout.enabled;
+    response["digits"] = layout.digits;
+    response["decimals"] = layout.decimals;
+    response["x"] = layout.x;
+    response["y"] = layout.y;
+    response["w"] = layout.digitWidth;
+    response["h"] = layout.digitHeight;
+    response["pitch"] = layout.pitch;
+    response["attempts"] = stats.attempts;
+    response["confident"] = stats.confident;
+    response["decodeFailures"] = stats.decodeFailures;
+    response["clipped"] = stats.clipped;
+    response["lastDigits"] = stats.lastDigits;
+    response["lastConfidence"] = stats.lastConfidence;
+    response["lastMs"] = stats.lastUs / 1000.0f;
+    
+    req.sendJson(200, response);
+}
+
+// The last TRACE_RING_SIZE stage spans, oldest first
+void handleTrace(HttpRequest &req) {
+    static TraceEvent events[TRACE_RING_SIZE];   // Too large for the control task's stack
+    int count = traceSnapshot(events, TRACE_RING_SIZE);
+    
+    JsonDocument response(requestArena());
+    response["nowUs"] = esp_timer_get_time();
+    response["slowMs"] = TRACE_SLOW_MS;
+    JsonArray spans = response["spans"].to<JsonArray>();
+    for (int i = 0; i < count; i++) {
+        const TraceEvent &event = events[i];
+        JsonObject entry = spans.add<JsonObject>();
+        entry["stage"] = traceStageName(event.stage);
+        entry["startUs"] = event.startUs;
+        entry["durationUs"] = event.durationUs;
+        entry["value"] = event.value;
+        entry["core"] = event.core;
+        if (event.stage == TRACE_HANDLER) {
+            entry["uri"] = controlRouteUri(event.value);
+        }
+    }
+    
+    req.sendJson(200, response);
+}
+
+// Firmware update: /ota?image=wattbox-1.5.bin[&sha256=...] fetches
+// API_FIRMWARE_ENDPOINT/<image> and reboots into it; no arguments just
+// reports progress and the running slot
+void handleOta(HttpRequest &req) {
+    int status = 200;
+    if (req.hasArg("image")) {
+        String sha256 = req.arg("sha256");
+        if (!otaStart(req.arg("image").c_str(), req.hasArg("sha256") ? sha256.c_str() : NULL)) {
+            req.send(409, "text/plain", "Invalid image or hash, or an update is running");
+            return;
+        }
+        status = 202;
     }
     
-    Serial.println("Stream stopped");
+    OtaStats stats;
+    getOtaStats(stats);
+    
+    JsonDocument response(requestArena());
+    response["state"] = otaStateName(stats.state);
+    response["error"] = otaErrorName(stats.lastError);
+    response["received"] = stats.received;
+    response["imageSize"] = stats.imageSize;
+    response["lastMs"] = stats.lastUs / 1000;
+    response["updates"] = stats.updates;
+    response["failures"] = stats.failures;
+    response["running"] = stats.running;
+    response["trial"] = stats.trial;
+    
+    req.sendJson(status, response);
+}
+
+// Prometheus scrape endpoint
+void handleMetrics(HttpRequest &req) {
+    size_t len = 0;
+    const char *text = metricsRender(len);
+    req.send(200, "text/plain; version=0.0.4", text, len);
 }
 
+static const Route ROUTES[] = {
+    {"/", handleRoot},
+    {"/info", handleInfo},
+    {"/capture", handleCapture},
+    {"/flash", handleFlash},
+    {"/snapshot", handleSnapshot},
+    {"/frame", handleFrame},
+    {"/send_to_api", handleSendToAPI},
+    {"/stream", handleStream},
+    {"/stream_stats", handleStreamStats},
+    {"/camera_profile", handleCameraProfile},
+    {"/roi", handleRoi},
+    {"/edge_ocr", handleEdgeOcr},
+    {"/meters", handleMeters},
+    {"/upload_stats", handleUploadStats},
+    {"/pipeline_stats", handlePipelineStats},
+    {"/channel_stats", handleChannelStats},
+    {"/frame_pool", handleFramePool},
+    {"/capture_stats", handleCaptureStats},
+    {"/metrics", handleMetrics},
+    {"/trace", handleTrace},
+    {"/ota", handleOta},
+};
+
 void setup() {
     Serial.begin(SERIAL_BAUD_RATE);
     Serial.println("\n\nWattBox ESP32-CAM Starting...");
+    // A freshly updated image that keeps failing goes back to the previous one
+    otaBootCheck();
+    if (DEEP_SLEEP_ENABLED) {
+        dutyCycleWake();
+    }
+    
+    // Initialize flash LED (PWM, off)
+    flashInit();
+    
+    // Before anything captures: decodes of every task share one decoder
+    jpegUtilInit();
     
-    // Initialize flash LED
-    pinMode(FLASH_LED_PIN, OUTPUT);
-    digitalWrite(FLASH_LED_PIN, LOW);
+    // Start associating first; the radio comes up while the camera initialises
+    wifiBegin();
     
     // Initialize camera
+    unsigned long cameraStart = millis();
     if (!initCamera()) {
         Serial.println("Camera initialization failed!");
         while(1);
     }
-    Serial.println("Camera initialized successfully");
+    bootCameraMs = millis() - cameraStart;
+    Serial.printf("Camera initialized successfully in %u ms\n", (unsigned)bootCameraMs);
     
-    // Connect to WiFi
-    connectWiFi();
+    if (!framePoolInit()) {
+        Serial.println("Frame pool allocation failed!");
+        while(1);
+    }
+    captureInit();
+    frameScoreInit();
+    edgeOcrInit();
+    meterRegionsInit();
+    if (OCR_UPLOAD_FORMAT == OCR_FORMAT_BITMAP) {
+        ocrBitmapInit();
+    }
+    if (THUMBNAIL_UPLOAD_ENABLED && !DEEP_SLEEP_ENABLED) {
+        thumbnailInit();
+    }
     
-    // Setup web server routes
-    server.on("/", handleRoot);
-    server.on("/capture", handleCapture);
-    server.on("/flash", handleFlash);
-    server.on("/send_to_api", handleSendToAPI);
-    server.on("/stream", handleStream);
+    // Finish the WiFi connection started above
+    reportWiFi();
+    uploaderInit();
     
-    // Start web server
-    server.begin();
-    Serial.println("HTTP server started on port 80");
-}
-
-void loop() {
-    // Auto-reconnect WiFi if disconnected
-    if (WiFi.status() != WL_CONNECTED) {
-        Serial.println("WiFi disconnected, reconnecting...");
-        connectWiFi();
-        delay(5000); // Wait 5 seconds before next attempt
-        return;
+    // First boot of an update: one capture and upload, or roll back
+    otaHealthCheck();
+    
+    // UTC clock for spooled frame timestamps; syncs in the background
+    configTime(0, 0, "pool.ntp.org");
+    
+    // Battery mode: one reading per wake, no servers
+    if (DEEP_SLEEP_ENABLED) {
+        dutyCycleRun();
     }
     
-    server.handleClient();
+    // Control server on its own task; loop() only looks after WiFi
+    startControlServer(ROUTES, sizeof(ROUTES) / sizeof(ROUTES[0]));
     
-    // Auto-capture feature (if enabled)
-    static unsigned long lastCapture = 0;
-    if (AUTO_CAPTURE_ENABLED && (millis() - lastCapture > CAPTURE_INTERVAL_MS)) {
-        Serial.println("Auto-capturing image...");
-        
-        if (USE_FLASH_FOR_CAPTURE) {
-            digitalWrite(FLASH_LED_PIN, HIGH);
-            delay(100);
-        }
-        
-        if (captured_fb) {
-            esp_camera_fb_return(captured_fb);
-        }
-        captured_fb = esp_camera_fb_get();
-        
-        if (USE_FLASH_FOR_CAPTURE) {
-            digitalWrite(FLASH_LED_PIN, LOW);
-        }
-        
-        if (captured_fb) {
-            Serial.println("Auto-capture successful");
-            // You can add automatic upload to API here
-        }
-        
-        lastCapture = millis();
+    // Start MJPEG stream server on its own port and task
+    startStreamServer();
+    
+    // Auto-capture runs in its own capture and upload tasks
+    if (AUTO_CAPTURE_ENABLED) {
+        startCapturePipeline();
     }
     
+    // Backend channel for capture commands and config pushed by the backend
+    if (CHANNEL_ENABLED) {
+        startBackendChannel();
+    }
+}
+
+void loop() {
+    // Reconnects in the background; capture and spooling carry on meanwhile
+    wifiService();
     delay(10);
 }
\ No newline at end of file
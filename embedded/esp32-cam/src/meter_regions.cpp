@@ -0,0 +1,290 @@
+#include "meter_regions.h"
+#include <Preferences.h>
+#include <esp_camera.h>
+#include <esp_timer.h>
+#include <img_converters.h>
+#include "jpeg_util.h"
+
+static const char *BOUNDARY = "wattbox-meters";
+
+struct EncodedCrop {
+    size_t offset;             // Into `output`
+    size_t len;
+};
+
+static MeterRegion regions[METER_REGIONS_MAX];
+static int regionCount = 0;
+static portMUX_TYPE regionLock = portMUX_INITIALIZER_UNLOCKED;
+static MeterRegionStats stats;
+
+// Upload task only: the regions and crops of the last encoded frame
+static uint8_t *gray = NULL;
+static uint8_t *output = NULL;
+static MeterRegion encodedRegions[METER_REGIONS_MAX];
+static EncodedCrop crops[METER_REGIONS_MAX];
+static int encodedCount = 0;
+static char manifest[METER_REGIONS_MAX * 112 + 8];
+static size_t manifestLen = 0;
+
+void meterRegionsInit() {
+    Preferences prefs;
+    if (prefs.begin("meters", true)) {
+        size_t len = prefs.getBytesLength("regions");
+        if (len % sizeof(MeterRegion) == 0 && len <= sizeof(regions) &&
+            prefs.getBytes("regions", regions, len) == len) {
+            regionCount = len / sizeof(MeterRegion);
+        }
+        prefs.end();
+    }
+    if (regionCount > 0) {
+        Serial.printf("Multi-meter: %d regions\n", regionCount);
+    }
+}
+
+int meterRegionCount() {
+    return regionCount;
+}
+
+int getMeterRegions(MeterRegion *out) {
+    portENTER_CRITICAL(&regionLock);
+    int count = regionCount;
+    memcpy(out, regions, count * sizeof(MeterRegion));
+    portEXIT_CRITICAL(&regionLock);
+    return count;
+}
+
+static bool validId(const char *id) {
+    if (!id[0]) {
+        return false;
+    }
+    for (const char *c = id; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_' && *c != '.') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Write the list back to NVS; an empty list removes the key
+static void storeRegions(const MeterRegion *list, int count) {
+    Preferences prefs;
+    if (prefs.begin("meters", false)) {
+        if (count > 0) {
+            prefs.putBytes("regions", list, count * sizeof(MeterRegion));
+        } else {
+            prefs.remove("regions");
+        }
+        prefs.end();
+    }
+}
+
+bool meterRegionSet(const MeterRegion &region) {
+    if (!validId(region.name) || !validId(region.meter) || region.width < 16 ||
+        region.height < 16 || region.x + region.width > resolution[READING_FRAME_SIZE].width ||
+        region.y + region.height > resolution[READING_FRAME_SIZE].height) {
+        return false;
+    }
+
+    MeterRegion list[METER_REGIONS_MAX];
+    int count = getMeterRegions(list);
+    int slot = count;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(list[i].name, region.name) == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == METER_REGIONS_MAX) {
+        return false;
+    }
+    list[slot] = region;
+    if (slot == count) {
+        count++;
+    }
+
+    size_t pixels = 0;
+    for (int i = 0; i < count; i++) {
+        pixels += (size_t)list[i].width * list[i].height;
+    }
+    if (pixels > METER_GRAY_SIZE) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&regionLock);
+    memcpy(regions, list, count * sizeof(MeterRegion));
+    regionCount = count;
+    portEXIT_CRITICAL(&regionLock);
+    storeRegions(list, count);
+    return true;
+}
+
+bool meterRegionRemove(const char *name) {
+    MeterRegion list[METER_REGIONS_MAX];
+    int count = getMeterRegions(list);
+    int found = -1;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(list[i].name, name) == 0) {
+            found = i;
+            break;
+        }
+    }
+    if (found < 0) {
+        return false;
+    }
+    memmove(list + found, list + found + 1, (count - found - 1) * sizeof(MeterRegion));
+    count--;
+
+    portENTER_CRITICAL(&regionLock);
+    memcpy(regions, list, count * sizeof(MeterRegion));
+    regionCount = count;
+    portEXIT_CRITICAL(&regionLock);
+    storeRegions(list, count);
+    return true;
+}
+
+size_t meterRegionsJson(const MeterRegion *list, int count, char *buf, size_t size) {
+    size_t len = snprintf(buf, size, "[");
+    for (int i = 0; i < count && len < size; i++) {
+        const MeterRegion &r = list[i];
+        len += snprintf(buf + len, size - len,
+                        "%s{\"meter\":\"%s\",\"name\":\"%s\",\"roi\":\"%u,%u,%u,%u\"}",
+                        i ? "," : "", r.meter, r.name, r.x, r.y, r.width, r.height);
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len, "]");
+    }
+    return min(len, size - 1);
+}
+
+struct OutputCursor {
+    size_t base;
+    size_t len;
+    bool overflow;
+};
+
+static size_t writeOutput(void *arg, size_t index, const void *data, size_t len) {
+    OutputCursor *cursor = (OutputCursor *)arg;
+    if (cursor->base + index + len > METER_OUTPUT_SIZE) {
+        cursor->overflow = true;
+        return 0;
+    }
+    memcpy(output + cursor->base + index, data, len);
+    cursor->len = index + len;
+    return len;
+}
+
+bool meterRegionsEncode(const PooledFrame *frame) {
+    int64_t start = esp_timer_get_time();
+    if (!gray) {
+        gray = (uint8_t *)ps_malloc(METER_GRAY_SIZE);
+        output = (uint8_t *)ps_malloc(METER_OUTPUT_SIZE);
+        if (!gray || !output) {
+            Serial.println("Multi-meter buffer allocation failed");
+            free(gray);
+            free(output);
+            gray = output = NULL;
+            stats.failures++;
+            return false;
+        }
+    }
+
+    // Regions set since the last frame apply from this one on
+    encodedCount = getMeterRegions(encodedRegions);
+    GrayCrop grayCrops[METER_REGIONS_MAX];
+    size_t grayUsed = 0;
+    for (int i = 0; i < encodedCount; i++) {
+        const MeterRegion &r = encodedRegions[i];
+        grayCrops[i] = {r.x, r.y, r.width, r.height, gray + grayUsed};
+        grayUsed += (size_t)r.width * r.height;
+    }
+    if (encodedCount == 0 || frame->format != PIXFORMAT_JPEG ||
+        !jpegDecodeGrayCrops(frame->buf, frame->len, grayCrops, encodedCount)) {
+        encodedCount = 0;
+        stats.failures++;
+        return false;
+    }
+
+    size_t outputUsed = 0;
+    for (int i = 0; i < encodedCount; i++) {
+        const GrayCrop &g = grayCrops[i];
+        OutputCursor cursor = {outputUsed, 0, false};
+        if (!fmt2jpg_cb(g.out, (size_t)g.width * g.height, g.width, g.height, PIXFORMAT_GRAYSCALE,
+                        METER_JPEG_QUALITY, writeOutput, &cursor) ||
+            cursor.overflow) {
+            encodedCount = 0;
+            stats.failures++;
+            return false;
+        }
+        crops[i] = {outputUsed, cursor.len};
+        outputUsed += cursor.len;
+    }
+    manifestLen = meterRegionsJson(encodedRegions, encodedCount, manifest, sizeof(manifest));
+
+    stats.encoded++;
+    stats.lastBytes = outputUsed;
+    stats.lastFullBytes = frame->len;
+    stats.lastUs = esp_timer_get_time() - start;
+    return true;
+}
+
+static size_t manifestPartHead(char *buf, size_t size) {
+    return snprintf(buf, size,
+        "--%s\r\n"
+        "Content-Disposition: form-data; name=\"manifest\"\r\n"
+        "Content-Type: application/json\r\n"
+        "\r\n",
+        BOUNDARY);
+}
+
+static size_t cropPartHead(char *buf, size_t size, const MeterRegion &region) {
+    return snprintf(buf, size,
+        "--%s\r\n"
+        "Content-Disposition: form-data; name=\"frames\"; filename=\"%s.jpg\"\r\n"
+        "Content-Type: image/jpeg\r\n"
+        "\r\n",
+        BOUNDARY, region.meter);
+}
+
+static size_t closingBoundary(char *buf, size_t size) {
+    return snprintf(buf, size, "--%s--\r\n", BOUNDARY);
+}
+
+static bool writeText(WiFiClient &client, const char *text, size_t len, size_t &sent) {
+    return uploadWriteAll(client, (const uint8_t *)text, len, sent);
+}
+
+// Streams the manifest, then each crop straight from the output buffer
+static bool writeMetersBody(WiFiClient &client, void *, size_t &sent) {
+    char part[160];
+    if (!writeText(client, part, manifestPartHead(part, sizeof(part)), sent) ||
+        !writeText(client, manifest, manifestLen, sent) ||
+        !writeText(client, "\r\n", 2, sent)) {
+        return false;
+    }
+    for (int i = 0; i < encodedCount; i++) {
+        if (!writeText(client, part, cropPartHead(part, sizeof(part), encodedRegions[i]), sent) ||
+            !uploadWriteAll(client, output + crops[i].offset, crops[i].len, sent) ||
+            !writeText(client, "\r\n", 2, sent)) {
+            return false;
+        }
+    }
+    return writeText(client, part, closingBoundary(part, sizeof(part)), sent);
+}
+
+int meterRegionsUpload(const char *extraHeaders, UploadResult &result) {
+    char part[160];
+    size_t length = manifestPartHead(part, sizeof(part)) + manifestLen + 2 +
+                    closingBoundary(part, sizeof(part));
+    for (int i = 0; i < encodedCount; i++) {
+        length += cropPartHead(part, sizeof(part), encodedRegions[i]) + crops[i].len + 2;
+    }
+
+    char contentType[64];
+    snprintf(contentType, sizeof(contentType), "multipart/form-data; boundary=%s", BOUNDARY);
+    return uploadStreamToBackend(API_METERS_ENDPOINT, contentType, length, writeMetersBody, NULL,
+                                 extraHeaders, result);
+}
+
+void getMeterRegionStats(MeterRegionStats &out) {
+    out = stats;
+}
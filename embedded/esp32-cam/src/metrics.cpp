@@ -0,0 +1,300 @@
+#include "metrics.h"
+#include <WiFi.h>
+#include <stdarg.h>
+#include "config.h"
+#include "uploader.h"
+#include "stream_server.h"
+#include "capture_pipeline.h"
+#include "frame_pool.h"
+#include "frame_spool.h"
+#include "camera_capture.h"
+#include "wifi_link.h"
+#include "request_arena.h"
+#include "backend_channel.h"
+
+static const int MAX_BUCKETS = 7;
+
+struct HistogramDef {
+    const char *name;
+    const char *help;
+    int bucketCount;
+    uint32_t bounds[MAX_BUCKETS];  // Upper bounds, ascending
+};
+
+static const HistogramDef HISTOGRAMS[METRIC_COUNT] = {
+    {"wattbox_capture_ms", "Reading capture time including warm-up", 6,
+     {100, 250, 500, 1000, 2000, 4000}},
+    {"wattbox_frame_bytes", "JPEG size of reading captures", 6,
+     {16384, 32768, 65536, 131072, 262144, 393216}},
+    {"wattbox_upload_ms", "Backend request time", 7,
+     {50, 100, 250, 500, 1000, 2500, 5000}},
+    {"wattbox_http_request_ms", "Control server handler time per request", 7,
+     {1, 5, 10, 50, 100, 500, 2500}},
+};
+
+static const char *REQUEST_PATHS[REQUEST_COUNT] = {"/capture", "/send_to_api", "/stream", "/snapshot"};
+
+struct Histogram {
+    uint32_t buckets[MAX_BUCKETS + 1];  // Last one is +Inf
+    uint64_t sum;
+    uint32_t count;
+};
+
+static Histogram histograms[METRIC_COUNT];
+static uint32_t requests[REQUEST_COUNT];
+static portMUX_TYPE metricsMux = portMUX_INITIALIZER_UNLOCKED;
+static char text[METRICS_BUFFER_SIZE];
+static uint32_t droppedFamilies = 0;
+// Kept free until the end for the family reporting the ones left out
+static const size_t DROPPED_RESERVE = 200;
+static unsigned long lastSummaryMs = 0;
+static bool summarySent = false;
+
+void metricObserve(MetricId id, uint32_t value) {
+    const HistogramDef &def = HISTOGRAMS[id];
+    int bucket = 0;
+    while (bucket < def.bucketCount && value > def.bounds[bucket]) {
+        bucket++;
+    }
+    portENTER_CRITICAL(&metricsMux);
+    Histogram &h = histograms[id];
+    h.buckets[bucket]++;
+    h.sum += value;
+    h.count++;
+    portEXIT_CRITICAL(&metricsMux);
+}
+
+void metricRequest(MetricRequestId id) {
+    requests[id]++;
+}
+
+struct TextWriter {
+    char *buf;
+    size_t size;
+    size_t len;
+    size_t familyStart;        // Where the family being written began
+    bool cut;                  // Part of it didn't fit
+};
+
+static void emit(TextWriter &w, const char *fmt, ...) {
+    if (w.cut) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(w.buf + w.len, w.size - w.len, fmt, args);
+    va_end(args);
+    if (n < 0 || w.len + n >= w.size) {
+        w.cut = true;
+        return;
+    }
+    w.len += n;
+}
+
+// A family goes out whole or not at all: a scraper given half a histogram
+// or a line cut mid-value rejects the whole page
+static void beginFamily(TextWriter &w) {
+    w.familyStart = w.len;
+    w.cut = false;
+}
+
+static void endFamily(TextWriter &w) {
+    if (w.cut) {
+        w.len = w.familyStart;
+        w.buf[w.len] = '\0';
+        droppedFamilies++;
+    }
+}
+
+static void gauge(TextWriter &w, const char *name, const char *help, double value) {
+    beginFamily(w);
+    emit(w, "# HELP %s %s\n# TYPE %s gauge\n%s %.10g\n", name, help, name, name, value);
+    endFamily(w);
+}
+
+static void counter(TextWriter &w, const char *name, const char *help, double value) {
+    beginFamily(w);
+    emit(w, "# HELP %s %s\n# TYPE %s counter\n%s %.10g\n", name, help, name, name, value);
+    endFamily(w);
+}
+
+static void histogram(TextWriter &w, MetricId id) {
+    const HistogramDef &def = HISTOGRAMS[id];
+    portENTER_CRITICAL(&metricsMux);
+    Histogram h = histograms[id];
+    portEXIT_CRITICAL(&metricsMux);
+
+    beginFamily(w);
+    emit(w, "# HELP %s %s\n# TYPE %s histogram\n", def.name, def.help, def.name);
+    uint32_t cumulative = 0;
+    for (int i = 0; i < def.bucketCount; i++) {
+        cumulative += h.buckets[i];
+        emit(w, "%s_bucket{le=\"%lu\"} %lu\n", def.name, (unsigned long)def.bounds[i],
+             (unsigned long)cumulative);
+    }
+    emit(w, "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %llu\n%s_count %lu\n", def.name,
+         (unsigned long)h.count, def.name, (unsigned long long)h.sum, def.name,
+         (unsigned long)h.count);
+    endFamily(w);
+}
+
+const char *metricsRender(size_t &len) {
+    TextWriter w = {text, sizeof(text) - DROPPED_RESERVE, 0, 0, false};
+
+    gauge(w, "wattbox_uptime_seconds", "Time since boot", millis() / 1000.0);
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t largestBlock = ESP.getMaxAllocHeap();
+    gauge(w, "wattbox_heap_free_bytes", "Free internal heap", freeHeap);
+    gauge(w, "wattbox_heap_min_free_bytes", "Lowest free internal heap since boot", ESP.getMinFreeHeap());
+    gauge(w, "wattbox_heap_largest_block_bytes", "Largest allocatable internal heap block",
+          largestBlock);
+    gauge(w, "wattbox_heap_fragmentation_percent",
+          "Free internal heap not in the largest block; rises as the heap fragments",
+          freeHeap ? 100.0 - 100.0 * largestBlock / freeHeap : 0);
+    gauge(w, "wattbox_psram_free_bytes", "Free PSRAM", ESP.getFreePsram());
+    gauge(w, "wattbox_psram_size_bytes", "Total PSRAM", ESP.getPsramSize());
+    bool connected = WiFi.status() == WL_CONNECTED;
+    gauge(w, "wattbox_wifi_connected", "1 while associated", connected ? 1 : 0);
+    if (connected) {
+        gauge(w, "wattbox_wifi_rssi_dbm", "Signal strength of the access point", WiFi.RSSI());
+    }
+
+    beginFamily(w);
+    emit(w, "# HELP wattbox_http_requests_total Requests to the control server\n"
+            "# TYPE wattbox_http_requests_total counter\n");
+    for (int i = 0; i < REQUEST_COUNT; i++) {
+        emit(w, "wattbox_http_requests_total{path=\"%s\"} %lu\n", REQUEST_PATHS[i],
+             (unsigned long)requests[i]);
+    }
+    endFamily(w);
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        histogram(w, (MetricId)i);
+    }
+
+    StreamStats stream;
+    getStreamStats(stream);
+    gauge(w, "wattbox_stream_viewers", "Connected MJPEG viewers", stream.viewers);
+    gauge(w, "wattbox_stream_fps", "Achieved stream frame rate", stream.achievedFps);
+    counter(w, "wattbox_stream_frames_sent_total", "Frame deliveries summed over viewers",
+            stream.framesSent);
+    counter(w, "wattbox_stream_frames_dropped_total", "Frames skipped for backed-up viewers",
+            stream.framesDropped);
+
+    UploadStats upload;
+    getUploadStats(upload);
+    counter(w, "wattbox_upload_requests_total", "Backend requests", upload.requests);
+    counter(w, "wattbox_upload_failures_total", "Backend requests without an HTTP status",
+            upload.failures);
+    counter(w, "wattbox_upload_connects_total", "TCP connections opened to the backend",
+            upload.connects);
+    counter(w, "wattbox_upload_reused_total", "Backend requests on a kept-alive connection",
+            upload.reused);
+
+    PipelineStats pipeline;
+    getPipelineStats(pipeline);
+    counter(w, "wattbox_pipeline_captured_total", "Auto-captures taken", pipeline.captured);
+    counter(w, "wattbox_pipeline_uploaded_total", "Auto-captures accepted by the backend",
+            pipeline.uploaded);
+    counter(w, "wattbox_pipeline_unchanged_total", "Auto-captures not uploaded, display unchanged",
+            pipeline.unchanged);
+    counter(w, "wattbox_pipeline_upload_failures_total", "Auto-uploads that failed",
+            pipeline.uploadFailures);
+    gauge(w, "wattbox_pipeline_queued", "Frames waiting for upload", pipeline.queued);
+    gauge(w, "wattbox_capture_interval_ms", "Capture interval set by the backend", pipeline.intervalMs);
+    if (pipeline.firstReadingMs) {
+        gauge(w, "wattbox_boot_first_reading_ms", "Uptime when the first reading was delivered",
+              pipeline.firstReadingMs);
+    }
+
+    WifiLinkStats link;
+    getWifiLinkStats(link);
+    gauge(w, "wattbox_wifi_connect_ms", "Duration of the last WiFi connect", link.lastConnectMs);
+    gauge(w, "wattbox_wifi_fast_path", "1 if the last connect used the cached network",
+          link.fastPath ? 1 : 0);
+    counter(w, "wattbox_wifi_fast_path_failures_total", "Cached connects that fell back to a scan",
+            link.fastPathFailures);
+    counter(w, "wattbox_wifi_disconnects_total", "Links lost after being up", link.disconnects);
+    gauge(w, "wattbox_wifi_backoff_ms", "Wait before the next connect attempt, 0 while up",
+          link.backoffMs);
+
+    ChannelStats channel;
+    getChannelStats(channel);
+    gauge(w, "wattbox_channel_connected", "1 while the backend channel is open", channel.connected ? 1 : 0);
+    counter(w, "wattbox_channel_disconnects_total", "Backend channel connections lost",
+            channel.disconnects);
+    counter(w, "wattbox_channel_commands_total", "Commands received over the backend channel",
+            channel.commands);
+
+    SpoolStats spool;
+    getSpoolStats(spool);
+    gauge(w, "wattbox_spool_pending", "Frames spooled to flash awaiting replay", spool.pending);
+
+    FramePoolStats pool;
+    getFramePoolStats(pool);
+    gauge(w, "wattbox_frame_pool_in_use", "Frame pool slots holding a frame", pool.inUse);
+    counter(w, "wattbox_frame_pool_exhausted_total", "Frames dropped for lack of a slot",
+            pool.exhausted);
+
+    RequestArenaStats arena;
+    getRequestArenaStats(arena);
+    gauge(w, "wattbox_request_arena_high_water_bytes", "Most request arena a response has used",
+          arena.highWater);
+    counter(w, "wattbox_request_arena_overflows_total", "Response allocations that fell back to the heap",
+            arena.overflows);
+
+    CaptureStats capture;
+    getCaptureStats(capture);
+    counter(w, "wattbox_capture_unsettled_total", "Captures taken before exposure settled",
+            capture.unsettled);
+    gauge(w, "wattbox_capture_last_score", "Burst score of the last reading capture",
+          capture.last.score);
+
+    w.size = sizeof(text);
+    counter(w, "wattbox_metrics_dropped_families_total",
+            "Metric families left out of /metrics, buffer full", droppedFamilies);
+
+    len = w.len;
+    return text;
+}
+
+// Mean of a histogram in its own unit, 0 when empty
+static uint32_t histogramMean(MetricId id) {
+    portENTER_CRITICAL(&metricsMux);
+    uint64_t sum = histograms[id].sum;
+    uint32_t count = histograms[id].count;
+    portEXIT_CRITICAL(&metricsMux);
+    return count ? sum / count : 0;
+}
+
+int metricsSummary(char *buf, size_t size) {
+    StreamStats stream;
+    getStreamStats(stream);
+    return snprintf(buf, size,
+                    "up=%lu,heap=%lu,heap_min=%lu,psram=%lu,rssi=%d,"
+                    "capture_ms=%lu,upload_ms=%lu,frame_bytes=%lu,fps=%.1f",
+                    millis() / 1000, (unsigned long)ESP.getFreeHeap(),
+                    (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getFreePsram(),
+                    (int)WiFi.RSSI(), (unsigned long)histogramMean(METRIC_CAPTURE_MS),
+                    (unsigned long)histogramMean(METRIC_UPLOAD_MS),
+                    (unsigned long)histogramMean(METRIC_FRAME_BYTES), stream.achievedFps);
+}
+
+void metricsSummaryHeader(char *buf, size_t size) {
+    if (summarySent && millis() - lastSummaryMs < METRICS_SUMMARY_INTERVAL_MS) {
+        return;
+    }
+    char summary[140];
+    int len = metricsSummary(summary, sizeof(summary));
+    char line[160];
+    int n = snprintf(line, sizeof(line), "X-Device-Metrics: %s\r\n", summary);
+
+    // A cut-off header line would corrupt the request; leave it out instead
+    size_t used = strlen(buf);
+    if (len <= 0 || (size_t)len >= sizeof(summary) || n <= 0 || (size_t)n >= sizeof(line) ||
+        used + n >= size) {
+        return;
+    }
+    memcpy(buf + used, line, n + 1);
+    lastSummaryMs = millis();
+    summarySent = true;
+}
@@ -0,0 +1,111 @@
+#include "ocr_bitmap.h"
+#include <esp_timer.h>
+#include "config.h"
+#include "jpeg_util.h"
+
+// Grayscale is decoded behind room for the PBM header, so packing can
+// overwrite the buffer from the front without catching up with its input
+static const size_t HEADER_RESERVE = 32;
+
+static uint8_t *buffer = NULL;
+static OcrBitmapStats stats;
+
+bool ocrBitmapInit() {
+    buffer = (uint8_t *)ps_malloc(OCR_BITMAP_BUFFER_SIZE);
+    if (!buffer) {
+        Serial.println("OCR bitmap buffer allocation failed");
+        return false;
+    }
+    return true;
+}
+
+// Otsu's method: the level that best separates the histogram into two classes
+static uint8_t otsuThreshold(const uint8_t *gray, size_t count) {
+    uint32_t histogram[256] = {0};
+    for (size_t i = 0; i < count; i++) {
+        histogram[gray[i]]++;
+    }
+
+    uint64_t sumAll = 0;
+    for (int level = 0; level < 256; level++) {
+        sumAll += (uint64_t)level * histogram[level];
+    }
+
+    uint64_t sumBelow = 0;
+    uint32_t countBelow = 0;
+    float bestVariance = -1;
+    uint8_t best = 128;
+    for (int level = 0; level < 256; level++) {
+        countBelow += histogram[level];
+        if (countBelow == 0) {
+            continue;
+        }
+        uint32_t countAbove = count - countBelow;
+        if (countAbove == 0) {
+            break;
+        }
+        sumBelow += (uint64_t)level * histogram[level];
+        float meanBelow = (float)sumBelow / countBelow;
+        float meanAbove = (float)(sumAll - sumBelow) / countAbove;
+        float variance = (float)countBelow * countAbove * (meanBelow - meanAbove) * (meanBelow - meanAbove);
+        if (variance > bestVariance) {
+            bestVariance = variance;
+            best = level;
+        }
+    }
+    return best;
+}
+
+bool ocrBitmapEncode(const uint8_t *jpeg, size_t len, const uint8_t *&out, size_t &outLen) {
+    int64_t start = esp_timer_get_time();
+    uint16_t frameWidth = 0, frameHeight = 0;
+    if (!buffer || !jpegDimensions(jpeg, len, frameWidth, frameHeight)) {
+        stats.failures++;
+        return false;
+    }
+    int shift = 0;
+    while (shift < JPG_SCALE_8X && (frameWidth >> shift) > OCR_BITMAP_MAX_WIDTH) {
+        shift++;
+    }
+
+    uint8_t *gray = buffer + HEADER_RESERVE;
+    uint16_t width = 0, height = 0;
+    if (!jpegDecodeGray(jpeg, len, (jpg_scale_t)shift, gray, OCR_BITMAP_BUFFER_SIZE - HEADER_RESERVE,
+                        width, height)) {
+        stats.failures++;
+        return false;
+    }
+
+    uint8_t threshold = otsuThreshold(gray, (size_t)width * height);
+
+    // P4: rows of MSB-first bits padded to whole bytes, 1 = black
+    int headerLen = snprintf((char *)buffer, HEADER_RESERVE, "P4\n%u %u\n", width, height);
+    uint8_t *dst = buffer + headerLen;
+    for (uint16_t y = 0; y < height; y++) {
+        const uint8_t *row = gray + (size_t)y * width;
+        for (uint16_t x = 0; x < width; x += 8) {
+            uint8_t bits = 0;
+            for (int b = 0; b < 8; b++) {
+                bits <<= 1;
+                if (x + b < width && row[x + b] <= threshold) {
+                    bits |= 1;
+                }
+            }
+            *dst++ = bits;
+        }
+    }
+
+    out = buffer;
+    outLen = dst - buffer;
+    stats.encoded++;
+    stats.lastWidth = width;
+    stats.lastHeight = height;
+    stats.lastThreshold = threshold;
+    stats.lastBytes = outLen;
+    stats.lastUs = esp_timer_get_time() - start;
+    return true;
+}
+
+void getOcrBitmapStats(OcrBitmapStats &out) {
+    out = stats;
+}
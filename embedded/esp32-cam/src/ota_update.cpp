@@ -0,0 +1,374 @@
+#include "ota_update.h"
+#include <WiFi.h>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <esp_timer.h>
+#include <mbedtls/sha256.h>
+#include "config.h"
+#include "http_util.h"
+#include "camera_profiles.h"
+#include "camera_capture.h"
+#include "frame_pool.h"
+#include "uploader.h"
+
+static const char *STATE_NAMES[] = {"idle", "downloading", "rebooting", "failed"};
+static const char *ERROR_NAMES[] = {
+    "none", "connect", "http", "size", "no_hash", "begin", "read", "write", "hash", "image", "boot",
+};
+
+// Written by a finished download for the slot it wrote; the boots of that
+// image count against it until otaHealthCheck() passes. NVS "ota"/"trial".
+struct OtaTrial {
+    char label[17];
+    uint8_t boots;
+};
+
+static OtaStats stats;
+static OtaTrial trial;
+static portMUX_TYPE stateLock = portMUX_INITIALIZER_UNLOCKED;
+
+// The download in progress, set by otaStart()
+static char imagePath[96];
+static uint8_t expectedHash[32];
+static bool haveHash = false;
+// Internal RAM: flash writes from PSRAM would go through a bounce buffer
+static uint8_t chunk[OTA_CHUNK_SIZE];
+
+static void storeTrial(const OtaTrial *record) {
+    Preferences prefs;
+    if (prefs.begin("ota", false)) {
+        if (record) {
+            prefs.putBytes("trial", record, sizeof(OtaTrial));
+        } else {
+            prefs.remove("trial");
+        }
+        prefs.end();
+    }
+}
+
+// Boot the other slot again. Returns only if it can't be booted, in which
+// case the running image is kept and no longer on trial.
+static void rollback(const char *reason) {
+    Serial.printf("Firmware in %s failed (%s), rolling back\n", stats.running, reason);
+    storeTrial(NULL);
+    stats.trial = false;
+
+    // With the bootloader's rollback enabled this marks the image invalid
+    // and restarts; otherwise the previous slot is selected by hand
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+        state == ESP_OTA_IMG_PENDING_VERIFY) {
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+    const esp_partition_t *previous = esp_ota_get_next_update_partition(NULL);
+    if (!previous || esp_ota_set_boot_partition(previous) != ESP_OK) {
+        Serial.println("No previous firmware to boot, keeping this one");
+        return;
+    }
+    ESP.restart();
+}
+
+static void confirm() {
+    esp_ota_mark_app_valid_cancel_rollback();
+    storeTrial(NULL);
+    stats.trial = false;
+    Serial.printf("Firmware in %s confirmed after %u boots\n", stats.running, trial.boots);
+}
+
+// Arduino marks the running image valid before setup() when the
+// bootloader's rollback is enabled; the health check decides instead
+extern "C" bool verifyRollbackLater() {
+    return true;
+}
+
+// On core 0, so a setup() spinning on core 1 can't hold it off
+static void trialTimeoutTask(void *) {
+    vTaskDelay(pdMS_TO_TICKS(OTA_HEALTH_TIMEOUT_MS));
+    if (stats.trial) {
+        rollback("no health check in time");
+    }
+    vTaskDelete(NULL);
+}
+
+void otaBootCheck() {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    strncpy(stats.running, running->label, sizeof(stats.running) - 1);
+
+    Preferences prefs;
+    if (prefs.begin("ota", false)) {
+        if (prefs.getBytesLength("trial") == sizeof(trial) &&
+            prefs.getBytes("trial", &trial, sizeof(trial)) == sizeof(trial)) {
+            if (strcmp(trial.label, running->label) == 0) {
+                trial.boots++;
+                prefs.putBytes("trial", &trial, sizeof(trial));
+                stats.trial = true;
+            } else {
+                // The bootloader has gone back to the other image already
+                prefs.remove("trial");
+            }
+        }
+        prefs.end();
+    }
+    if (!stats.trial) {
+        return;
+    }
+
+    stats.trialBoots = trial.boots;
+    Serial.printf("Firmware in %s on trial, boot %u\n", stats.running, trial.boots);
+    if (trial.boots > OTA_TRIAL_BOOTS) {
+        rollback("restarted before its health check");
+        return;
+    }
+    xTaskCreatePinnedToCore(trialTimeoutTask, "ota_trial", 2048, NULL, 1, NULL, PRO_CPU_NUM);
+}
+
+void otaHealthCheck() {
+    if (!stats.trial) {
+        return;
+    }
+    for (int attempt = 1; attempt <= OTA_HEALTH_ATTEMPTS; attempt++) {
+        if (attempt > 1) {
+            delay(OTA_HEALTH_RETRY_MS);
+        }
+        if (WiFi.status() != WL_CONNECTED) {
+            Serial.printf("Health check %d: WiFi not connected\n", attempt);
+            continue;
+        }
+        CaptureInfo info;
+        PooledFrame *frame = captureReading(info);
+        if (!frame) {
+            Serial.printf("Health check %d: capture failed\n", attempt);
+            continue;
+        }
+        char extraHeaders[160];
+        cameraFrameHeaders(extraHeaders, sizeof(extraHeaders));
+        captureScoreHeader(frame, extraHeaders, sizeof(extraHeaders));
+        size_t used = strlen(extraHeaders);
+        snprintf(extraHeaders + used, sizeof(extraHeaders) - used, "X-Firmware-Trial: %s\r\n",
+                 stats.running);
+
+        static UploadResult upload;
+        int code = uploadToBackend(frame->buf, frame->len, "image/jpeg", extraHeaders, upload);
+        framePoolRelease(frame);
+        if (code >= 200 && code < 300) {
+            confirm();
+            return;
+        }
+        Serial.printf("Health check %d: upload failed: %d\n", attempt, code);
+    }
+    rollback("health check failed");
+}
+
+static bool parseHash(const char *hex, uint8_t *out) {
+    while (*hex == ' ') {
+        hex++;
+    }
+    if (strlen(hex) != 64) {
+        return false;
+    }
+    for (int i = 0; i < 32; i++) {
+        char byte[3] = {hex[2 * i], hex[2 * i + 1], '\0'};
+        char *end;
+        out[i] = strtoul(byte, &end, 16);
+        if (*end != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool validImageName(const char *name) {
+    if (!name[0] || name[0] == '.') {
+        return false;
+    }
+    for (const char *c = name; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '-' && *c != '_' && *c != '.') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Request the image and stream it into the inactive slot
+static OtaError download() {
+    WiFiClient client;
+    if (!client.connect(API_HOST, API_PORT, UPLOAD_TIMEOUT_MS)) {
+        return OTA_ERR_CONNECT;
+    }
+    char head[256];
+    int headLen = snprintf(head, sizeof(head),
+                           "GET %s HTTP/1.1\r\n"
+                           "Host: %s:%d\r\n"
+                           "X-Device-ID: %s\r\n"
+                           "Connection: close\r\n"
+                           "\r\n",
+                           imagePath, API_HOST, API_PORT, DEVICE_ID);
+    if (client.write((const uint8_t *)head, headLen) != (size_t)headLen) {
+        return OTA_ERR_CONNECT;
+    }
+
+    unsigned long deadline = millis() + UPLOAD_TIMEOUT_MS;
+    char line[128];
+    int statusCode = 0;
+    if (!readHttpLine(client, line, sizeof(line), deadline)) {
+        return OTA_ERR_READ;
+    }
+    if (sscanf(line, "HTTP/1.%*d %d", &statusCode) != 1 || statusCode != 200) {
+        Serial.printf("Firmware request: %s\n", line);
+        return OTA_ERR_HTTP;
+    }
+    long length = -1;
+    bool headersDone = false;
+    while (readHttpLine(client, line, sizeof(line), deadline)) {
+        if (line[0] == '\0') {
+            headersDone = true;
+            break;
+        }
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            length = atol(line + 15);
+        } else if (!haveHash && strncasecmp(line, "X-Firmware-SHA256:", 18) == 0) {
+            haveHash = parseHash(line + 18, expectedHash);
+        }
+    }
+    if (!headersDone) {
+        return OTA_ERR_READ;
+    }
+    const esp_partition_t *slot = esp_ota_get_next_update_partition(NULL);
+    if (length <= 0 || !slot || (size_t)length > slot->size) {
+        return OTA_ERR_SIZE;
+    }
+    if (!haveHash) {
+        return OTA_ERR_NO_HASH;
+    }
+    stats.imageSize = length;
+
+    // Sectors are erased as the writes reach them; erasing the whole slot
+    // first would stall the connection for seconds
+    esp_ota_handle_t handle;
+    if (esp_ota_begin(slot, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK) {
+        return OTA_ERR_BEGIN;
+    }
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+
+    // Whole chunks are hashed and written as they fill; the first one is
+    // checked for an app image header by esp_ota_write()
+    OtaError error = OTA_ERR_NONE;
+    size_t received = 0;
+    size_t fill = 0;
+    deadline = millis() + UPLOAD_TIMEOUT_MS;
+    while (received < (size_t)length) {
+        size_t want = min(OTA_CHUNK_SIZE - fill, (size_t)length - received - fill);
+        int n = client.available() > 0 ? client.read(chunk + fill, want) : 0;
+        if (n <= 0) {
+            if (!client.connected() || millis() > deadline) {
+                error = OTA_ERR_READ;
+                break;
+            }
+            delay(1);
+            continue;
+        }
+        fill += n;
+        deadline = millis() + UPLOAD_TIMEOUT_MS;  // Stalls are timed, not the whole image
+        if (fill == OTA_CHUNK_SIZE || received + fill == (size_t)length) {
+            mbedtls_sha256_update(&sha, chunk, fill);
+            if (esp_ota_write(handle, chunk, fill) != ESP_OK) {
+                error = OTA_ERR_WRITE;
+                break;
+            }
+            received += fill;
+            fill = 0;
+            stats.received = received;
+        }
+    }
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    client.stop();
+
+    if (error == OTA_ERR_NONE && memcmp(digest, expectedHash, sizeof(digest)) != 0) {
+        error = OTA_ERR_HASH;
+    }
+    if (error != OTA_ERR_NONE) {
+        esp_ota_abort(handle);
+        return error;
+    }
+    if (esp_ota_end(handle) != ESP_OK) {
+        return OTA_ERR_IMAGE;
+    }
+    if (esp_ota_set_boot_partition(slot) != ESP_OK) {
+        return OTA_ERR_BOOT;
+    }
+
+    OtaTrial record = {};
+    strncpy(record.label, slot->label, sizeof(record.label) - 1);
+    storeTrial(&record);
+    return OTA_ERR_NONE;
+}
+
+static void otaTask(void *) {
+    int64_t start = esp_timer_get_time();
+    OtaError error = download();
+    if (error == OTA_ERR_NONE) {
+        stats.lastUs = esp_timer_get_time() - start;
+        stats.updates++;
+        stats.state = OTA_REBOOTING;
+        Serial.printf("Firmware update: %u bytes in %u ms, rebooting\n", (unsigned)stats.imageSize,
+                      (unsigned)(stats.lastUs / 1000));
+        delay(100);  // Let the log line out
+        ESP.restart();
+    }
+    stats.lastError = error;
+    stats.failures++;
+    stats.state = OTA_FAILED;
+    Serial.printf("Firmware update failed: %s\n", otaErrorName(error));
+    vTaskDelete(NULL);
+}
+
+bool otaStart(const char *image, const char *sha256Hex) {
+    uint8_t hash[32];
+    if (!validImageName(image) ||
+        strlen(API_FIRMWARE_ENDPOINT) + 1 + strlen(image) >= sizeof(imagePath) ||
+        (sha256Hex && !parseHash(sha256Hex, hash))) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&stateLock);
+    bool busy = stats.state == OTA_DOWNLOADING || stats.state == OTA_REBOOTING || stats.trial;
+    if (!busy) {
+        stats.state = OTA_DOWNLOADING;
+    }
+    portEXIT_CRITICAL(&stateLock);
+    if (busy) {
+        return false;
+    }
+
+    snprintf(imagePath, sizeof(imagePath), "%s/%s", API_FIRMWARE_ENDPOINT, image);
+    haveHash = sha256Hex != NULL;
+    if (haveHash) {
+        memcpy(expectedHash, hash, sizeof(hash));
+    }
+    stats.received = 0;
+    stats.imageSize = 0;
+    stats.lastError = OTA_ERR_NONE;
+    Serial.printf("Firmware update from %s\n", imagePath);
+    if (xTaskCreatePinnedToCore(otaTask, "ota", OTA_TASK_STACK_SIZE, NULL, 1, NULL,
+                                OTA_TASK_CORE) != pdPASS) {
+        stats.state = OTA_FAILED;
+        return false;
+    }
+    return true;
+}
+
+const char *otaStateName(OtaState state) {
+    return STATE_NAMES[state];
+}
+
+const char *otaErrorName(OtaError error) {
+    return ERROR_NAMES[error];
+}
+
+void getOtaStats(OtaStats &out) {
+    out = stats;
+}
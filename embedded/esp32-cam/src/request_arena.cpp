@@ -0,0 +1,96 @@
+#include "request_arena.h"
+#include "config.h"
+
+// Every block is preceded by its size, so reallocate() knows what to copy
+struct BlockHeader {
+    size_t size;
+    size_t pad;                // Keeps blocks 8-byte aligned
+};
+
+static uint8_t *arena = NULL;
+static size_t used = 0;
+static uint8_t *lastBlock = NULL;  // Can be grown or freed in place
+static RequestArenaStats stats;
+
+static bool inArena(void *ptr) {
+    return arena && (uint8_t *)ptr >= arena && (uint8_t *)ptr < arena + REQUEST_ARENA_SIZE;
+}
+
+static size_t alignUp(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+class RequestArenaAllocator : public ArduinoJson::Allocator {
+public:
+    void *allocate(size_t size) override {
+        size_t need = sizeof(BlockHeader) + alignUp(size);
+        if (!arena || used + need > REQUEST_ARENA_SIZE) {
+            stats.overflows += arena != NULL;
+            return malloc(size);
+        }
+        BlockHeader *header = (BlockHeader *)(arena + used);
+        header->size = size;
+        lastBlock = (uint8_t *)(header + 1);
+        used += need;
+        return lastBlock;
+    }
+
+    void deallocate(void *ptr) override {
+        if (!inArena(ptr)) {
+            free(ptr);
+        } else if (ptr == lastBlock) {
+            used = (uint8_t *)ptr - sizeof(BlockHeader) - arena;
+            lastBlock = NULL;
+        }
+        // Anything else waits for the reset
+    }
+
+    void *reallocate(void *ptr, size_t size) override {
+        if (!ptr) {
+            return allocate(size);
+        }
+        if (!inArena(ptr)) {
+            return realloc(ptr, size);
+        }
+        BlockHeader *header = (BlockHeader *)ptr - 1;
+        if (ptr == lastBlock) {
+            size_t start = (uint8_t *)ptr - arena;
+            if (start + alignUp(size) <= REQUEST_ARENA_SIZE) {
+                header->size = size;
+                used = start + alignUp(size);
+                return ptr;
+            }
+        }
+        void *moved = allocate(size);
+        if (moved) {
+            memcpy(moved, ptr, min(header->size, size));
+        }
+        return moved;
+    }
+};
+
+static RequestArenaAllocator allocator;
+
+bool requestArenaInit() {
+    arena = (uint8_t *)ps_malloc(REQUEST_ARENA_SIZE);
+    stats.size = arena ? REQUEST_ARENA_SIZE : 0;
+    return arena != NULL;
+}
+
+ArduinoJson::Allocator *requestArena() {
+    return &allocator;
+}
+
+void requestArenaReset() {
+    stats.requests++;
+    stats.lastUsed = used;
+    if (used > stats.highWater) {
+        stats.highWater = used;
+    }
+    used = 0;
+    lastBlock = NULL;
+}
+
+void getRequestArenaStats(RequestArenaStats &out) {
+    out = stats;
+}
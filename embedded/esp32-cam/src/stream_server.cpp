@@ -0,0 +1,356 @@
+#include "stream_server.h"
+#include <WiFi.h>
+#include <esp_camera.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <errno.h>
+#include "config.h"
+#include "camera_profiles.h"
+
+static WiFiServer streamServer(STREAM_SERVER_PORT);
+static WiFiClient viewers[STREAM_MAX_CLIENTS];
+static bool viewerActive[STREAM_MAX_CLIENTS];
+static volatile int viewerCount = 0;
+
+static StreamStats stats;
+static portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char STREAM_HEADER[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+// A connection whose request is still arriving. It is read as far as it has
+// arrived on each pass of the stream task, never waited for, so a client
+// that connects and sends nothing costs the viewers nothing.
+struct PendingViewer {
+    bool active;
+    WiFiClient client;
+    unsigned long deadline;    // millis() by which the request must be complete
+    char line[64];             // Line being read; longer ones are cut, only the start matters
+    size_t lineLen;
+    bool haveRequestLine;
+    bool isStream;
+};
+
+static PendingViewer pending[STREAM_MAX_PENDING];
+static int pendingCount = 0;
+
+static void endPending(PendingViewer &p) {
+    p.client = WiFiClient();
+    p.active = false;
+    pendingCount--;
+}
+
+// Consume what has arrived of a pending request; true once the blank line
+// ending its headers has been read
+static bool readPending(PendingViewer &p) {
+    uint8_t buf[64];
+    int avail;
+    while ((avail = p.client.available()) > 0) {
+        int n = p.client.read(buf, min((size_t)avail, sizeof(buf)));
+        if (n <= 0) {
+            return false;
+        }
+        for (int i = 0; i < n; i++) {
+            char c = buf[i];
+            if (c == '\r') {
+                continue;
+            }
+            if (c != '\n') {
+                if (p.lineLen < sizeof(p.line) - 1) {
+                    p.line[p.lineLen++] = c;
+                }
+                continue;
+            }
+            p.line[p.lineLen] = '\0';
+            if (!p.haveRequestLine) {
+                p.haveRequestLine = p.lineLen > 0;
+                p.isStream = strncmp(p.line, "GET /stream", 11) == 0 ||
+                             strncmp(p.line, "GET / ", 6) == 0;
+            } else if (p.lineLen == 0) {
+                return true;  // Request headers are not needed
+            }
+            p.lineLen = 0;
+        }
+    }
+    return false;
+}
+
+// Attach a client whose request has been read as a viewer
+static void attachViewer(WiFiClient &client) {
+    for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+        if (!viewerActive[i]) {
+            client.setNoDelay(true);
+            client.write((const uint8_t *)STREAM_HEADER, sizeof(STREAM_HEADER) - 1);
+            viewers[i] = client;
+            viewerActive[i] = true;
+            viewerCount++;
+            Serial.printf("Stream viewer connected (%d/%d)\n", viewerCount, STREAM_MAX_CLIENTS);
+            return;
+        }
+    }
+
+    client.print("HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n");
+    client.stop();
+}
+
+// Take a new connection and move pending requests along
+static void acceptViewers() {
+    WiFiClient client = streamServer.available();
+    if (client) {
+        int slot = -1;
+        for (int i = 0; i < STREAM_MAX_PENDING && slot < 0; i++) {
+            if (!pending[i].active) {
+                slot = i;
+            }
+        }
+        if (slot < 0) {
+            client.print("HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n");
+            client.stop();
+        } else {
+            PendingViewer &p = pending[slot];
+            p.active = true;
+            p.client = client;
+            p.deadline = millis() + STREAM_HANDSHAKE_MS;
+            p.lineLen = 0;
+            p.haveRequestLine = false;
+            p.isStream = false;
+            pendingCount++;
+        }
+    }
+
+    for (int i = 0; i < STREAM_MAX_PENDING; i++) {
+        PendingViewer &p = pending[i];
+        if (!p.active) {
+            continue;
+        }
+        if (readPending(p)) {
+            if (p.isStream) {
+                attachViewer(p.client);
+            } else {
+                p.client.print("HTTP/1.1 404 Not Found\r\nConnection: close\r\n\r\n");
+                p.client.stop();
+            }
+            endPending(p);
+        } else if (!p.client.connected() || (long)(millis() - p.deadline) >= 0) {
+            p.client.stop();
+            endPending(p);
+        }
+    }
+}
+
+static void dropViewer(int i) {
+    viewers[i].stop();
+    viewers[i] = WiFiClient();
+    viewerActive[i] = false;
+    viewerCount--;
+    Serial.printf("Stream viewer disconnected (%d/%d)\n", viewerCount, STREAM_MAX_CLIENTS);
+}
+
+// Write all of `buf` without blocking past `deadlineUs`. WiFiClient::write()
+// would wait for the socket however long it takes, and with it every viewer
+// after this one. Sets `slow` when the deadline was the reason.
+static bool writeWithin(int fd, const uint8_t *buf, size_t len, int64_t deadlineUs, bool &slow) {
+    size_t sent = 0;
+    while (sent < len) {
+        int n = send(fd, buf + sent, len - sent, MSG_DONTWAIT);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return false;
+        }
+        int64_t leftUs = deadlineUs - esp_timer_get_time();
+        if (leftUs <= 0) {
+            slow = true;
+            return false;
+        }
+        fd_set writeSet;
+        FD_ZERO(&writeSet);
+        FD_SET(fd, &writeSet);
+        struct timeval timeout = {0, (long)min(leftUs, (int64_t)10000)};
+        select(fd + 1, NULL, &writeSet, NULL, &timeout);
+    }
+    return true;
+}
+
+// Write one multipart frame within STREAM_SEND_TIMEOUT_MS; false means the
+// viewer has gone away or is too slow, and a part cut short has broken its
+// stream either way
+static bool sendFrame(WiFiClient &client, const char *partHead, size_t partHeadLen,
+                      const camera_fb_t *fb, bool &slow) {
+    int fd = client.fd();
+    int64_t deadlineUs = esp_timer_get_time() + (int64_t)STREAM_SEND_TIMEOUT_MS * 1000;
+    return fd >= 0 && writeWithin(fd, (const uint8_t *)partHead, partHeadLen, deadlineUs, slow) &&
+           writeWithin(fd, fb->buf, fb->len, deadlineUs, slow) &&
+           writeWithin(fd, (const uint8_t *)"\r\n", 2, deadlineUs, slow);
+}
+
+// True when the viewer's socket can take more data right now. A viewer that
+// is still draining an earlier frame skips this one instead of queueing it.
+static bool viewerWritable(WiFiClient &client) {
+    int fd = client.fd();
+    if (fd < 0) {
+        return false;
+    }
+    fd_set writeSet;
+    FD_ZERO(&writeSet);
+    FD_SET(fd, &writeSet);
+    struct timeval timeout = {0, 0};
+    return select(fd + 1, NULL, &writeSet, NULL, &timeout) > 0;
+}
+
+// Exponential moving average with a 1/8 weight for the new sample
+static uint32_t smooth(uint32_t avg, uint32_t sample) {
+    return avg == 0 ? sample : avg - avg / 8 + sample / 8;
+}
+
+static void streamTask(void *) {
+    const int64_t framePeriodUs = 1000000 / STREAM_TARGET_FPS;
+    int64_t nextFrameUs = esp_timer_get_time();
+    int64_t windowStartUs = nextFrameUs;
+    uint32_t windowFrames = 0;
+    unsigned long lastLog = millis();
+
+    for (;;) {
+        acceptViewers();
+
+        if (viewerCount == 0) {
+            // Come back soon for a request that is still arriving
+            vTaskDelay(pdMS_TO_TICKS(pendingCount ? 5 : 50));
+            nextFrameUs = esp_timer_get_time();
+            continue;
+        }
+
+        // Wait for this frame's slot
+        int64_t waitUs = nextFrameUs - esp_timer_get_time();
+        if (waitUs > 0) {
+            vTaskDelay(pdMS_TO_TICKS(waitUs / 1000));
+        }
+        int64_t frameStartUs = esp_timer_get_time();
+        // If we are behind, start over from now rather than bursting to catch up
+        nextFrameUs = max(nextFrameUs + framePeriodUs, frameStartUs);
+
+        // Decide who gets this frame before capturing, so a fully backed-up
+        // set of viewers doesn't cost a capture at all
+        bool ready[STREAM_MAX_CLIENTS];
+        int readyCount = 0;
+        for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+            ready[i] = viewerActive[i] && viewerWritable(viewers[i]);
+            if (ready[i]) {
+                readyCount++;
+            }
+        }
+        uint32_t dropped = viewerCount - readyCount;
+        if (readyCount == 0) {
+            portENTER_CRITICAL(&statsMux);
+            stats.framesDropped += dropped;
+            portEXIT_CRITICAL(&statsMux);
+            continue;
+        }
+
+        // One capture is fanned out to every ready viewer. A still capture
+        // holds the camera in the reading profile; skip this slot if so.
+        // The camera stays held until the frame buffer is back with the
+        // driver, so a still capture can't switch profiles under it. That
+        // is at most STREAM_MAX_CLIENTS * STREAM_SEND_TIMEOUT_MS of sending.
+        if (!cameraAcquire(PROFILE_PREVIEW, pdMS_TO_TICKS(100))) {
+            continue;
+        }
+        camera_fb_t *fb = esp_camera_fb_get();
+        int64_t capturedUs = esp_timer_get_time();
+        if (!fb) {
+            cameraRelease();
+            Serial.println("Camera capture failed during stream");
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        char partHead[96];
+        int partHeadLen = snprintf(partHead, sizeof(partHead),
+            "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n", (unsigned)fb->len);
+
+        uint32_t sent = 0, slowViewers = 0;
+        for (int i = 0; i < STREAM_MAX_CLIENTS; i++) {
+            if (!ready[i]) {
+                continue;
+            }
+            bool slow = false;
+            if (sendFrame(viewers[i], partHead, partHeadLen, fb, slow)) {
+                sent++;
+            } else {
+                if (slow) {
+                    slowViewers++;
+                    Serial.println("Stream viewer too slow for a frame");
+                }
+                dropViewer(i);
+            }
+        }
+
+        esp_camera_fb_return(fb);
+        cameraRelease();
+        int64_t doneUs = esp_timer_get_time();
+
+        windowFrames++;
+        bool windowDone = doneUs - windowStartUs >= 1000000;
+
+        portENTER_CRITICAL(&statsMux);
+        stats.framesSent += sent;
+        stats.framesDropped += dropped;
+        stats.slowViewers += slowViewers;
+        stats.captureUs = smooth(stats.captureUs, capturedUs - frameStartUs);
+        stats.sendUs = smooth(stats.sendUs, doneUs - capturedUs);
+        if (windowDone) {
+            stats.achievedFps = windowFrames * 1000000.0f / (doneUs - windowStartUs);
+        }
+        portEXIT_CRITICAL(&statsMux);
+
+        if (windowDone) {
+            windowStartUs = doneUs;
+            windowFrames = 0;
+        }
+
+        if (millis() - lastLog >= STREAM_STATS_LOG_MS) {
+            StreamStats snapshot;
+            getStreamStats(snapshot);
+            Serial.printf("Stream: %.1f/%d FPS, %d viewers, capture %u ms, send %u ms, %u dropped\n",
+                          snapshot.achievedFps, STREAM_TARGET_FPS, snapshot.viewers,
+                          (unsigned)(snapshot.captureUs / 1000), (unsigned)(snapshot.sendUs / 1000),
+                          (unsigned)snapshot.framesDropped);
+            lastLog = millis();
+        }
+    }
+}
+
+bool startStreamServer() {
+    streamServer.begin();
+    streamServer.setNoDelay(true);
+
+    BaseType_t created = xTaskCreatePinnedToCore(
+        streamTask, "stream", STREAM_TASK_STACK_SIZE, NULL, 1, NULL, STREAM_TASK_CORE);
+    if (created != pdPASS) {
+        Serial.println("Failed to start stream task");
+        return false;
+    }
+
+    Serial.printf("Stream server started on port %d\n", STREAM_SERVER_PORT);
+    return true;
+}
+
+int streamClientCount() {
+    return viewerCount;
+}
+
+void getStreamStats(StreamStats &out) {
+    portENTER_CRITICAL(&statsMux);
+    out = stats;
+    portEXIT_CRITICAL(&statsMux);
+    out.viewers = viewerCount;
+    if (out.viewers == 0) {
+        out.achievedFps = 0;
+    }
+}
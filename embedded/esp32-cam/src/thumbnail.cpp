@@ -0,0 +1,165 @@
+#include "thumbnail.h"
+#include <esp_timer.h>
+#include <img_converters.h>
+#include "config.h"
+#include "jpeg_util.h"
+
+struct KeptFrame {
+    PooledFrame *frame;
+    int64_t keptUs;
+};
+
+static uint8_t *gray = NULL;
+static uint8_t *output = NULL;
+static KeptFrame kept[THUMBNAIL_KEEP_FRAMES];
+static portMUX_TYPE keepMux = portMUX_INITIALIZER_UNLOCKED;
+static ThumbnailStats stats;
+
+bool thumbnailInit() {
+    gray = (uint8_t *)ps_malloc(THUMBNAIL_GRAY_SIZE);
+    output = (uint8_t *)ps_malloc(THUMBNAIL_OUTPUT_SIZE);
+    if (!gray || !output) {
+        Serial.println("Thumbnail buffer allocation failed");
+        return false;
+    }
+    return true;
+}
+
+struct OutputCursor {
+    size_t len;
+    bool overflow;
+};
+
+static size_t writeOutput(void *arg, size_t index, const void *data, size_t len) {
+    OutputCursor *cursor = (OutputCursor *)arg;
+    if (index + len > THUMBNAIL_OUTPUT_SIZE) {
+        cursor->overflow = true;
+        return 0;
+    }
+    memcpy(output + index, data, len);
+    cursor->len = index + len;
+    return len;
+}
+
+bool thumbnailEncode(const PooledFrame *frame, const uint8_t *&out, size_t &outLen) {
+    int64_t start = esp_timer_get_time();
+    uint16_t frameWidth = frame->width;
+    uint16_t frameHeight = frame->height;
+    if (!gray || !output || frame->format != PIXFORMAT_JPEG ||
+        (!frameWidth && !jpegDimensions(frame->buf, frame->len, frameWidth, frameHeight))) {
+        stats.failures++;
+        return false;
+    }
+    int shift = 0;
+    while (shift < JPG_SCALE_8X && (frameWidth >> shift) > THUMBNAIL_MAX_WIDTH) {
+        shift++;
+    }
+
+    uint16_t width = 0, height = 0;
+    OutputCursor cursor = {0, false};
+    if (!jpegDecodeGray(frame->buf, frame->len, (jpg_scale_t)shift, gray, THUMBNAIL_GRAY_SIZE,
+                        width, height) ||
+        !fmt2jpg_cb(gray, (size_t)width * height, width, height, PIXFORMAT_GRAYSCALE,
+                    THUMBNAIL_JPEG_QUALITY, writeOutput, &cursor) ||
+        cursor.overflow) {
+        stats.failures++;
+        return false;
+    }
+
+    out = output;
+    outLen = cursor.len;
+    stats.encoded++;
+    stats.lastWidth = width;
+    stats.lastHeight = height;
+    stats.lastBytes = outLen;
+    stats.lastFullBytes = frame->len;
+    stats.lastUs = esp_timer_get_time() - start;
+    return true;
+}
+
+// Drop expired entries; call with keepMux held
+static void expireLocked(int64_t now) {
+    for (int i = 0; i < THUMBNAIL_KEEP_FRAMES; i++) {
+        if (kept[i].frame && now - kept[i].keptUs >= (int64_t)THUMBNAIL_KEEP_MS * 1000) {
+            framePoolRelease(kept[i].frame);
+            kept[i].frame = NULL;
+            stats.kept--;
+        }
+    }
+}
+
+void thumbnailKeepFull(PooledFrame *frame) {
+    int64_t now = esp_timer_get_time();
+    framePoolRetain(frame);
+    portENTER_CRITICAL(&keepMux);
+    expireLocked(now);
+    int slot = 0;
+    for (int i = 0; i < THUMBNAIL_KEEP_FRAMES; i++) {
+        if (!kept[i].frame) {
+            slot = i;
+            break;
+        }
+        if (kept[i].keptUs < kept[slot].keptUs) {
+            slot = i;
+        }
+    }
+    if (kept[slot].frame) {
+        framePoolRelease(kept[slot].frame);
+    } else {
+        stats.kept++;
+    }
+    kept[slot].frame = frame;
+    kept[slot].keptUs = now;
+    portEXIT_CRITICAL(&keepMux);
+}
+
+void thumbnailDropFull(uint32_t seq) {
+    portENTER_CRITICAL(&keepMux);
+    for (int i = 0; i < THUMBNAIL_KEEP_FRAMES; i++) {
+        if (kept[i].frame && kept[i].frame->seq == seq) {
+            framePoolRelease(kept[i].frame);
+            kept[i].frame = NULL;
+            stats.kept--;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&keepMux);
+}
+
+PooledFrame *thumbnailFullFrame(uint32_t seq) {
+    PooledFrame *found = NULL;
+    portENTER_CRITICAL(&keepMux);
+    expireLocked(esp_timer_get_time());
+    for (int i = 0; i < THUMBNAIL_KEEP_FRAMES; i++) {
+        if (kept[i].frame && kept[i].frame->seq == seq) {
+            found = kept[i].frame;
+            framePoolRetain(found);
+            break;
+        }
+    }
+    if (found) {
+        stats.fetched++;
+    } else {
+        stats.misses++;
+    }
+    portEXIT_CRITICAL(&keepMux);
+    return found;
+}
+
+void thumbnailExpire() {
+    portENTER_CRITICAL(&keepMux);
+    expireLocked(esp_timer_get_time());
+    portEXIT_CRITICAL(&keepMux);
+}
+
+void thumbnailHeaders(const PooledFrame *frame, char *buf, size_t size) {
+    size_t used = strlen(buf);
+    snprintf(buf + used, size - used, "X-Frame-Seq: %lu\r\nX-Full-Size: %u\r\n",
+             (unsigned long)frame->seq, (unsigned)frame->len);
+}
+
+void getThumbnailStats(ThumbnailStats &out) {
+    portENTER_CRITICAL(&keepMux);
+    out = stats;
+    portEXIT_CRITICAL(&keepMux);
+}
@@ -0,0 +1,129 @@
+#include "trace.h"
+#include "config.h"
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+
+static const char *STAGE_NAMES[TRACE_STAGE_COUNT] = {
+    "capture", "camera_wait", "warmup", "burst", "change", "edge_ocr", "encode",
+    "upload", "connect", "send", "reply", "spool", "wifi", "handler",
+};
+
+// A slot's `seq` is the number of the span in it plus one, written after
+// the event; 0 while a writer is filling it
+struct TraceSlot {
+    uint32_t seq;
+    TraceEvent event;
+};
+
+static TraceSlot ring[TRACE_RING_SIZE];
+static uint32_t head = 0;             // Spans ever recorded
+static char slowTrace[160] = "";
+static portMUX_TYPE slowMux = portMUX_INITIALIZER_UNLOCKED;
+
+void traceRecord(TraceStage stage, int64_t startUs, uint32_t durationUs, int32_t value) {
+    uint32_t n = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    TraceSlot &slot = ring[n & (TRACE_RING_SIZE - 1)];
+    __atomic_store_n(&slot.seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot.event.startUs = startUs;
+    slot.event.durationUs = durationUs;
+    slot.event.value = value;
+    slot.event.stage = stage;
+    slot.event.core = xPortGetCoreID();
+    __atomic_store_n(&slot.seq, n + 1, __ATOMIC_RELEASE);
+}
+
+void traceEnd(const TraceSpan &span, TraceStage stage, int32_t value) {
+    static uint32_t cpuMhz = 0;
+    if (cpuMhz == 0) {
+        cpuMhz = getCpuFreqMHz();
+    }
+    uint32_t cycles = ESP.getCycleCount() - span.startCycles;
+    int64_t elapsedUs = esp_timer_get_time() - span.startUs;
+    // The counter wraps every 2^32 cycles (about 18 s at 240 MHz); longer
+    // spans fall back to the microsecond timer
+    uint32_t durationUs = cycles / cpuMhz;
+    if (elapsedUs >= (int64_t)(UINT32_MAX / cpuMhz)) {
+        durationUs = (uint32_t)min(elapsedUs, (int64_t)UINT32_MAX);
+    }
+    traceRecord(stage, span.startUs, durationUs, value);
+}
+
+const char *traceStageName(TraceStage stage) {
+    return stage < TRACE_STAGE_COUNT ? STAGE_NAMES[stage] : "unknown";
+}
+
+// Copy span number `n` if it is still in the ring and not being rewritten
+static bool readSpan(uint32_t n, TraceEvent &out) {
+    const TraceSlot &slot = ring[n & (TRACE_RING_SIZE - 1)];
+    if (__atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE) != n + 1) {
+        return false;
+    }
+    out = slot.event;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot.seq, __ATOMIC_RELAXED) == n + 1;
+}
+
+int traceSnapshot(TraceEvent *out, int max) {
+    uint32_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32_t available = min(end, (uint32_t)TRACE_RING_SIZE);
+    uint32_t first = end - min(available, (uint32_t)max);
+    int count = 0;
+    for (uint32_t n = first; n != end; n++) {
+        if (readSpan(n, out[count])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+void traceReadingDone(uint32_t seq) {
+    uint32_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32_t first = end - min(end, (uint32_t)TRACE_RING_SIZE);
+
+    // The capture span of this frame, newest first
+    TraceEvent event;
+    int64_t startUs = -1;
+    for (uint32_t n = end; n != first; n--) {
+        if (readSpan(n - 1, event) && event.stage == TRACE_CAPTURE && (uint32_t)event.value == seq) {
+            startUs = event.startUs;
+            break;
+        }
+    }
+    int64_t totalUs = esp_timer_get_time() - startUs;
+    if (startUs < 0 || totalUs < (int64_t)TRACE_SLOW_MS * 1000) {
+        return;
+    }
+
+    // Everything but control requests that happened since, per stage
+    uint64_t stageUs[TRACE_STAGE_COUNT] = {};
+    for (uint32_t n = first; n != end; n++) {
+        if (readSpan(n, event) && event.startUs >= startUs && event.stage != TRACE_HANDLER) {
+            stageUs[event.stage] += event.durationUs;
+        }
+    }
+    char summary[sizeof(slowTrace)];
+    size_t len = snprintf(summary, sizeof(summary), "total=%lu", (unsigned long)(totalUs / 1000));
+    for (int i = 0; i < TRACE_STAGE_COUNT && len < sizeof(summary); i++) {
+        if (stageUs[i] >= 1000) {
+            len += snprintf(summary + len, sizeof(summary) - len, ",%s=%lu", STAGE_NAMES[i],
+                            (unsigned long)(stageUs[i] / 1000));
+        }
+    }
+    Serial.printf("Slow reading (frame %lu): %s\n", (unsigned long)seq, summary);
+
+    portENTER_CRITICAL(&slowMux);
+    memcpy(slowTrace, summary, sizeof(slowTrace));
+    portEXIT_CRITICAL(&slowMux);
+}
+
+void traceHeaders(char *buf, size_t size) {
+    size_t used = strlen(buf);
+    portENTER_CRITICAL(&slowMux);
+    // Kept for the next request if the line doesn't fit whole
+    if (slowTrace[0] && used + strlen(slowTrace) + 18 < size) {
+        snprintf(buf + used, size - used, "X-Slow-Trace: %s\r\n", slowTrace);
+        slowTrace[0] = '\0';
+    }
+    portEXIT_CRITICAL(&slowMux);
+}
@@ -0,0 +1,270 @@
+#include "uploader.h"
+#include <esp_timer.h>
+#include "http_util.h"
+#include "metrics.h"
+#include "trace.h"
+
+// One connection to the backend is kept open between uploads so each reading
+// doesn't pay for a TCP handshake. The mutex serialises requests on it.
+static WiFiClient backend;
+static SemaphoreHandle_t uploadMutex = NULL;
+static UploadStats stats;
+
+static bool ensureConnected(bool &reused) {
+    if (backend.connected()) {
+        reused = true;
+        return true;
+    }
+    reused = false;
+    backend.stop();
+    TraceSpan span = traceBegin();
+    bool connected = backend.connect(API_HOST, API_PORT, UPLOAD_TIMEOUT_MS);
+    traceEnd(span, TRACE_CONNECT, connected);
+    if (!connected) {
+        return false;
+    }
+    backend.setNoDelay(true);
+    stats.connects++;
+    return true;
+}
+
+// Reason a line could not be read: the peer hung up or it was too slow
+static int readError() {
+    return backend.connected() ? UPLOAD_ERR_READ_TIMEOUT : UPLOAD_ERR_CONNECTION_LOST;
+}
+
+// Read the status line, headers and (the head of) the body of a reply
+static int readReply(UploadResult &result, bool &keepOpen, unsigned long timeoutMs) {
+    // Status line, e.g. "HTTP/1.1 200 OK"
+    unsigned long deadline = millis() + timeoutMs;
+    char line[128];
+    if (!readHttpLine(backend, line, sizeof(line), deadline)) {
+        return readError();
+    }
+    int minor = 0;
+    int statusCode = 0;
+    if (sscanf(line, "HTTP/1.%d %d", &minor, &statusCode) != 2 || statusCode <= 0) {
+        return UPLOAD_ERR_NO_HTTP_SERVER;
+    }
+    bool reusable = minor >= 1;
+
+    // Headers: framing, connection handling and the backend's capture schedule
+    long contentLength = -1;
+    bool headersDone = false;
+    while (readHttpLine(backend, line, sizeof(line), deadline)) {
+        if (line[0] == '\0') {
+            headersDone = true;
+            break;
+        }
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            contentLength = atol(line + 15);
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line + 11, "close")) {
+            reusable = false;
+        } else if (strncasecmp(line, "X-Capture-Interval:", 19) == 0) {
+            result.captureIntervalMs = strtoul(line + 19, NULL, 10) * 1000;  // Seconds
+        }
+    }
+    if (!headersDone) {
+        return readError();
+    }
+
+    // Body: keep at most UPLOAD_RESPONSE_MAX bytes. Without a Content-Length
+    // the end of the body can't be found, so the connection is not reused.
+    size_t want = UPLOAD_RESPONSE_MAX;
+    if (contentLength >= 0 && (size_t)contentLength < want) {
+        want = contentLength;
+    }
+    while (result.responseLen < want && millis() < deadline) {
+        int avail = backend.available();
+        if (avail <= 0) {
+            if (!backend.connected()) {
+                break;
+            }
+            delay(1);
+            continue;
+        }
+        size_t toRead = min((size_t)avail, want - result.responseLen);
+        int n = backend.read((uint8_t *)result.response + result.responseLen, toRead);
+        if (n <= 0) {
+            break;
+        }
+        result.responseLen += n;
+    }
+    result.response[result.responseLen] = '\0';
+
+    if (contentLength < 0) {
+        result.responseTruncated = backend.available() > 0;
+        return statusCode;
+    }
+
+    // Discard the rest of a long reply so the next request starts clean
+    size_t remaining = contentLength - result.responseLen;
+    result.responseTruncated = remaining > 0;
+    uint8_t scratch[64];
+    while (remaining > 0 && millis() < deadline) {
+        int avail = backend.available();
+        if (avail <= 0) {
+            if (!backend.connected()) {
+                break;
+            }
+            delay(1);
+            continue;
+        }
+        int n = backend.read(scratch, min(sizeof(scratch), min((size_t)avail, remaining)));
+        if (n <= 0) {
+            break;
+        }
+        remaining -= n;
+    }
+
+    keepOpen = reusable && remaining == 0;
+    return statusCode;
+}
+
+// Send one request on the open connection and read its reply. `keepOpen` is
+// set when the reply was consumed completely and the server allows reuse.
+static int exchange(const char *path, const char *contentType, size_t len,
+                    UploadBodyWriter writeBody, void *ctx,
+                    const char *extraHeaders, UploadResult &result, bool &keepOpen,
+                    unsigned long replyTimeoutMs) {
+    keepOpen = false;
+    result.bytesSent = 0;
+    result.responseTruncated = false;
+    result.responseLen = 0;
+    result.captureIntervalMs = 0;
+    result.response[0] = '\0';
+
+    // Request head is formatted on the stack; Content-Length is known up front
+    // so the body can go out as-is without chunk framing.
+    char head[640];
+    int headLen = snprintf(head, sizeof(head),
+        "POST %s HTTP/1.1\r\n"
+        "Host: %s:%d\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %u\r\n"
+        "X-Device-ID: %s\r\n"
+        "X-Device-Name: %s\r\n"
+        "Connection: keep-alive\r\n"
+        "%s"
+        "\r\n",
+        path, API_HOST, API_PORT, contentType, (unsigned)len, DEVICE_ID, DEVICE_NAME,
+        extraHeaders ? extraHeaders : "");
+    TraceSpan span = traceBegin();
+    if (headLen <= 0 || (size_t)headLen >= sizeof(head) ||
+        backend.write((const uint8_t *)head, headLen) != (size_t)headLen) {
+        return UPLOAD_ERR_SEND_HEADER;
+    }
+
+    bool sent = writeBody(backend, ctx, result.bytesSent) && result.bytesSent == len;
+    traceEnd(span, TRACE_SEND, headLen + result.bytesSent);
+    if (!sent) {
+        return UPLOAD_ERR_SEND_PAYLOAD;
+    }
+
+    span = traceBegin();
+    int statusCode = readReply(result, keepOpen, replyTimeoutMs);
+    traceEnd(span, TRACE_REPLY, statusCode);
+    return statusCode;
+}
+
+bool uploadWriteAll(WiFiClient &client, const uint8_t *buf, size_t len, size_t &sent) {
+    size_t done = 0;
+    while (done < len) {
+        size_t written = client.write(buf + done, min(UPLOAD_CHUNK_SIZE, len - done));
+        if (written == 0) {
+            return false;
+        }
+        done += written;
+        sent += written;
+    }
+    return true;
+}
+
+struct BufferBody {
+    const uint8_t *buf;
+    size_t len;
+};
+
+static bool writeBufferBody(WiFiClient &client, void *ctx, size_t &sent) {
+    const BufferBody *body = (const BufferBody *)ctx;
+    return uploadWriteAll(client, body->buf, body->len, sent);
+}
+
+void uploaderInit() {
+    uploadMutex = xSemaphoreCreateMutex();
+}
+
+int uploadToBackend(const uint8_t *body, size_t len, const char *contentType,
+                    const char *extraHeaders, UploadResult &result) {
+    return postToBackend(API_ENDPOINT, body, len, contentType, extraHeaders, result);
+}
+
+int postToBackend(const char *path, const uint8_t *body, size_t len, const char *contentType,
+                  const char *extraHeaders, UploadResult &result) {
+    BufferBody buffer = {body, len};
+    return uploadStreamToBackend(path, contentType, len, writeBufferBody, &buffer,
+                                 extraHeaders, result);
+}
+
+int uploadStreamToBackend(const char *path, const char *contentType, size_t len,
+                          UploadBodyWriter writeBody, void *ctx,
+                          const char *extraHeaders, UploadResult &result,
+                          unsigned long replyTimeoutMs) {
+    xSemaphoreTake(uploadMutex, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    TraceSpan span = traceBegin();
+
+    int code = UPLOAD_ERR_CONNECT;
+    bool reused = false;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!ensureConnected(reused)) {
+            code = UPLOAD_ERR_CONNECT;
+            break;
+        }
+
+        bool keepOpen = false;
+        code = exchange(path, contentType, len, writeBody, ctx, extraHeaders, result, keepOpen,
+                        replyTimeoutMs);
+        if (!keepOpen) {
+            backend.stop();
+        }
+
+        // The server may have closed an idle connection just as we reused it.
+        // Only a request that couldn't be written completely is retried on a
+        // fresh connection: once the whole body is out the backend may have
+        // stored the reading, even if the reply never arrives, and sending it
+        // again would record it twice. A close the server sent while the
+        // connection was idle is already caught by ensureConnected().
+        bool staleSocket = code == UPLOAD_ERR_SEND_HEADER || code == UPLOAD_ERR_SEND_PAYLOAD;
+        if (!reused || !staleSocket) {
+            break;
+        }
+        stats.staleRetries++;
+    }
+
+    result.statusCode = code;
+    result.reusedConnection = reused;
+    result.latencyUs = esp_timer_get_time() - start;
+
+    stats.requests++;
+    if (code <= 0) {
+        stats.failures++;
+    }
+    if (reused) {
+        stats.reused++;
+    }
+    stats.lastLatencyUs = result.latencyUs;
+    stats.avgLatencyUs = stats.avgLatencyUs == 0
+        ? result.latencyUs
+        : stats.avgLatencyUs - stats.avgLatencyUs / 8 + result.latencyUs / 8;
+    stats.connected = backend.connected();
+
+    xSemaphoreGive(uploadMutex);
+    traceEnd(span, TRACE_UPLOAD, code);
+    metricObserve(METRIC_UPLOAD_MS, result.latencyUs / 1000);
+    return code;
+}
+
+void getUploadStats(UploadStats &out) {
+    out = stats;
+}
@@ -0,0 +1,214 @@
+#include "wifi_link.h"
+#include <WiFi.h>
+#include <Preferences.h>
+#include "config.h"
+#include "trace.h"
+
+static const uint32_t CACHE_MAGIC = 0x57424E31;  // "WBN1"
+
+// Everything needed to rejoin the network without a scan or DHCP
+struct NetworkCache {
+    uint32_t magic;
+    uint8_t bssid[6];
+    int32_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+// RTC memory survives resets and deep sleep but not power loss; NVS covers
+// brownouts and is only written when the network changes
+RTC_DATA_ATTR static NetworkCache rtcCache;
+static NetworkCache cache;
+
+enum LinkState {
+    LINK_CONNECTING = 0,       // Association in progress, since beginMs
+    LINK_UP,
+    LINK_BACKOFF               // Waiting backoffMs after a failed attempt
+};
+
+static LinkState state = LINK_CONNECTING;
+static bool fastAttempt = false;
+static bool usedFastPath = false;
+static bool eventsRegistered = false;
+static unsigned long beginMs = 0;
+static unsigned long backoffStartMs = 0;
+static unsigned long backoffMs = WIFI_RECONNECT_MIN_MS;
+// Set from the WiFi event task, consumed by wifiService()
+static volatile bool linkLost = false;
+static volatile uint8_t lostReason = 0;
+static WifiLinkStats stats;
+
+static bool loadCache() {
+    if (rtcCache.magic == CACHE_MAGIC) {
+        cache = rtcCache;
+        return true;
+    }
+    Preferences prefs;
+    bool loaded = false;
+    if (prefs.begin("wifi", true)) {
+        loaded = prefs.getBytesLength("cache") == sizeof(cache) &&
+                 prefs.getBytes("cache", &cache, sizeof(cache)) == sizeof(cache) &&
+                 cache.magic == CACHE_MAGIC;
+        prefs.end();
+    }
+    if (loaded) {
+        rtcCache = cache;
+    }
+    return loaded;
+}
+
+static void storeCache() {
+    NetworkCache current = {};
+    current.magic = CACHE_MAGIC;
+    const uint8_t *bssid = WiFi.BSSID();
+    if (!bssid) {
+        return;
+    }
+    memcpy(current.bssid, bssid, sizeof(current.bssid));
+    current.channel = WiFi.channel();
+    current.ip = WiFi.localIP();
+    current.gateway = WiFi.gatewayIP();
+    current.subnet = WiFi.subnetMask();
+    current.dns = WiFi.dnsIP();
+
+    rtcCache = current;
+    if (memcmp(&current, &cache, sizeof(current)) == 0) {
+        return;
+    }
+    cache = current;
+    Preferences prefs;
+    if (prefs.begin("wifi", false)) {
+        prefs.putBytes("cache", &current, sizeof(current));
+        prefs.end();
+    }
+}
+
+static void beginScan() {
+    fastAttempt = false;
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());  // Back to DHCP
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+}
+
+static void onWifiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+    if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+        lostReason = info.wifi_sta_disconnected.reason;
+        linkLost = true;
+    }
+}
+
+// Start an association attempt; the cached network first if there is one
+static void beginAttempt() {
+    state = LINK_CONNECTING;
+    beginMs = millis();
+    fastAttempt = FASTBOOT_ENABLED && loadCache();
+    usedFastPath = fastAttempt;
+    if (!fastAttempt) {
+        beginScan();
+        return;
+    }
+    if (FASTBOOT_REUSE_IP && cache.ip != 0) {
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet),
+                    IPAddress(cache.dns));
+    }
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, cache.channel, cache.bssid, true);
+}
+
+static void linkUp() {
+    state = LINK_UP;
+    linkLost = false;  // Including the events of our own disconnect()
+    backoffMs = WIFI_RECONNECT_MIN_MS;
+    stats.fastPath = usedFastPath;
+    stats.connects++;
+    stats.lastConnectMs = millis() - beginMs;
+    traceRecord(TRACE_WIFI, esp_timer_get_time() - (int64_t)stats.lastConnectMs * 1000,
+                stats.lastConnectMs * 1000, usedFastPath);
+    stats.backoffMs = 0;
+    storeCache();
+    if (stats.disconnects > 0) {
+        Serial.printf("WiFi reconnected in %u ms%s\n", (unsigned)stats.lastConnectMs,
+                      usedFastPath ? " (cached network)" : "");
+    }
+}
+
+void wifiBegin() {
+    Serial.print("Connecting to WiFi: ");
+    Serial.println(WIFI_SSID);
+
+    WiFi.persistent(false);  // The cache below replaces the SDK's own flash copy
+    WiFi.setAutoReconnect(false);  // wifiService() reconnects, with backoff
+    WiFi.mode(WIFI_STA);
+    if (!eventsRegistered) {
+        WiFi.onEvent(onWifiEvent);
+        eventsRegistered = true;
+    }
+    beginAttempt();
+}
+
+void wifiService() {
+    unsigned long now = millis();
+    switch (state) {
+    case LINK_UP:
+        if (!linkLost && WiFi.status() == WL_CONNECTED) {
+            return;
+        }
+        linkLost = false;
+        stats.disconnects++;
+        stats.lastDisconnectReason = lostReason;
+        Serial.printf("WiFi lost (reason %u), reconnecting\n", (unsigned)lostReason);
+        WiFi.disconnect();
+        beginAttempt();
+        return;
+
+    case LINK_CONNECTING:
+        if (WiFi.status() == WL_CONNECTED) {
+            linkUp();
+            return;
+        }
+        if (now - beginMs >= WIFI_CONNECT_TIMEOUT_MS) {
+            WiFi.disconnect();
+            state = LINK_BACKOFF;
+            backoffStartMs = now;
+            stats.backoffMs = backoffMs;
+            Serial.printf("WiFi connect failed, retrying in %lu ms\n", backoffMs);
+            return;
+        }
+        if (fastAttempt && now - beginMs >= FASTBOOT_WIFI_TIMEOUT_MS) {
+            // Access point moved or lease gone: do it the slow way
+            Serial.println("Cached network unavailable, scanning");
+            stats.fastPathFailures++;
+            usedFastPath = false;
+            WiFi.disconnect();
+            beginScan();
+        }
+        return;
+
+    case LINK_BACKOFF:
+        if (now - backoffStartMs >= backoffMs) {
+            backoffMs = min(backoffMs * 2, WIFI_RECONNECT_MAX_MS);
+            beginAttempt();
+        }
+        return;
+    }
+}
+
+bool wifiConnected() {
+    return state == LINK_UP;
+}
+
+bool wifiWaitConnected(unsigned long timeoutMs) {
+    unsigned long start = millis();
+    do {
+        wifiService();
+        if (state != LINK_CONNECTING) {
+            break;
+        }
+        delay(10);
+    } while (millis() - start < timeoutMs);
+    return state == LINK_UP;
+}
+
+void getWifiLinkStats(WifiLinkStats &out) {
+    out = stats;
+}